@@ -1,30 +1,477 @@
 #include "MemoryPool.hpp"
 
+#include <mutex>
+#include <atomic>
+
 MemoryPool* MemoryPool::GlobalPool = new MemoryPool(4096);
 
-MemoryPool::MemoryPool(std::size_t size)
+namespace
 {
-    length = size;
-    allocateNewBlock();
+    ///每个尺寸等级在线程本地缓存和中心仓库之间一次搬运的内存块数量,小内存块一次多搬一些
+    inline unsigned batchSize(std::size_t index)
+    {
+        std::size_t count = 4096 / ((index + 1) * MemoryPool::Alignment);
+        return static_cast<unsigned>(count < 4 ? 4 : (count > 64 ? 64 : count));
+    }
+
+    inline char* alignUp(char* ptr,std::size_t align)
+    {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+        return ptr + (align - addr % align) % align;
+    }
+
+    ///计数器只由所属线程写入,统计时由其他线程读取,所以不需要原子的读改写
+    inline void bump(std::atomic<std::uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+    }
 }
 
-MemoryPool::~MemoryPool()
+/**
+ * @brief The MemoryPool::Depot struct : 中心仓库,持有内存池申请的所有内存页和大对象,所有成员都由mutex保护
+ */
+struct MemoryPool::Depot
+{
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    ///大对象的头部,位于返回给使用者的地址之前,用来把所有大对象串成双向链表
+    struct LargeBlock
+    {
+        LargeBlock* prev;
+        LargeBlock* next;
+        void* raw;
+        std::size_t size;
+    };
+
+    Depot(std::size_t size,PageProvider* source):id(nextId()),provider(source),length(size){}
+
+    ~Depot()
+    {
+        clear();
+    }
+
+    static std::uint64_t nextId()
+    {
+        static std::atomic<std::uint64_t> counter{1};
+        return counter.fetch_add(1,std::memory_order_relaxed);
+    }
+
+    ///取出最多count个index等级的内存块,优先使用空闲链表,不足时从内存页中切割,返回链表头,实际数量写入count
+    FreeBlock* fetch(std::size_t index,unsigned& count)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const std::size_t size = (index + 1) * Alignment;
+        FreeBlock* head = nullptr;
+        unsigned taken = 0;
+        while (taken < count && freeList[index] != nullptr)
+        {
+            FreeBlock* block = freeList[index];
+            freeList[index] = block->next;
+            block->next = head;
+            head = block;
+            ++taken;
+        }
+
+        if(taken == 0 && std::size_t(end - cursor) < size)
+            allocateNewPage();
+
+        while (taken < count && std::size_t(end - cursor) >= size)
+        {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(cursor);
+            cursor += size;
+            block->next = head;
+            head = block;
+            ++taken;
+            ++carved[index];
+        }
+
+        count = taken;
+        outstanding += taken * size;
+        updatePeak();
+        return head;
+    }
+
+    ///把head到tail之间的count个内存块归还到index等级的空闲链表
+    void put(std::size_t index,FreeBlock* head,FreeBlock* tail,unsigned count)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        putLocked(index,head,tail,count);
+    }
+
+    void* allocateLarge(std::size_t size,std::size_t align)
+    {
+        const std::size_t total = sizeof (LargeBlock) + align + size;
+        char* raw = static_cast<char*>(::operator new(total));
+        char* address = alignUp(raw + sizeof (LargeBlock),align);
+        LargeBlock* header = reinterpret_cast<LargeBlock*>(address) - 1;
+        header->raw = raw;
+        header->size = total;
+        header->prev = nullptr;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        header->next = large;
+        if(large != nullptr)
+            large->prev = header;
+        large = header;
+        largeBytes += total;
+        ++largeAllocations;
+        updatePeak();
+        return address;
+    }
+
+    void releaseLarge(void* ptr)
+    {
+        LargeBlock* header = static_cast<LargeBlock*>(ptr) - 1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(header->prev != nullptr)
+                header->prev->next = header->next;
+            else
+                large = header->next;
+            if(header->next != nullptr)
+                header->next->prev = header->prev;
+            largeBytes -= header->size;
+            ++largeDeallocations;
+        }
+        ::operator delete(header->raw);
+    }
+
+    void reset();
+
+    void attach(LocalCache& cache);
+
+    void detach(LocalCache& cache,unsigned cacheGeneration);
+
+    PoolStats stats();
+
+private:
+    void putLocked(std::size_t index,FreeBlock* head,FreeBlock* tail,unsigned count)
+    {
+        tail->next = freeList[index];
+        freeList[index] = head;
+        outstanding -= count * (index + 1) * Alignment;
+    }
+
+    void updatePeak()
+    {
+        if(outstanding + largeBytes > peak)
+            peak = outstanding + largeBytes;
+    }
+
+    ///当前内存页剩余的空间按尺寸等级切割后挂到对应的空闲链表中,避免浪费,然后申请新的内存页
+    void allocateNewPage()
+    {
+        std::size_t remain = std::size_t(end - cursor);
+        while (remain >= Alignment)
+        {
+            std::size_t index = (remain > MaxBytes ? std::size_t(MaxBytes) : remain) / Alignment - 1;
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(cursor);
+            block->next = freeList[index];
+            freeList[index] = block;
+            cursor += (index + 1) * Alignment;
+            remain -= (index + 1) * Alignment;
+            ++carved[index];
+        }
+
+        char* raw = static_cast<char*>(provider->allocatePage(length + Alignment));
+        pages.push_back(raw);
+        cursor = alignUp(raw,Alignment);
+        end = cursor + length;
+    }
+
+    void clear()
+    {
+        for(char* page : pages)
+            provider->deallocatePage(page,length + Alignment);
+        pages.clear();
+
+        while (large != nullptr)
+        {
+            LargeBlock* next = large->next;
+            ::operator delete(large->raw);
+            large = next;
+        }
+
+        for(std::size_t i = 0; i < ClassCount; i++)
+        {
+            freeList[i] = nullptr;
+            carved[i] = 0;
+        }
+        cursor = end = nullptr;
+        outstanding = 0;
+        largeBytes = 0;
+    }
+
+public:
+    const std::uint64_t id;//内存池的唯一编号,不使用地址作为编号,因为析构之后的地址可能被新的内存池复用
+    std::atomic<unsigned> generation{0};//每次reset()加一,线程本地缓存通过它判断缓存的内存块是否已经被释放
+
+private:
+    std::mutex mutex;
+    PageProvider* const provider;
+    const std::size_t length;
+    FreeBlock* freeList[ClassCount] = {};
+    std::vector<char*> pages;
+    char* cursor = nullptr;
+    char* end = nullptr;
+    LargeBlock* large = nullptr;
+
+    //统计信息,线程本地缓存中的计数器在统计时汇总,缓存解绑时并入retired
+    std::vector<LocalCache*> caches;
+    std::uint64_t retiredAllocated[ClassCount] = {};
+    std::uint64_t retiredReleased[ClassCount] = {};
+    std::uint64_t baseline[ClassCount] = {};//reset()时仍在计数器中的使用量,计算正在使用的数量时扣除
+    std::size_t carved[ClassCount] = {};//reset()以来从内存页中切割出的内存块数量
+    std::size_t outstanding = 0;//从中心仓库取出、尚未归还的字节数
+    std::size_t largeBytes = 0;
+    std::size_t peak = 0;
+    std::uint64_t largeAllocations = 0;
+    std::uint64_t largeDeallocations = 0;
+};
+
+/**
+ * @brief The MemoryPool::LocalCache struct : 某个线程中某个内存池的本地缓存,只会被所属的线程修改,所以不需要加锁
+ */
+struct MemoryPool::LocalCache
+{
+    using FreeBlock = Depot::FreeBlock;
+
+    ~LocalCache()
+    {
+        flush();
+    }
+
+    void bind(const std::shared_ptr<Depot>& depot)
+    {
+        flush();
+        id = depot->id;
+        generation = depot->generation.load(std::memory_order_relaxed);
+        owner = depot;
+        depot->attach(*this);
+    }
+
+    ///内存池已经reset(),缓存的内存块已经被释放,直接丢弃
+    void discard(unsigned current)
+    {
+        for(std::size_t i = 0; i < ClassCount; i++)
+        {
+            freeList[i] = nullptr;
+            count[i] = 0;
+        }
+        generation = current;
+    }
+
+    ///把缓存的内存块和计数器全部归还给中心仓库,内存池已经析构时直接丢弃
+    void flush()
+    {
+        std::shared_ptr<Depot> depot = owner.lock();
+        if(depot)
+            depot->detach(*this,generation);
+        discard(generation);
+        for(std::size_t i = 0; i < ClassCount; i++)
+        {
+            allocated[i].store(0,std::memory_order_relaxed);
+            released[i].store(0,std::memory_order_relaxed);
+        }
+        owner.reset();
+        id = 0;
+    }
+
+    ///本地缓存过多时把一批内存块归还给中心仓库
+    void drain(Depot* depot,std::size_t index,unsigned batch)
+    {
+        FreeBlock* head = freeList[index];
+        FreeBlock* tail = head;
+        for(unsigned i = 1; i < batch; i++)
+            tail = tail->next;
+        freeList[index] = tail->next;
+        count[index] -= batch;
+        depot->put(index,head,tail,batch);
+    }
+
+    std::uint64_t id = 0;
+    unsigned generation = 0;
+    std::weak_ptr<Depot> owner;
+    FreeBlock* freeList[ClassCount] = {};
+    unsigned count[ClassCount] = {};
+    std::atomic<std::uint64_t> allocated[ClassCount] = {};
+    std::atomic<std::uint64_t> released[ClassCount] = {};
+};
+
+void MemoryPool::Depot::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    clear();
+    generation.fetch_add(1,std::memory_order_relaxed);
+    for(std::size_t i = 0; i < ClassCount; i++)
+    {
+        std::uint64_t used = retiredAllocated[i] - retiredReleased[i];
+        for(LocalCache* cache : caches)
+            used += cache->allocated[i].load(std::memory_order_relaxed) - cache->released[i].load(std::memory_order_relaxed);
+        baseline[i] = used;
+    }
+}
+
+void MemoryPool::Depot::attach(LocalCache& cache)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    caches.push_back(&cache);
+}
+
+void MemoryPool::Depot::detach(LocalCache& cache,unsigned cacheGeneration)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const bool current = generation.load(std::memory_order_relaxed) == cacheGeneration;
+    for(std::size_t i = 0; i < ClassCount; i++)
+    {
+        retiredAllocated[i] += cache.allocated[i].load(std::memory_order_relaxed);
+        retiredReleased[i] += cache.released[i].load(std::memory_order_relaxed);
+        if(!current || cache.freeList[i] == nullptr)
+            continue;
+
+        FreeBlock* tail = cache.freeList[i];
+        unsigned count = 1;
+        while (tail->next != nullptr)
+        {
+            tail = tail->next;
+            ++count;
+        }
+        putLocked(i,cache.freeList[i],tail,count);
+    }
+    caches.erase(std::find(caches.begin(),caches.end(),&cache));
+}
+
+PoolStats MemoryPool::Depot::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    PoolStats stats;
+    stats.bytesReserved = pages.size() * (length + Alignment) + largeBytes;
+    stats.bytesInUse = largeBytes;
+    stats.highWaterBytes = peak;
+    stats.allocations = largeAllocations;
+    stats.deallocations = largeDeallocations;
+    stats.sizeClasses.resize(ClassCount);
+    for(std::size_t i = 0; i < ClassCount; i++)
+    {
+        std::uint64_t allocations = retiredAllocated[i];
+        std::uint64_t deallocations = retiredReleased[i];
+        for(LocalCache* cache : caches)
+        {
+            allocations += cache->allocated[i].load(std::memory_order_relaxed);
+            deallocations += cache->released[i].load(std::memory_order_relaxed);
+        }
+
+        //各线程的计数器不是同一时刻读取的,使用量可能短暂地为负数或者超过切割出的数量
+        std::int64_t live = std::int64_t(allocations - deallocations - baseline[i]);
+        PoolStats::SizeClass& sizeClass = stats.sizeClasses[i];
+        sizeClass.blockSize = (i + 1) * Alignment;
+        sizeClass.live = live > 0 ? std::size_t(live) : 0;
+        sizeClass.free = carved[i] > sizeClass.live ? carved[i] - sizeClass.live : 0;
+
+        stats.bytesInUse += sizeClass.live * sizeClass.blockSize;
+        stats.allocations += allocations;
+        stats.deallocations += deallocations;
+    }
+    return stats;
+}
+
+MemoryPool::LocalCache& MemoryPool::localCache(const std::shared_ptr<Depot>& depot)
 {
-    std::vector<char*>::iterator it = poolVec.begin();
-    while (it != poolVec.end())
+    ///每个线程最多同时缓存CacheSlots个内存池,超出时轮流淘汰
+    struct LocalCacheSlots
+    {
+        enum {CacheSlots = 4};
+        LocalCache slots[CacheSlots];
+        unsigned victim = 0;
+    };
+
+    static thread_local LocalCacheSlots local;
+    for(LocalCache& cache : local.slots)
     {
-        ::operator delete(*it);
-        ++it;
+        if(cache.id == depot->id)
+        {
+            unsigned current = depot->generation.load(std::memory_order_relaxed);
+            if(cache.generation != current)
+                cache.discard(current);
+            return cache;
+        }
     }
+
+    LocalCache& cache = local.slots[local.victim++ % LocalCacheSlots::CacheSlots];
+    cache.bind(depot);
+    return cache;
+}
+
+MemoryPool::MemoryPool(std::size_t size,PageProvider* provider)
+    :depot(std::make_shared<Depot>(size < 4 * MaxBytes ? 4 * MaxBytes : size,provider != nullptr ? provider : PageProvider::heap()))
+{
+}
+
+MemoryPool::~MemoryPool()
+{
+    //线程本地缓存中可能还有中心仓库的引用,释放最后一个引用时中心仓库析构并释放所有内存
+}
+
+void MemoryPool::reset()
+{
+#ifdef MEMORYPOOL_DEBUG
+    debugger.clear();
+#endif
+    depot->reset();
 }
 
-void MemoryPool::allocateNewBlock()
+PoolStats MemoryPool::stats() const
 {
-    char* buf = static_cast<char*>(::operator new(length));
-    if(buf)
+    return depot->stats();
+}
+
+void* MemoryPool::allocateBlock(std::size_t size)
+{
+    if(size > MaxBytes)
+        return depot->allocateLarge(size,Alignment);
+
+    const std::size_t index = (size + Alignment - 1) / Alignment - 1;
+    LocalCache& cache = localCache(depot);
+    LocalCache::FreeBlock* block = cache.freeList[index];
+    if(block == nullptr)
     {
-        pool = buf;
-        offset = 0;
-        poolVec.push_back(buf);
+        unsigned count = batchSize(index);
+        block = depot->fetch(index,count);
+        cache.freeList[index] = block->next;
+        cache.count[index] = count - 1;
     }
+    else
+    {
+        cache.freeList[index] = block->next;
+        --cache.count[index];
+    }
+    bump(cache.allocated[index]);
+    return block;
+}
+
+void* MemoryPool::allocateLarge(std::size_t size,std::size_t align)
+{
+    return depot->allocateLarge(size,align);
+}
+
+void MemoryPool::releaseBlock(void* ptr,std::size_t size) noexcept
+{
+    const std::size_t index = (size + Alignment - 1) / Alignment - 1;
+    LocalCache& cache = localCache(depot);
+    LocalCache::FreeBlock* block = static_cast<LocalCache::FreeBlock*>(ptr);
+    block->next = cache.freeList[index];
+    cache.freeList[index] = block;
+    bump(cache.released[index]);
+
+    const unsigned batch = batchSize(index);
+    if(++cache.count[index] > 2 * batch)
+        cache.drain(depot.get(),index,batch);
+}
+
+void MemoryPool::releaseLarge(void* ptr) noexcept
+{
+    depot->releaseLarge(ptr);
 }
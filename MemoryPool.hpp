@@ -6,149 +6,552 @@
 #include <list>
 #include <unordered_map>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include "PageProvider.hpp"
+#include "PoolDiagnostics.hpp"
 
 /**
- * @brief The MemoryPool class : 专门为消息包装器定制的内存池
- * 这是一个简陋的内存池,是为了代替::operator new分配地址,确保给***生命周期伴随整个程序运行***的小对象分配的内存是连续的,减少内存散布
- * 内存池会返回一个地址,为了避免内存频繁分配和回收,依然需要在外部配合placement new使用
+ * @brief The MemoryPool class : 线程安全、可复用的小对象内存池
+ * 内存池按16字节的粒度把不超过512字节的内存块划分为32个尺寸等级,每个尺寸等级维护一条侵入式空闲链表,链表指针直接存放在空闲块内部,
+ * deallocate()回收的内存块会挂回对应尺寸等级的空闲链表中被后续的allocate()复用,而不是像以前一样只调用析构函数
+ *
+ * 每个线程为每个内存池维护一份线程本地缓存,分配和回收都优先在本地缓存中完成,不需要加锁;
+ * 本地缓存为空时从中心仓库(Depot)批量取出一批内存块,本地缓存过多时再批量归还给中心仓库,只有批量操作才需要获取中心仓库的锁,
+ * 所以多个线程同时使用同一个内存池时不会在一把全局锁上排队
+ *
+ * 超过512字节或者对齐要求超过16字节的对象直接由::operator new分配,但是依然由内存池记录,在reset()或者内存池析构时一起释放
  *
- * 临时对象不要使用这个内存池，这个内存池没有真正意义上实现内存复用
+ * reset()会一次性释放内存池分配过的所有内存,内存池中尚未回收的对象的析构函数不会被调用,调用reset()时不能有其他线程正在使用这个内存池
+ * deallocate()必须使用与allocate()相同的类型T,因为内存块的尺寸等级是根据sizeof(T)计算的
+ *
+ * 定义MEMORYPOOL_DEBUG时每个内存块前后带有护栏,内存池析构时报告泄漏、重复释放和护栏被改写的内存块,参考PoolDebugger
  */
 class MemoryPool
 {
 public:
+    static constexpr std::size_t Alignment = 16;//内存块的对齐粒度,同时也是尺寸等级的步长
+
+    static constexpr std::size_t ClassCount = 32;//尺寸等级的数量
+
+    static constexpr std::size_t MaxBytes = Alignment * ClassCount;//可以由尺寸等级分配的最大内存块,更大的对象直接由::operator new分配
+
     static MemoryPool* GlobalPool;
 
-    MemoryPool(std::size_t size = 1024);
+    ///size是内存池每次申请的内存页的大小,不足4倍MaxBytes时按4倍MaxBytes申请;provider为内存页的来源,为空时使用PageProvider::heap()
+    MemoryPool(std::size_t size = 1024,PageProvider* provider = nullptr);
 
     ~MemoryPool();
 
+    MemoryPool(const MemoryPool&) = delete;
+
+    MemoryPool& operator = (const MemoryPool&) = delete;
+
     template<typename T,typename...Args>
     T* allocate(Args&&...args)
     {
-        if(sizeof(T) > length)
+        void* address = allocateBytes(sizeof (T),std::alignment_of<T>::value);
+        if(address == nullptr)
             return nullptr;
 
-        //计算指针的内存对齐位置
-        auto aligneCalculate = [this]()
+        try
         {
-            uintptr_t addr = reinterpret_cast<uintptr_t>(pool+offset);
-            if(addr % std::alignment_of<T>::value != 0)
-                offset = offset + (std::alignment_of<T>::value - addr % std::alignment_of<T>::value);
-        };
-        aligneCalculate();
-
-        if(offset + sizeof (T) > length)
-        {
-            allocateNewBlock();
-            //重新分配内存之后要重新计算对齐位置
-            aligneCalculate();
+            return ::new (address) T(std::forward<Args>(args)...);
         }
-
-        //如果重新分配内存块之后还是不够，则直接返回空指针
-        if(offset + sizeof (T) <= length)
+        catch(...)
         {
-            if(pool != nullptr)
-            {
-                void* address = pool + offset;
-                offset += sizeof (T);
-                return ::new (address) T(std::forward<Args>(args)...);
-            }
+            release(address,sizeof (T),std::alignment_of<T>::value);
+            throw;
         }
-
-        return nullptr;
     }
 
     template<typename T> typename std::enable_if<!std::is_void<T>::value>::type
-    deallocate(T*& ptr) const noexcept
+    deallocate(T*& ptr) noexcept
     {
         if(ptr)
         {
+#ifdef MEMORYPOOL_DEBUG
+            if(!debugger.check(ptr))
+                return;
+#endif
             ptr->~T();
-            //::operator delete(ptr);//这里不能delete指针,因为这个指针是placement new在内存块的这个地址上调用了构造函数,并没有分配内存
+            release(ptr,sizeof (T),std::alignment_of<T>::value);
+            ptr = nullptr;
         }
     }
 
     template<typename T> typename std::enable_if<std::is_void<T>::value>::type
-    deallocate(T*& ptr) const noexcept
+    deallocate(T*&) noexcept
     {
-        //::operator delete(ptr);//这里不能delete指针,因为这个指针是placement new在内存块的这个地址上调用了构造函数,并没有分配内存
+        //void*无法得知内存块的尺寸等级,所以不回收
     }
 
+    ///一次性释放内存池中的所有内存,所有线程本地缓存中属于这个内存池的内存块都会在下一次访问时被丢弃
+    void reset();
+
+    ///统计快照,尺寸等级中的live是所有线程计数器之和,在其他线程正在分配时只是近似值
+    PoolStats stats() const;
+
 private:
-    void allocateNewBlock();
+    friend class MemoryPoolResource;
+
+    template<typename> friend class PoolAllocator;
+
+    struct Depot;
+
+    struct LocalCache;
+
+    static LocalCache& localCache(const std::shared_ptr<Depot>& depot);
+
+    void* allocateBlock(std::size_t size);
+
+    void* allocateLarge(std::size_t size,std::size_t align);
+
+    ///分配size字节、按align对齐的内存,供allocate()以及容器分配器使用
+    void* allocateBytes(std::size_t size,std::size_t align)
+    {
+#ifdef MEMORYPOOL_DEBUG
+        return debugger.track(allocateRaw(PoolDebugger::padded(size,align),align),size,align);
+#else
+        return allocateRaw(size,align);
+#endif
+    }
+
+    void release(void* ptr,std::size_t size,std::size_t align) noexcept
+    {
+#ifdef MEMORYPOOL_DEBUG
+        ptr = debugger.untrack(ptr,size,align);
+        if(ptr == nullptr)
+            return;
+        size = PoolDebugger::padded(size,align);
+#endif
+        releaseRaw(ptr,size,align);
+    }
+
+    void* allocateRaw(std::size_t size,std::size_t align)
+    {
+        if(size == 0)
+            size = 1;
+        return align > Alignment ? allocateLarge(size,align) : allocateBlock(size);
+    }
+
+    void releaseRaw(void* ptr,std::size_t size,std::size_t align) noexcept
+    {
+        if(size == 0)
+            size = 1;
+        if(size > MaxBytes || align > Alignment)
+            releaseLarge(ptr);
+        else
+            releaseBlock(ptr,size);
+    }
+
+    void releaseBlock(void* ptr,std::size_t size) noexcept;
+
+    void releaseLarge(void* ptr) noexcept;
 
 private:
-    std::vector<char*> poolVec;
-    char* pool = nullptr;
-    std::size_t length = 0;
-    std::size_t offset = 0;
+    std::shared_ptr<Depot> depot;//线程本地缓存持有中心仓库的弱引用,线程退出时内存池可能已经析构
+#ifdef MEMORYPOOL_DEBUG
+    PoolDebugger debugger{"MemoryPool"};
+#endif
 };
 
+/**
+ * @brief The PoolAllocator class : 从MemoryPool中分配内存的标准容器分配器
+ * 可以作为std::vector、std::map、std::basic_string等容器的分配器,让一组容器共享同一个内存池,
+ * 容器全部析构之后调用MemoryPool::reset()即可一次性释放它们占用的所有内存
+ * 默认构造的PoolAllocator使用MemoryPool::GlobalPool
+ */
 template<typename T>
-class Allocator
+class PoolAllocator
 {
 public:
-    Allocator(std::size_t num)
+    using value_type = T;
+
+    PoolAllocator() noexcept : pool(MemoryPool::GlobalPool){}
+
+    PoolAllocator(MemoryPool& memoryPool) noexcept : pool(&memoryPool){}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : pool(other.pool){}
+
+    T* allocate(std::size_t n)
     {
-        poolSize = sizeof (T) * num;
-        allocateNewBlock();
+        if(n > std::size_t(-1) / sizeof (T))
+            throw std::bad_alloc();
+        return static_cast<T*>(pool->allocateBytes(n * sizeof (T),std::alignment_of<T>::value));
     }
 
-    ~Allocator()
+    void deallocate(T* ptr,std::size_t n) noexcept
     {
-        for(void* ptr : usedBlocks)
+        pool->release(ptr,n * sizeof (T),std::alignment_of<T>::value);
+    }
+
+    template<typename U>
+    bool operator == (const PoolAllocator<U>& other) const noexcept {return pool == other.pool;}
+
+    template<typename U>
+    bool operator != (const PoolAllocator<U>& other) const noexcept {return pool != other.pool;}
+
+private:
+    template<typename> friend class PoolAllocator;
+
+    MemoryPool* pool;
+};
+
+/**
+ * @brief The Allocator class : 固定类型T的对象池
+ * 对象池每次向系统申请一个能容纳num个T的slab,slab按照T的对齐要求对齐,空闲的槽位通过侵入式链表串起来,链表指针直接存放在空闲槽位内部,
+ * 所以allocate()和deallocate()都是O(1)的,并且除了申请slab之外不会产生任何额外的内存分配
+ *
+ * Magazine为false时对象池不加锁,只能在单个线程中使用;
+ * Magazine为true时每个线程为每个对象池持有一个弹匣(magazine),分配和回收优先在弹匣中完成,弹匣为空或者过满时才批量与中心仓库交换槽位,
+ * 这时对象池可以被多个线程同时使用,并且可以在一个线程中分配、在另一个线程中回收
+ *
+ * 对象池析构时会调用所有尚未回收的对象的析构函数,析构时不能有其他线程正在使用这个对象池
+ * 定义MEMORYPOOL_DEBUG时每个槽位在对象前后带有护栏,对象池析构时报告没有回收的对象以及它们的分配位置
+ */
+template<typename T,bool Magazine = false>
+class Allocator
+{
+#ifdef MEMORYPOOL_DEBUG
+    enum : std::size_t {Offset = PoolDebugger::front(std::alignment_of<T>::value)};//对象在槽位中的偏移
+
+    enum : std::size_t {SlotBytes = PoolDebugger::padded(sizeof (T),std::alignment_of<T>::value)};
+#else
+    enum : std::size_t {Offset = 0};
+
+    enum : std::size_t {SlotBytes = sizeof (T)};
+#endif
+
+    union Slot
+    {
+        Slot* next;
+        typename std::aligned_storage<SlotBytes,std::alignment_of<T>::value>::type storage;
+    };
+
+    enum {Capacity = 32};//弹匣的容量,弹匣中的槽位达到2倍容量时归还一半给中心仓库
+
+    struct Depot;
+
+    ///某个线程中某个对象池的弹匣,线程退出或者被其他对象池挤出时把槽位归还给中心仓库
+    struct MagazineCache
+    {
+        ~MagazineCache()
         {
-            T* obj = static_cast<T*>(ptr);
-            obj->~T();
+            unbind();
+        }
+
+        void bind(const std::shared_ptr<Depot>& depot)
+        {
+            unbind();
+            std::lock_guard<std::mutex> lock(depot->mutex);
+            depot->magazines.push_back(this);
+            id = depot->id;
+            owner = depot;
+        }
+
+        void unbind()
+        {
+            std::shared_ptr<Depot> depot = owner.lock();
+            if(depot)
+            {
+                std::lock_guard<std::mutex> lock(depot->mutex);
+                while (head != nullptr)
+                {
+                    Slot* slot = head;
+                    head = slot->next;
+                    depot->push(slot);
+                }
+                depot->allocations += allocated.load(std::memory_order_relaxed);
+                depot->deallocations += released.load(std::memory_order_relaxed);
+                depot->magazines.erase(std::find(depot->magazines.begin(),depot->magazines.end(),this));
+            }
+            head = nullptr;
+            count = 0;
+            allocated.store(0,std::memory_order_relaxed);
+            released.store(0,std::memory_order_relaxed);
+            id = 0;
+            owner.reset();
         }
 
-        for(void* pool : pools)
+        ///计数器只由所属线程写入,统计时由其他线程读取
+        static void bump(std::atomic<std::uint64_t>& counter)
         {
-            ::operator delete(pool);
+            counter.store(counter.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
         }
+
+        std::uint64_t id = 0;
+        std::weak_ptr<Depot> owner;
+        Slot* head = nullptr;
+        unsigned count = 0;
+        std::atomic<std::uint64_t> allocated{0};
+        std::atomic<std::uint64_t> released{0};
+    };
+
+    ///中心仓库,持有所有slab和空闲链表,Magazine为true时由mutex保护
+    struct Depot
+    {
+        Depot(std::size_t num):id(nextId()),slotCount(num == 0 ? 1 : num){}
+
+        ~Depot()
+        {
+            for(void* slab : slabs)
+                ::operator delete(slab);
+        }
+
+        static std::uint64_t nextId()
+        {
+            static std::atomic<std::uint64_t> counter{1};
+            return counter.fetch_add(1,std::memory_order_relaxed);
+        }
+
+        void push(Slot* slot)
+        {
+            slot->next = freeList;
+            freeList = slot;
+            --outstanding;
+        }
+
+        Slot* pop()
+        {
+            if(freeList == nullptr)
+                allocateNewBlock();
+            Slot* slot = freeList;
+            freeList = slot->next;
+            if(++outstanding > peak)
+                peak = outstanding;
+            return slot;
+        }
+
+        ///申请的内存多出一个Slot的对齐量,保证slab中的第一个槽位按照T的要求对齐
+        void allocateNewBlock()
+        {
+            char* buffer = static_cast<char*>(::operator new(sizeof (Slot) * slotCount + std::alignment_of<Slot>::value));
+            slabs.push_back(buffer);
+
+            uintptr_t addr = reinterpret_cast<uintptr_t>(buffer);
+            std::size_t align = std::alignment_of<Slot>::value;
+            Slot* first = reinterpret_cast<Slot*>(buffer + (align - addr % align) % align);
+            for(std::size_t i = slotCount; i > 0; i--)
+            {
+                first[i - 1].next = freeList;
+                freeList = first + i - 1;
+            }
+        }
+
+        ///遍历空闲链表和所有弹匣,对不在其中的槽位调用析构函数
+        void destroyLive()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<Slot*> idle;
+            for(Slot* slot = freeList; slot != nullptr; slot = slot->next)
+                idle.push_back(slot);
+            for(MagazineCache* magazine : magazines)
+                for(Slot* slot = magazine->head; slot != nullptr; slot = slot->next)
+                    idle.push_back(slot);
+            std::sort(idle.begin(),idle.end());
+
+            std::size_t align = std::alignment_of<Slot>::value;
+            for(char* buffer : slabs)
+            {
+                uintptr_t addr = reinterpret_cast<uintptr_t>(buffer);
+                Slot* first = reinterpret_cast<Slot*>(buffer + (align - addr % align) % align);
+                for(Slot* slot = first; slot != first + slotCount; slot++)
+                {
+                    if(!std::binary_search(idle.begin(),idle.end(),slot))
+                        object(slot)->~T();
+                }
+            }
+        }
+
+        const std::uint64_t id;
+        const std::size_t slotCount;
+        std::mutex mutex;
+        Slot* freeList = nullptr;
+        std::vector<char*> slabs;
+        std::vector<MagazineCache*> magazines;
+
+        //统计信息,弹匣中的计数器在统计时汇总,弹匣解绑时并入allocations和deallocations
+        std::size_t outstanding = 0;//从中心仓库取出、尚未归还的槽位数量
+        std::size_t peak = 0;
+        std::uint64_t allocations = 0;
+        std::uint64_t deallocations = 0;
+    };
+
+public:
+    ///num是每个slab能容纳的对象数量
+    Allocator(std::size_t num):depot(std::make_shared<Depot>(num)){}
+
+    ~Allocator()
+    {
+        destroyLive(std::is_trivially_destructible<T>());
     }
 
+    Allocator(const Allocator&) = delete;
+
+    Allocator& operator = (const Allocator&) = delete;
+
     template<typename...Args>
     T* allocate(Args&&...args)
     {
-        if(freeBlocks.empty())
-            allocateNewBlock();
-
-        T* ptr = static_cast<T*>(freeBlocks.front());
-        freeBlocks.pop_front();
-        usedBlocks.push_back(ptr);
-        return ::new (ptr) T(std::forward<Args>(args)...);
+        Slot* slot = acquire(std::integral_constant<bool,Magazine>());
+        void* address = &slot->storage;
+#ifdef MEMORYPOOL_DEBUG
+        address = debugger.track(address,sizeof (T),std::alignment_of<T>::value);
+#endif
+        try
+        {
+            return ::new (address) T(std::forward<Args>(args)...);
+        }
+        catch(...)
+        {
+#ifdef MEMORYPOOL_DEBUG
+            debugger.untrack(address,sizeof (T),std::alignment_of<T>::value);
+#endif
+            recycle(slot,std::integral_constant<bool,Magazine>());
+            throw;
+        }
     }
 
     void deallocate(T* ptr)
     {
+        if(ptr == nullptr)
+            return;
+#ifdef MEMORYPOOL_DEBUG
+        if(!debugger.check(ptr))
+            return;
+#endif
         ptr->~T();
-        usedBlocks.remove(ptr);
-        freeBlocks.push_back(ptr);
+        void* address = ptr;
+#ifdef MEMORYPOOL_DEBUG
+        address = debugger.untrack(ptr,sizeof (T),std::alignment_of<T>::value);
+#endif
+        recycle(static_cast<Slot*>(address),std::integral_constant<bool,Magazine>());
+    }
+
+    ///统计快照,只有一个尺寸等级,blockSize是槽位的大小
+    PoolStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(depot->mutex);
+        std::uint64_t allocations = depot->allocations;
+        std::uint64_t deallocations = depot->deallocations;
+        for(MagazineCache* magazine : depot->magazines)
+        {
+            allocations += magazine->allocated.load(std::memory_order_relaxed);
+            deallocations += magazine->released.load(std::memory_order_relaxed);
+        }
+
+        PoolStats stats;
+        const std::size_t capacity = depot->slabs.size() * depot->slotCount;
+        const std::int64_t live = std::int64_t(allocations - deallocations);
+        PoolStats::SizeClass sizeClass;
+        sizeClass.blockSize = sizeof (Slot);
+        sizeClass.live = live > 0 ? std::size_t(live) : 0;
+        sizeClass.free = capacity > sizeClass.live ? capacity - sizeClass.live : 0;
+        stats.sizeClasses.push_back(sizeClass);
+
+        stats.bytesReserved = depot->slabs.size() * (sizeof (Slot) * depot->slotCount + std::alignment_of<Slot>::value);
+        stats.bytesInUse = sizeClass.live * sizeof (Slot);
+        stats.highWaterBytes = depot->peak * sizeof (Slot);
+        stats.allocations = allocations;
+        stats.deallocations = deallocations;
+        return stats;
     }
 
 private:
-    void allocateNewBlock()
+    static T* object(Slot* slot)
     {
-        void* buffer = nullptr;
-        while (!buffer)
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(&slot->storage) + Offset);
+    }
+
+    Slot* acquire(std::false_type)
+    {
+        ++depot->allocations;
+        return depot->pop();
+    }
+
+    void recycle(Slot* slot,std::false_type)
+    {
+        ++depot->deallocations;
+        depot->push(slot);
+    }
+
+    Slot* acquire(std::true_type)
+    {
+        MagazineCache& magazine = localMagazine();
+        if(magazine.head == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(depot->mutex);
+            for(unsigned i = 0; i < Capacity; i++)
+            {
+                Slot* slot = depot->pop();
+                slot->next = magazine.head;
+                magazine.head = slot;
+            }
+            magazine.count = Capacity;
+        }
+
+        Slot* slot = magazine.head;
+        magazine.head = slot->next;
+        --magazine.count;
+        MagazineCache::bump(magazine.allocated);
+        return slot;
+    }
+
+    void recycle(Slot* slot,std::true_type)
+    {
+        MagazineCache& magazine = localMagazine();
+        slot->next = magazine.head;
+        magazine.head = slot;
+        MagazineCache::bump(magazine.released);
+        if(++magazine.count < 2 * Capacity)
+            return;
+
+        std::lock_guard<std::mutex> lock(depot->mutex);
+        for(unsigned i = 0; i < Capacity; i++)
         {
-            buffer = ::operator new(poolSize);//这里分配的内存有可能没有对齐
+            Slot* extra = magazine.head;
+            magazine.head = extra->next;
+            depot->push(extra);
         }
+        magazine.count -= Capacity;
+    }
 
-        for(int i = 0; i < poolSize/sizeof (T); i++)
+    ///每个线程最多同时为MagazineSlots个同类型的对象池持有弹匣,超出时轮流淘汰
+    MagazineCache& localMagazine()
+    {
+        enum {MagazineSlots = 4};
+        static thread_local MagazineCache magazines[MagazineSlots];
+        static thread_local unsigned victim = 0;
+        for(MagazineCache& magazine : magazines)
         {
-            void* ptr = (static_cast<T*>(buffer) + i);
-            freeBlocks.push_back(ptr);
+            if(magazine.id == depot->id)
+                return magazine;
         }
+
+        MagazineCache& magazine = magazines[victim++ % MagazineSlots];
+        magazine.bind(depot);
+        return magazine;
+    }
+
+    template<typename,bool> friend class AllocatorResource;
+
+    void destroyLive(std::true_type){}
+
+    void destroyLive(std::false_type)
+    {
+        depot->destroyLive();
     }
 
 private:
-    std::size_t poolSize;//size of single pool
-    std::vector<void*> pools;//collection of pool
-    std::list<void*> usedBlocks;
-    std::list<void*> freeBlocks;
+    std::shared_ptr<Depot> depot;//弹匣持有中心仓库的弱引用,线程退出时对象池可能已经析构
+#ifdef MEMORYPOOL_DEBUG
+    PoolDebugger debugger{"Allocator"};
+#endif
 };
 
 #endif // MEMORYPOOL_HPP
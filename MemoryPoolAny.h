@@ -5,17 +5,28 @@
 #include <cstddef>
 #include <vector>
 #include <list>
-#include <unordered_map>
+#include <string>
+#include <mutex>
 #include <iostream>
 #include <atomic>
 #include <thread>
+
+#include "PageProvider.hpp"
+#include "PoolDiagnostics.hpp"
+
 /**
- * @brief The MemoryPoolAny class **需要加锁保证线程安全
- * MemoryPoolAny被分为一级分配器和二级分配器,一级分配器用来分配大于256字节的内存块,二级分配器用来分配小于256字节的内存,分配器分配的内存都会被添加到哈希表中复用(目前只有二级分配器的内存会被复用)
+ * @brief The MemoryPoolAny class : 线程安全的任意类型内存池
+ * MemoryPoolAny被分为一级分配器和二级分配器,一级分配器用来分配大于256字节(或者对齐要求超过8字节)的内存块,直接使用::operator new;
+ * 二级分配器用来分配不超过256字节的内存,内存块的大小补足到8的整倍数,一共32个尺寸等级,每个尺寸等级维护一条侵入式单向空闲链表,
+ * 链表指针直接存放在空闲内存块内部,所以回收和复用内存块都不会产生额外的内存分配
  *
- * 分配内存时优先从哈希表的空闲内存块中寻找可用的内存块,没有可用的内存块就从当前内存页中分配
- * 如果内存页剩余的空间不足以分配一个对应的内存块,则内存页剩余的空间按使用情况切割成块,添加到哈希表中,避免内存浪费
+ * 分配内存时优先从对应尺寸等级的空闲链表中取出内存块,没有可用的内存块就从当前内存页中切割
+ * 如果内存页剩余的空间不足以分配一个对应的内存块,则内存页剩余的空间按尺寸等级切割成块,挂到对应的空闲链表中,避免内存浪费
  * 随后新申请一个内存页,从新的内存页中分配内存块给申请者
+ *
+ * 二级分配器的空闲链表和内存页由自旋锁保护,临界区只有几条指令,所以多个线程可以同时使用同一个内存池
+ *
+ * stats()返回各尺寸等级的使用情况,定义MEMORYPOOL_DEBUG时每个内存块前后带有护栏,内存池析构时报告泄漏和重复释放,参考PoolDebugger
  */
 
 class MemoryPoolAny
@@ -25,7 +36,12 @@ class MemoryPoolAny
     public:
         void lock()
         {
-            while (flag.test_and_set(std::memory_order_acquire)){}
+            //自旋一段时间仍然拿不到锁时让出CPU,避免持有锁的线程被抢占后其他线程空转整个时间片
+            for(unsigned spin = 0; flag.test_and_set(std::memory_order_acquire); spin++)
+            {
+                if(spin >= 64)
+                    std::this_thread::yield();
+            }
         }
 
         void unlock()
@@ -33,26 +49,32 @@ class MemoryPoolAny
             flag.clear(std::memory_order_release);
         }
     private:
-        std::atomic_flag flag;
+        std::atomic_flag flag = ATOMIC_FLAG_INIT;
     };
 
-    enum {MINBYTES = 8};//最小内存块大小,这样可以保证绝大多数内存块都是内存对齐的,但是缺点就是会造成内存空间浪费
+    ///空闲内存块,next指针直接存放在内存块内部
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
 
-    enum {MAXBYTES = 256};//一级分配器和二级分配器的界限
+    static constexpr std::size_t MINBYTES = 8;//最小内存块大小,同时也是尺寸等级的步长,保证二级分配器分配的内存块都按8字节对齐
 
-    enum {PAGESIZE = 8192};//内存页的大小
+    static constexpr std::size_t MAXBYTES = 256;//一级分配器和二级分配器的界限
 
-    ///将T所需的内存大小补足到8的整倍数
-    template<typename T>
-    struct SizeUp
-    {
-        constexpr static unsigned value = sizeof(T) + MINBYTES - sizeof(T)%MINBYTES;
-    };
+    static constexpr std::size_t CLASSCOUNT = MAXBYTES / MINBYTES;//二级分配器尺寸等级的数量
+
+    static constexpr std::size_t PAGESIZE = 8192;//内存页的大小
 
 public:
-    MemoryPoolAny(){}
+    ///provider为内存页的来源,为空时使用PageProvider::heap()
+    MemoryPoolAny(PageProvider* provider = nullptr):provider(provider != nullptr ? provider : PageProvider::heap()){}
 
-    ~MemoryPoolAny(){}
+    ~MemoryPoolAny()
+    {
+        for(void* page : pages)
+            provider->deallocatePage(page,PAGESIZE);
+    }
 
     MemoryPoolAny(const MemoryPoolAny&) = delete ;
 
@@ -66,10 +88,19 @@ public:
     typename std::enable_if<!std::is_void<T>::value , T*>::type
     construct(Args&&...args)
     {
-        void* buf  = allocateBuffer<T>();
-        if(buf != nullptr)
-            ::new (buf) T(std::forward<Args>(args)...);
-        return static_cast<T*>(buf);
+        void* buf  = allocateBytes(sizeof(T),std::alignment_of<T>::value);
+        if(buf == nullptr)
+            return nullptr;
+
+        try
+        {
+            return ::new (buf) T(std::forward<Args>(args)...);
+        }
+        catch(...)
+        {
+            releaseBytes(buf,sizeof(T),std::alignment_of<T>::value);
+            throw;
+        }
     }
 
     template<typename T,typename...Args>
@@ -80,129 +111,227 @@ public:
     typename std::enable_if<!std::is_void<T>::value>::type
     destruct(T* obj)
     {
+        if(obj == nullptr)
+            return;
+#ifdef MEMORYPOOL_DEBUG
+        if(!debugger.check(obj))
+            return;
+#endif
         obj->~T();
-        if(SizeUp<T>::value > MAXBYTES)
-            ::operator delete(obj);
-        else
-            freeBlocks.emplace(unsigned(SizeUp<T>::value),obj);
+        releaseBytes(obj,sizeof(T),std::alignment_of<T>::value);
     }
 
-    void printPoolStatus()
+    ///统计快照,sizeClasses是二级分配器的32个尺寸等级,一级分配器分配的内存只计入字节数和次数
+    PoolStats stats() const
     {
-        auto freeIt = freeBlocks.cbegin();
+        std::lock_guard<SpinLock> lock(spinLock);
+        PoolStats stats;
+        stats.bytesReserved = pages.size() * PAGESIZE + largeBytes;
+        stats.bytesInUse = inUseBytes;
+        stats.highWaterBytes = peakBytes;
+        stats.allocations = allocations;
+        stats.deallocations = deallocations;
+        stats.sizeClasses.resize(CLASSCOUNT);
+        for(unsigned index = 0; index < CLASSCOUNT; index++)
+        {
+            stats.sizeClasses[index].blockSize = (index + 1) * MINBYTES;
+            stats.sizeClasses[index].live = live[index];
+            stats.sizeClasses[index].free = carved[index] - live[index];
+        }
+        return stats;
+    }
 
+    void printPoolStatus()
+    {
+        PoolStats status = stats();
         std::string info  = "FreeBlocks status:";
-        while (freeIt != freeBlocks.cend())
+        for(const PoolStats::SizeClass& sizeClass : status.sizeClasses)
         {
-            int key = (*freeIt).first;
-            if( key > MAXBYTES)
-                break;
-
-            int count = freeBlocks.count(key);
-            info += std::to_string(key) + "-" + std::to_string(count) + "   ";
-            ++freeIt;
+            if(sizeClass.free != 0)
+                info += std::to_string(sizeClass.blockSize) + "-" + std::to_string(sizeClass.free) + "   ";
         }
         std::cout<<info<<std::endl<<std::flush;
     }
 
 private:
-    void* allocateNewPage()
-    {
-        void* buffer = ::operator new(PAGESIZE);
-        if(buffer == nullptr)
-            throw std::bad_alloc();
+    friend class MemoryPoolAnyResource;
 
+    void allocateNewPage()
+    {
+        void* buffer = provider->allocatePage(PAGESIZE);
         offset = 0;
         pages.push_back(buffer);
-        return buffer;
     }
 
-    template<typename T>
-    typename std::enable_if<(sizeof(T)>MAXBYTES),void*>::type allocateBuffer()
+    ///将内存大小补足到8的整倍数
+    static unsigned sizeUp(std::size_t size)
     {
-        return ::operator new(sizeof(T));
+        return unsigned((size == 0 ? 1 : size) + MINBYTES - 1) / MINBYTES * MINBYTES;
     }
 
-    template<typename T>
-    typename std::enable_if<(sizeof(T)<=MAXBYTES),void*>::type allocateBuffer()
+    ///是否由二级分配器分配
+    static bool isSmall(std::size_t size,std::size_t align)
     {
-        unsigned size = SizeUp<T>::value;
+        return size <= MAXBYTES && align <= MINBYTES;
+    }
 
-        void* buf = findFromHashTable(size);
+    ///分配size字节、按align对齐的内存,供construct()以及MemoryPoolAnyResource使用
+    void* allocateBytes(std::size_t size,std::size_t align)
+    {
+#ifdef MEMORYPOOL_DEBUG
+        return debugger.track(allocateRaw(PoolDebugger::padded(size,align),align),size,align);
+#else
+        return allocateRaw(size,align);
+#endif
+    }
 
+    void releaseBytes(void* buf,std::size_t size,std::size_t align)
+    {
+#ifdef MEMORYPOOL_DEBUG
+        buf = debugger.untrack(buf,size,align);
         if(buf == nullptr)
-            buf = findFromMemoryPage(size);
+            return;
+        size = PoolDebugger::padded(size,align);
+#endif
+        releaseRaw(buf,size,align);
+    }
 
+    void* allocateRaw(std::size_t size,std::size_t align)
+    {
+        if(isSmall(size,align))
+            return allocateSmall(sizeUp(size));
+
+        //一级分配器,C++17之后支持超过默认对齐的类型
+#if __cplusplus > 201402L
+        void* buf = align > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? ::operator new(size,std::align_val_t(align)) : ::operator new(size);
+#else
+        void* buf = ::operator new(size);
+#endif
+        std::lock_guard<SpinLock> lock(spinLock);
+        largeBytes += size;
+        countAllocation(size);
         return buf;
     }
 
-    ///从哈希表中查找一块合适的内存并返回
-    void* findFromHashTable(const unsigned size)
+    void releaseRaw(void* buf,std::size_t size,std::size_t align)
     {
-        std::unordered_multimap<unsigned,void*>::iterator it = freeBlocks.find(size);
-        if(it == freeBlocks.end())
+        if(isSmall(size,align))
         {
-            return nullptr;
+            releaseSmall(buf,sizeUp(size));
+            return;
+        }
+
+        {
+            std::lock_guard<SpinLock> lock(spinLock);
+            largeBytes -= size;
+            countDeallocation(size);
         }
-        else
+#if __cplusplus > 201402L
+        if(align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
         {
-            freeBlocks.erase(it);
-            return (*it).second;
+            ::operator delete(buf,std::align_val_t(align));
+            return;
         }
+#endif
+        ::operator delete(buf);
     }
 
-    ///从内存页中查找一块合适的内存并且返回
-    void* findFromMemoryPage(const unsigned size)
+    ///由二级分配器分配size字节的内存块,size必须是8的整倍数并且不超过MAXBYTES
+    void* allocateSmall(const unsigned size)
     {
-        if(pages.empty())
-            allocateNewPage();
+        std::lock_guard<SpinLock> lock(spinLock);
+        void* buf = findFromFreeList(size);
+        if(buf == nullptr)
+            buf = findFromMemoryPage(size);
+        ++live[size / MINBYTES - 1];
+        countAllocation(size);
+        return buf;
+    }
+
+    void releaseSmall(void* buf,const unsigned size)
+    {
+        std::lock_guard<SpinLock> lock(spinLock);
+        pushFreeBlock(buf,size);
+        --live[size / MINBYTES - 1];
+        countDeallocation(size);
+    }
 
-        //如果内存页剩余大小不足,则将内存页剩余空间切割挂载到哈希表中,切割完毕之后重新申请内存页
+    ///以下两个函数只能在持有spinLock时调用
+    void countAllocation(std::size_t size)
+    {
+        ++allocations;
+        inUseBytes += size;
+        if(inUseBytes > peakBytes)
+            peakBytes = inUseBytes;
+    }
+
+    void countDeallocation(std::size_t size)
+    {
+        ++deallocations;
+        inUseBytes -= size;
+    }
+
+    void pushFreeBlock(void* buf,const unsigned size)
+    {
+        FreeBlock* block = static_cast<FreeBlock*>(buf);
+        block->next = freeLists[size / MINBYTES - 1];
+        freeLists[size / MINBYTES - 1] = block;
+    }
+
+    ///从空闲链表中取出一块对应尺寸的内存并返回
+    void* findFromFreeList(const unsigned size)
+    {
+        FreeBlock* block = freeLists[size / MINBYTES - 1];
+        if(block != nullptr)
+            freeLists[size / MINBYTES - 1] = block->next;
+        return block;
+    }
+
+    ///从内存页中切割一块内存并且返回
+    void* findFromMemoryPage(const unsigned size)
+    {
+        //如果内存页剩余大小不足,则将内存页剩余空间切割挂载到空闲链表中,切割完毕之后重新申请内存页
         if(PAGESIZE - offset < size)
         {
-            cutPage(PAGESIZE - offset);
+            cutPage();
             allocateNewPage();
         }
 
-        void* buf = pages.back();  
+        void* buf = static_cast<char*>(pages.back()) + offset;
         offset += size;
+        ++carved[size / MINBYTES - 1];
         return buf;
     }
 
-    ///将内存页切割,按2的N次幂切割,直到大小不足MINBYTES
-    ///按照内存池分配策略,每一次分配的内存块都是8的整倍数,所以最后切割出来的内存块大小也一定是8的整倍数
-    void cutPage(std::size_t remainSize)
+    ///将内存页剩余的空间按尽可能大的尺寸等级切割,按照内存池分配策略,offset一定是8的整倍数,所以切割出来的内存块大小也一定是8的整倍数
+    void cutPage()
     {
-        if(PAGESIZE - offset <= MINBYTES)
-        {
-            void* block = static_cast<char*>(pages.back()) + offset;
-            freeBlocks.emplace(PAGESIZE-offset,block);
-        }
-        else
+        while (PAGESIZE - offset >= MINBYTES)
         {
-            std::size_t blockSize = sizeHelper(remainSize);
-
-            void* block = static_cast<char*>(pages.back()) + offset;
-            freeBlocks.emplace(PAGESIZE-offset,block);
+            std::size_t blockSize = PAGESIZE - offset > MAXBYTES ? std::size_t(MAXBYTES) : PAGESIZE - offset;
+            pushFreeBlock(static_cast<char*>(pages.back()) + offset,unsigned(blockSize));
             offset += blockSize;
-
-            cutPage(PAGESIZE - offset);
+            ++carved[blockSize / MINBYTES - 1];
         }
     }
 
-    ///计算小于size的最大的2的N次幂的值,默认从设定的最小内存块大小值开始查找
-    std::size_t sizeHelper(const std::size_t target,std::size_t now = MINBYTES)
-    {
-        if(now <= target && now*2 > target)
-            return now;
-        else
-            return sizeHelper(target,now*2);
-    }
-
 private:
-    std::size_t offset = 0;//内存页地址偏移,用于计算当前内存页是空余大小
+    PageProvider* const provider;
+    mutable SpinLock spinLock;//保护二级分配器的空闲链表、内存页以及统计信息
+    std::size_t offset = PAGESIZE;//内存页地址偏移,用于计算当前内存页是空余大小,初始值为PAGESIZE使得第一次分配时申请内存页
     std::vector<void*> pages;//内存页容器
-    std::unordered_multimap<unsigned,void*> freeBlocks;//空闲的内存块
+    FreeBlock* freeLists[CLASSCOUNT] = {};//每个尺寸等级的空闲内存块
+
+    std::size_t live[CLASSCOUNT] = {};//每个尺寸等级正在使用的内存块数量
+    std::size_t carved[CLASSCOUNT] = {};//每个尺寸等级从内存页中切割出的内存块数量
+    std::size_t largeBytes = 0;//一级分配器正在使用的字节数
+    std::size_t inUseBytes = 0;
+    std::size_t peakBytes = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+#ifdef MEMORYPOOL_DEBUG
+    PoolDebugger debugger{"MemoryPoolAny"};
+#endif
 };
 
 #endif // MEMORYPOOLANY_H
@@ -0,0 +1,132 @@
+#ifndef MEMORYRESOURCE_HPP
+#define MEMORYRESOURCE_HPP
+
+#include "MemoryPool.hpp"
+#include "MemoryPoolAny.h"
+
+///std::pmr需要C++17,低于C++17时这个头文件为空,可以使用MemoryPool.hpp中的PoolAllocator代替
+#if __cplusplus > 201402L
+#include <memory_resource>
+
+/**
+ * @brief The MemoryPoolResource class : 以MemoryPool为后端的std::pmr::memory_resource
+ * 不持有内存池,内存池的生命周期必须覆盖所有使用这个资源的容器
+ * 同一个请求内的对象图可以全部放在同一个MemoryPool中,容器析构之后调用MemoryPool::reset()一次性释放
+ */
+class MemoryPoolResource : public std::pmr::memory_resource
+{
+public:
+    explicit MemoryPoolResource(MemoryPool& memoryPool = *MemoryPool::GlobalPool) noexcept : pool(memoryPool){}
+
+    MemoryPool& memoryPool() const noexcept {return pool;}
+
+protected:
+    void* do_allocate(std::size_t bytes,std::size_t align) override
+    {
+        return pool.allocateBytes(bytes,align);
+    }
+
+    void do_deallocate(void* ptr,std::size_t bytes,std::size_t align) override
+    {
+        pool.release(ptr,bytes,align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        const MemoryPoolResource* resource = dynamic_cast<const MemoryPoolResource*>(&other);
+        return resource != nullptr && &resource->pool == &pool;
+    }
+
+private:
+    MemoryPool& pool;
+};
+
+/**
+ * @brief The MemoryPoolAnyResource class : 以MemoryPoolAny为后端的std::pmr::memory_resource
+ * 补足到8的整倍数之后不超过256字节、对齐要求不超过8字节的请求由二级分配器分配,其他请求使用对齐的::operator new,
+ * 两类请求都计入MemoryPoolAny::stats()
+ */
+class MemoryPoolAnyResource : public std::pmr::memory_resource
+{
+public:
+    explicit MemoryPoolAnyResource(MemoryPoolAny& memoryPool) noexcept : pool(memoryPool){}
+
+    MemoryPoolAny& memoryPool() const noexcept {return pool;}
+
+protected:
+    void* do_allocate(std::size_t bytes,std::size_t align) override
+    {
+        return pool.allocateBytes(bytes,align);
+    }
+
+    void do_deallocate(void* ptr,std::size_t bytes,std::size_t align) override
+    {
+        pool.releaseBytes(ptr,bytes,align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        const MemoryPoolAnyResource* resource = dynamic_cast<const MemoryPoolAnyResource*>(&other);
+        return resource != nullptr && &resource->pool == &pool;
+    }
+
+private:
+    MemoryPoolAny& pool;
+};
+
+/**
+ * @brief The AllocatorResource class : 以Allocator<T,Magazine>为后端的std::pmr::memory_resource
+ * 不超过一个槽位大小和对齐要求的请求从对象池中分配,其他请求转交给上游资源,适合std::pmr::list、std::pmr::map这类逐个分配节点的容器,
+ * 对象池析构时会对尚未回收的槽位调用~T,所以T必须是平凡析构的类型,通常使用与容器节点等大的存储类型作为T
+ */
+template<typename T,bool Magazine = false>
+class AllocatorResource : public std::pmr::memory_resource
+{
+    static_assert(std::is_trivially_destructible<T>::value,"AllocatorResource requires a trivially destructible slot type");
+
+    using Pool = Allocator<T,Magazine>;
+
+    using Slot = typename Pool::Slot;
+
+public:
+    explicit AllocatorResource(Pool& allocator,std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) noexcept
+        :pool(allocator),upstream(upstream){}
+
+    Pool& objectPool() const noexcept {return pool;}
+
+protected:
+    void* do_allocate(std::size_t bytes,std::size_t align) override
+    {
+        if(fits(bytes,align))
+            return pool.acquire(std::integral_constant<bool,Magazine>());
+        return upstream->allocate(bytes,align);
+    }
+
+    void do_deallocate(void* ptr,std::size_t bytes,std::size_t align) override
+    {
+        if(fits(bytes,align))
+            pool.recycle(static_cast<Slot*>(ptr),std::integral_constant<bool,Magazine>());
+        else
+            upstream->deallocate(ptr,bytes,align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        const AllocatorResource* resource = dynamic_cast<const AllocatorResource*>(&other);
+        return resource != nullptr && &resource->pool == &pool;
+    }
+
+private:
+    static bool fits(std::size_t bytes,std::size_t align)
+    {
+        return bytes <= sizeof (Slot) && align <= std::alignment_of<Slot>::value;
+    }
+
+private:
+    Pool& pool;
+    std::pmr::memory_resource* upstream;
+};
+
+#endif
+
+#endif // MEMORYRESOURCE_HPP
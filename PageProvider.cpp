@@ -0,0 +1,242 @@
+#include "PageProvider.hpp"
+
+#include <cstdint>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const std::size_t HugePageSize = std::size_t(2) << 20;
+
+    inline std::size_t roundUp(std::size_t size,std::size_t granularity)
+    {
+        return (size + granularity - 1) / granularity * granularity;
+    }
+
+    class HeapPageProvider : public PageProvider
+    {
+    public:
+        void* allocatePage(std::size_t size) override
+        {
+            return ::operator new(size);
+        }
+
+        void deallocatePage(void* page,std::size_t) noexcept override
+        {
+            ::operator delete(page);
+        }
+    };
+}
+
+PageProvider* PageProvider::heap()
+{
+    //不析构,静态对象中的内存池在程序退出时可能还会归还内存页
+    static PageProvider* provider = new HeapPageProvider;
+    return provider;
+}
+
+MappedPageProvider::MappedPageProvider()
+    :MappedPageProvider(Options())
+{
+}
+
+MappedPageProvider::MappedPageProvider(const Options& options)
+    :options(options)
+{
+    std::size_t prefaulted = 0;
+    while (prefaulted < options.prefaultBytes)
+    {
+        std::size_t size = options.regionSize;
+        char* base = map(size);
+        for(std::size_t offset = 0; offset < size; offset += 4096)
+            base[offset] = 0;
+
+        Region& region = regions[base];
+        region.size = size;
+        region.pinned = true;
+        prefaulted += size;
+    }
+}
+
+MappedPageProvider::~MappedPageProvider()
+{
+    for(auto& item : regions)
+        unmap(item.first,item.second.size);
+}
+
+void* MappedPageProvider::allocatePage(std::size_t size)
+{
+    size = roundUp(size == 0 ? 1 : size,64);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(size > options.regionSize)
+    {
+        std::size_t mapped = size;
+        char* base = map(mapped);
+        Region& region = regions[base];
+        region.size = mapped;
+        region.pageSize = size;
+        region.offset = mapped;
+        region.live = 1;
+        region.dedicated = true;
+        return base;
+    }
+
+    std::map<char*,Region>::iterator idle = regions.end();
+    for(auto it = regions.begin(); it != regions.end(); ++it)
+    {
+        Region& region = it->second;
+        if(region.dedicated)
+            continue;
+
+        if(region.pageSize == size)
+        {
+            if(region.freePages != nullptr)
+            {
+                FreePage* page = region.freePages;
+                region.freePages = page->next;
+                ++region.live;
+                return page;
+            }
+            if(region.offset + size <= region.size)
+            {
+                char* page = it->first + region.offset;
+                region.offset += size;
+                ++region.live;
+                return page;
+            }
+        }
+        else if(region.pageSize == 0 && idle == regions.end())
+        {
+            idle = it;
+        }
+    }
+
+    if(idle == regions.end())
+    {
+        std::size_t mapped = options.regionSize;
+        char* base = map(mapped);
+        idle = regions.emplace(base,Region()).first;
+        idle->second.size = mapped;
+    }
+
+    Region& region = idle->second;
+    region.pageSize = size;
+    region.offset = size;
+    region.live = 1;
+    return idle->first;
+}
+
+void MappedPageProvider::deallocatePage(void* page,std::size_t) noexcept
+{
+    if(page == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<char*,Region>::iterator it = regions.upper_bound(static_cast<char*>(page));
+    --it;
+    Region& region = it->second;
+    if(region.dedicated)
+    {
+        unmap(it->first,region.size);
+        regions.erase(it);
+        return;
+    }
+
+    FreePage* freePage = static_cast<FreePage*>(page);
+    freePage->next = region.freePages;
+    region.freePages = freePage;
+
+    //区域中的内存页全部归还,整个区域重新变为空闲,可以被切割成其他大小的内存页
+    if(--region.live == 0)
+    {
+        region.pageSize = 0;
+        region.offset = 0;
+        region.freePages = nullptr;
+        if(!region.pinned)
+            advise(it->first,region.size);
+    }
+}
+
+std::size_t MappedPageProvider::regionCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return regions.size();
+}
+
+std::size_t MappedPageProvider::idleRegionCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t count = 0;
+    for(const auto& item : regions)
+    {
+        if(item.second.live == 0)
+            ++count;
+    }
+    return count;
+}
+
+char* MappedPageProvider::map(std::size_t& size)
+{
+#if defined(__linux__)
+    const int protection = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if(options.hugePages == NoHugePages)
+    {
+        size = roundUp(size,std::size_t(sysconf(_SC_PAGESIZE)));
+        void* address = mmap(nullptr,size,protection,flags,-1,0);
+        if(address == MAP_FAILED)
+            throw std::bad_alloc();
+        return static_cast<char*>(address);
+    }
+
+    size = roundUp(size,HugePageSize);
+    if(options.hugePages == ExplicitHugePages)
+    {
+        void* address = mmap(nullptr,size,protection,flags | MAP_HUGETLB,-1,0);
+        if(address != MAP_FAILED)
+            return static_cast<char*>(address);
+    }
+
+    //多映射一个大页的长度,然后裁掉首尾使区域按2MB对齐,透明大页只能作用于对齐的2MB范围
+    void* address = mmap(nullptr,size + HugePageSize,protection,flags,-1,0);
+    if(address == MAP_FAILED)
+        throw std::bad_alloc();
+
+    char* raw = static_cast<char*>(address);
+    char* base = raw + (HugePageSize - reinterpret_cast<uintptr_t>(raw) % HugePageSize) % HugePageSize;
+    if(base != raw)
+        munmap(raw,std::size_t(base - raw));
+    if(raw + size + HugePageSize != base + size)
+        munmap(base + size,std::size_t(raw + size + HugePageSize - (base + size)));
+    madvise(base,size,MADV_HUGEPAGE);
+    return base;
+#else
+    size = roundUp(size,4096);
+    return static_cast<char*>(::operator new(size));
+#endif
+}
+
+void MappedPageProvider::unmap(char* base,std::size_t size) noexcept
+{
+#if defined(__linux__)
+    munmap(base,size);
+#else
+    (void)size;
+    ::operator delete(base);
+#endif
+}
+
+void MappedPageProvider::advise(char* base,std::size_t size) noexcept
+{
+#if defined(__linux__)
+    madvise(base,size,MADV_DONTNEED);
+#else
+    (void)base;
+    (void)size;
+#endif
+}
@@ -0,0 +1,97 @@
+#ifndef PAGEPROVIDER_HPP
+#define PAGEPROVIDER_HPP
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+/**
+ * @brief The PageProvider class : 内存池申请内存页的来源
+ * MemoryPool和MemoryPoolAny不再直接调用::operator new申请内存页,而是通过PageProvider申请和归还,
+ * 返回的内存页至少按16字节对齐;PageProvider的生命周期必须覆盖所有使用它的内存池
+ */
+class PageProvider
+{
+public:
+    virtual ~PageProvider() = default;
+
+    virtual void* allocatePage(std::size_t size) = 0;
+
+    virtual void deallocatePage(void* page,std::size_t size) noexcept = 0;
+
+    ///默认的PageProvider,直接使用::operator new和::operator delete
+    static PageProvider* heap();
+};
+
+/**
+ * @brief The MappedPageProvider class : 从mmap映射的大块区域中切割内存页
+ * 每次向系统映射regionSize字节的区域,同一个区域只切割同一种大小的内存页,归还的内存页挂在区域内部的空闲链表上复用,
+ * 区域中的内存页全部归还之后通过MADV_DONTNEED把物理内存还给系统,但是保留虚拟地址以便再次使用;超过regionSize的内存页单独映射
+ *
+ * hugePages为TransparentHugePages时区域按2MB对齐并调用madvise(MADV_HUGEPAGE),
+ * 为ExplicitHugePages时使用MAP_HUGETLB映射,系统没有预留大页时退回到透明大页
+ * prefaultBytes大于0时在构造时预先映射并写入对应大小的区域,这些区域不会被MADV_DONTNEED释放,前几次分配不会产生缺页中断
+ *
+ * 非Linux平台上区域由::operator new分配,没有大页和MADV_DONTNEED的效果
+ */
+class MappedPageProvider : public PageProvider
+{
+public:
+    enum HugePages{NoHugePages,TransparentHugePages,ExplicitHugePages};
+
+    struct Options
+    {
+        std::size_t regionSize = std::size_t(2) << 20;//每次映射的区域大小
+        HugePages hugePages = NoHugePages;
+        std::size_t prefaultBytes = 0;//启动时预先写入的字节数
+    };
+
+    MappedPageProvider();
+
+    explicit MappedPageProvider(const Options& options);
+
+    ~MappedPageProvider() override;
+
+    MappedPageProvider(const MappedPageProvider&) = delete;
+
+    MappedPageProvider& operator = (const MappedPageProvider&) = delete;
+
+    void* allocatePage(std::size_t size) override;
+
+    void deallocatePage(void* page,std::size_t size) noexcept override;
+
+    ///当前映射的区域数量以及其中没有任何内存页在使用的区域数量
+    std::size_t regionCount() const;
+
+    std::size_t idleRegionCount() const;
+
+private:
+    struct FreePage
+    {
+        FreePage* next;
+    };
+
+    struct Region
+    {
+        std::size_t size = 0;//区域的映射大小
+        std::size_t pageSize = 0;//区域切割的内存页大小,0表示区域空闲
+        std::size_t offset = 0;//尚未切割的空间的起始偏移
+        std::size_t live = 0;//正在使用的内存页数量
+        FreePage* freePages = nullptr;
+        bool dedicated = false;//单独映射的大内存页,归还时直接解除映射
+        bool pinned = false;//预先写入的区域,空闲时不释放物理内存
+    };
+
+    char* map(std::size_t& size);
+
+    void unmap(char* base,std::size_t size) noexcept;
+
+    void advise(char* base,std::size_t size) noexcept;
+
+private:
+    const Options options;
+    mutable std::mutex mutex;
+    std::map<char*,Region> regions;//按起始地址排序,归还内存页时用来查找所属区域
+};
+
+#endif // PAGEPROVIDER_HPP
@@ -0,0 +1,181 @@
+#ifndef POOLDIAGNOSTICS_HPP
+#define POOLDIAGNOSTICS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief The PoolStats struct : 内存池的统计快照,由MemoryPool::stats()、MemoryPoolAny::stats()和Allocator::stats()返回
+ * allocations和deallocations是内存池创建以来的累计次数,不会被reset()清零,两次快照的差值除以间隔时间就是分配速率
+ */
+struct PoolStats
+{
+    struct SizeClass
+    {
+        std::size_t blockSize = 0;
+        std::size_t live = 0;//正在使用的内存块数量
+        std::size_t free = 0;//已经切割出来但是空闲的内存块数量,包括线程本地缓存中的内存块
+    };
+
+    std::size_t bytesReserved = 0;//向PageProvider或者::operator new申请的总字节数
+    std::size_t bytesInUse = 0;//正在使用的内存块按尺寸等级计算的总字节数,包括大对象
+    std::size_t highWaterBytes = 0;//bytesInUse的历史最大值,使用线程本地缓存的内存池记录的是从中心仓库取出的字节数的最大值
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    std::vector<SizeClass> sizeClasses;
+};
+
+#ifdef MEMORYPOOL_DEBUG
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#if defined(__linux__) && defined(__GLIBC__)
+#include <execinfo.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief The PoolDebugger class : 定义MEMORYPOOL_DEBUG时内存池用来检查内存错误的调试器
+ * 每个内存块前后各有一段填充了固定字节的护栏,回收时检查护栏是否被改写;每次分配记录调用栈,
+ * 回收不在记录中的地址时报告重复释放,内存池析构时报告所有尚未回收的内存块以及它们的分配位置
+ */
+class PoolDebugger
+{
+    enum {GuardBytes = 16};
+
+    enum {MaxFrames = 16};
+
+    enum : unsigned char {Canary = 0xCD};
+
+    struct Record
+    {
+        std::size_t size = 0;
+        int frames = 0;
+        void* stack[MaxFrames];
+    };
+
+public:
+    explicit PoolDebugger(const char* poolName):name(poolName){}
+
+    ~PoolDebugger()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(const auto& item : records)
+        {
+            std::cerr<<"["<<name<<"] leak: "<<item.second.size<<" bytes at "<<item.first<<" allocated at:"<<std::endl;
+            printStack(item.second);
+        }
+        if(!records.empty() || doubleFrees != 0 || corruptions != 0)
+        {
+            std::cerr<<"["<<name<<"] "<<records.size()<<" leaks, "<<doubleFrees<<" double frees, "
+                     <<corruptions<<" corrupted blocks"<<std::endl;
+        }
+    }
+
+    PoolDebugger(const PoolDebugger&) = delete;
+
+    PoolDebugger& operator = (const PoolDebugger&) = delete;
+
+    ///前护栏的长度,不小于对齐要求,保证返回给使用者的地址依然对齐
+    static constexpr std::size_t front(std::size_t align)
+    {
+        return align > GuardBytes ? align : std::size_t(GuardBytes);
+    }
+
+    ///包含前后护栏的内存块大小
+    static constexpr std::size_t padded(std::size_t size,std::size_t align)
+    {
+        return front(align) + size + GuardBytes;
+    }
+
+    ///在raw指向的内存块中写入护栏并记录调用栈,返回给使用者的地址
+    void* track(void* raw,std::size_t size,std::size_t align)
+    {
+        unsigned char* user = static_cast<unsigned char*>(raw) + front(align);
+        std::memset(raw,Canary,front(align));
+        std::memset(user + size,Canary,GuardBytes);
+
+        Record record;
+        record.size = size;
+#if defined(__linux__) && defined(__GLIBC__)
+        record.frames = backtrace(record.stack,MaxFrames);
+#endif
+        std::lock_guard<std::mutex> lock(mutex);
+        records[user] = record;
+        return user;
+    }
+
+    ///检查user是否是一个正在使用的内存块,不是则报告重复释放
+    bool check(const void* user)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(records.count(user) != 0)
+            return true;
+        ++doubleFrees;
+        std::cerr<<"["<<name<<"] double free or invalid pointer: "<<user<<std::endl;
+        return false;
+    }
+
+    ///检查护栏并删除记录,返回内存块的起始地址;user不是正在使用的内存块时返回nullptr
+    void* untrack(void* user,std::size_t size,std::size_t align)
+    {
+        unsigned char* raw = static_cast<unsigned char*>(user) - front(align);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = records.find(user);
+        if(it == records.end())
+        {
+            ++doubleFrees;
+            std::cerr<<"["<<name<<"] double free or invalid pointer: "<<user<<std::endl;
+            return nullptr;
+        }
+
+        if(!intact(raw,front(align)) || !intact(static_cast<unsigned char*>(user) + size,GuardBytes))
+        {
+            ++corruptions;
+            std::cerr<<"["<<name<<"] canary overwritten around "<<size<<" bytes at "<<user<<", allocated at:"<<std::endl;
+            printStack(it->second);
+        }
+        records.erase(it);
+        return raw;
+    }
+
+    ///内存池reset()之后所有内存块都已经释放,不再视为泄漏
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        records.clear();
+    }
+
+private:
+    static bool intact(const unsigned char* guard,std::size_t length)
+    {
+        for(std::size_t i = 0; i < length; i++)
+        {
+            if(guard[i] != Canary)
+                return false;
+        }
+        return true;
+    }
+
+    static void printStack(const Record& record)
+    {
+#if defined(__linux__) && defined(__GLIBC__)
+        std::cerr<<std::flush;
+        backtrace_symbols_fd(const_cast<void* const*>(record.stack),record.frames,STDERR_FILENO);
+#else
+        (void)record;
+#endif
+    }
+
+private:
+    const char* name;
+    std::mutex mutex;
+    std::unordered_map<const void*,Record> records;
+    std::size_t doubleFrees = 0;
+    std::size_t corruptions = 0;
+};
+#endif
+
+#endif // POOLDIAGNOSTICS_HPP
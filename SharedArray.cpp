@@ -1 +1,83 @@
 #include "SharedArray.h"
+
+#include <cerrno>
+#include <system_error>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+namespace SharedArrayPrivate
+{
+    void* mapFile(const std::string& path,bool writable,std::size_t& bytes)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int file = ::open(path.c_str(),O_RDONLY | O_CLOEXEC);
+        if(file < 0)
+            throw std::system_error(errno,std::generic_category(),path);
+
+        struct stat status;
+        if(::fstat(file,&status) != 0)
+        {
+            int error = errno;
+            ::close(file);
+            throw std::system_error(error,std::generic_category(),path);
+        }
+
+        bytes = std::size_t(status.st_size);
+        if(bytes == 0)
+        {
+            ::close(file);
+            return nullptr;
+        }
+
+        int flags = MAP_PRIVATE;
+#ifdef MAP_NORESERVE
+        //可写的私有映射只有被写入的页面才需要交换空间,不为整个文件预留
+        if(writable)
+            flags |= MAP_NORESERVE;
+#endif
+        void* address = ::mmap(nullptr,bytes,writable ? PROT_READ | PROT_WRITE : PROT_READ,flags,file,0);
+        int error = errno;
+        //映射建立之后关闭文件描述符不影响映射
+        ::close(file);
+        if(address == MAP_FAILED)
+            throw std::system_error(error,std::generic_category(),path);
+        return address;
+#else
+        //没有mmap的平台上一次性读入整个文件
+        (void)writable;
+        std::ifstream file(path,std::ios::binary | std::ios::ate);
+        if(!file)
+            throw std::system_error(std::make_error_code(std::errc::no_such_file_or_directory),path);
+
+        bytes = std::size_t(file.tellg());
+        if(bytes == 0)
+            return nullptr;
+
+        char* buffer = static_cast<char*>(::operator new(bytes));
+        file.seekg(0);
+        if(!file.read(buffer,std::streamsize(bytes)))
+        {
+            ::operator delete(buffer);
+            throw std::system_error(std::make_error_code(std::errc::io_error),path);
+        }
+        return buffer;
+#endif
+    }
+
+    void unmapFile(void* address,std::size_t bytes) noexcept
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        ::munmap(address,bytes);
+#else
+        (void)bytes;
+        ::operator delete(address);
+#endif
+    }
+}
@@ -1,19 +1,334 @@
 #ifndef SHAREDARRAY_H
 #define SHAREDARRAY_H
 
-#include <string.h>
-#include <memory>
-#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace SharedArrayPrivate
+{
+    ///以MAP_PRIVATE方式映射整个文件,writable为true时映射可写,写入不会影响文件;bytes返回文件大小,
+    ///文件为空时返回nullptr,打开或者映射失败时抛出std::system_error
+    void* mapFile(const std::string& path,bool writable,std::size_t& bytes);
+
+    void unmapFile(void* address,std::size_t bytes) noexcept;
+}
+
+/**
+ * @brief The SharedArrayDetach struct : 统计SharedArray因为数据被共享而复制元素的次数和字节数,用来找出意外的复制
+ * 只有定义SHAREDARRAY_DEBUG时SharedArray才会计数;设置了hook时每次复制都会调用它,可以在其中打印调用栈或者设置断点
+ */
+struct SharedArrayDetach
+{
+    enum Reason{Edit,Append,Insert,Resize,Reserve,ReasonCount};
+
+    using Hook = void(*)(Reason reason,std::size_t bytes);
+
+    static const char* name(Reason reason) noexcept
+    {
+        static const char* const names[ReasonCount] = {"edit","append","insert","resize","reserve"};
+        return names[reason];
+    }
+
+    static std::uint64_t count(Reason reason) noexcept
+    {
+        return counters()[reason].load(std::memory_order_relaxed);
+    }
+
+    static std::uint64_t bytes(Reason reason) noexcept
+    {
+        return byteCounters()[reason].load(std::memory_order_relaxed);
+    }
+
+    static std::uint64_t total() noexcept
+    {
+        std::uint64_t sum = 0;
+        for(int reason = 0; reason < ReasonCount; reason++)
+            sum += count(Reason(reason));
+        return sum;
+    }
+
+    static void reset() noexcept
+    {
+        for(int reason = 0; reason < ReasonCount; reason++)
+        {
+            counters()[reason].store(0,std::memory_order_relaxed);
+            byteCounters()[reason].store(0,std::memory_order_relaxed);
+        }
+    }
+
+    static void setHook(Hook hook) noexcept
+    {
+        hookSlot().store(hook,std::memory_order_release);
+    }
+
+    static void record(Reason reason,std::size_t size) noexcept
+    {
+        counters()[reason].fetch_add(1,std::memory_order_relaxed);
+        byteCounters()[reason].fetch_add(size,std::memory_order_relaxed);
+        Hook hook = hookSlot().load(std::memory_order_acquire);
+        if(hook != nullptr)
+            hook(reason,size);
+    }
+
+    static void print(std::ostream& stream)
+    {
+        for(int reason = 0; reason < ReasonCount; reason++)
+            stream<<name(Reason(reason))<<": "<<count(Reason(reason))<<" detaches, "<<bytes(Reason(reason))<<" bytes"<<std::endl;
+    }
+
+private:
+    static std::atomic<std::uint64_t>* counters() noexcept
+    {
+        static std::atomic<std::uint64_t> values[ReasonCount];
+        return values;
+    }
+
+    static std::atomic<std::uint64_t>* byteCounters() noexcept
+    {
+        static std::atomic<std::uint64_t> values[ReasonCount];
+        return values;
+    }
+
+    static std::atomic<Hook>& hookSlot() noexcept
+    {
+        static std::atomic<Hook> hook{nullptr};
+        return hook;
+    }
+};
+
+/**
+ * @brief The SharedArrayData class : SharedArray的共享数据块
+ * 引用计数、元素数量、容量和元素放在同一次分配的内存中,元素从头部之后按alignof(T)对齐的位置开始,
+ * 复制SharedArray只需要增加引用计数,不会像std::shared_ptr那样额外分配一个控制块
+ * 映射文件时只分配头部,elements指向映射区域,最后一个引用释放时解除映射
+ */
+template<typename T>
+struct SharedArrayData
+{
+    std::atomic<std::size_t> ref;
+    std::size_t size;
+    std::size_t capacity;
+    T* elements;
+    std::size_t mapped;//映射区域的字节数,0表示元素存放在数据块内部
+    bool readOnly;//只读映射,写入之前必须复制到匿名内存
+
+    enum : std::size_t {Align = alignof(T) > alignof(std::atomic<std::size_t>) ? alignof(T) : alignof(std::atomic<std::size_t>)};
+
+    SharedArrayData(std::size_t count,T* data) noexcept:ref(1),size(0),capacity(count),elements(data),mapped(0),readOnly(false){}
+
+    ///元素相对数据块起始地址的偏移
+    static constexpr std::size_t offset()
+    {
+        return (sizeof(SharedArrayData) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    T* begin() noexcept
+    {
+        return elements;
+    }
+
+    const T* begin() const noexcept
+    {
+        return elements;
+    }
+
+    ///只有一个引用并且不是只读映射时可以原地写入
+    bool writable() const noexcept
+    {
+        return ref.load(std::memory_order_acquire) == 1 && !readOnly;
+    }
+
+    ///在末尾构造一个元素,调用者保证size小于capacity
+    template<typename...Args>
+    void append(Args&&...args)
+    {
+        ::new (static_cast<void*>(begin() + size)) T(std::forward<Args>(args)...);
+        ++size;
+    }
+
+    ///分配可以容纳capacity个元素的数据块,引用计数为1,元素数量为0
+    static SharedArrayData* allocate(std::size_t capacity)
+    {
+        if(capacity > (std::size_t(-1) - offset()) / sizeof(T))
+            throw std::bad_alloc();
+
+        const std::size_t bytes = offset() + sizeof(T) * capacity;
+#if __cplusplus > 201402L
+        void* block = Align > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? ::operator new(bytes,std::align_val_t(Align)) : ::operator new(bytes);
+#else
+        void* block = ::operator new(bytes);
+#endif
+        return ::new (block) SharedArrayData(capacity,reinterpret_cast<T*>(static_cast<char*>(block) + offset()));
+    }
+
+    ///为映射区域分配头部,count个元素全部有效;分配失败时解除映射
+    static SharedArrayData* map(T* elements,std::size_t count,std::size_t bytes,bool readOnly)
+    {
+        void* block = nullptr;
+        try
+        {
+            block = ::operator new(sizeof(SharedArrayData));
+        }
+        catch(...)
+        {
+            SharedArrayPrivate::unmapFile(elements,bytes);
+            throw;
+        }
+        SharedArrayData* data = ::new (block) SharedArrayData(count,elements);
+        data->size = count;
+        data->mapped = bytes;
+        data->readOnly = readOnly;
+        return data;
+    }
+
+    ///把source开始的count个元素追加到末尾,调用者保证容量足够;平凡可复制的类型直接memcpy,
+    ///其他类型move为true时移动元素(移动构造可能抛出异常时依然复制),否则逐个调用拷贝构造函数
+    void transfer(T* source,std::size_t count,bool move)
+    {
+        transfer(source,count,move,std::integral_constant<bool,std::is_trivially_copyable<T>::value>());
+    }
+
+    ///把[first,last)范围内的元素复制到末尾,调用者保证容量足够
+    template<typename Iterator>
+    void copy(Iterator first,Iterator last)
+    {
+        for(; first != last; ++first)
+            append(*first);
+    }
+
+    void copy(const T* first,const T* last)
+    {
+        transfer(const_cast<T*>(first),std::size_t(last - first),false);
+    }
+
+    void copy(T* first,T* last)
+    {
+        transfer(first,std::size_t(last - first),false);
+    }
+
+    ///析构第count个之后的元素
+    void truncate(std::size_t count) noexcept
+    {
+        if(!std::is_trivially_destructible<T>::value)
+        {
+            for(std::size_t i = count; i < size; i++)
+                begin()[i].~T();
+        }
+        size = count;
+    }
+
+    ///把source开始的count个元素复制到容量为capacity的新数据块
+    static SharedArrayData* clone(T* source,std::size_t count,std::size_t capacity)
+    {
+        SharedArrayData* data = allocate(capacity);
+        try
+        {
+            data->transfer(source,count,false);
+        }
+        catch(...)
+        {
+            destroy(data);
+            throw;
+        }
+        return data;
+    }
+
+    static void retain(SharedArrayData* data) noexcept
+    {
+        if(data != nullptr)
+            data->ref.fetch_add(1,std::memory_order_relaxed);
+    }
+
+    ///引用计数减一,最后一个引用析构元素并释放数据块
+    static void release(SharedArrayData* data) noexcept
+    {
+        if(data != nullptr && data->ref.fetch_sub(1,std::memory_order_acq_rel) == 1)
+            destroy(data);
+    }
+
+    ///析构已经构造的元素并释放数据块,元素构造过程中抛出异常时也用它回收
+    static void destroy(SharedArrayData* data) noexcept
+    {
+        data->truncate(0);
+        if(data->mapped != 0)
+        {
+            SharedArrayPrivate::unmapFile(data->elements,data->mapped);
+            data->~SharedArrayData();
+            ::operator delete(static_cast<void*>(data));
+            return;
+        }
+        data->~SharedArrayData();
+#if __cplusplus > 201402L
+        if(Align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            ::operator delete(static_cast<void*>(data),std::align_val_t(Align));
+            return;
+        }
+#endif
+        ::operator delete(static_cast<void*>(data));
+    }
+
+private:
+    void transfer(T* source,std::size_t count,bool,std::true_type) noexcept
+    {
+        if(count != 0)
+            std::memcpy(static_cast<void*>(begin() + size),source,sizeof(T) * count);
+        size += count;
+    }
+
+    //构造函数抛出异常时已经追加的元素计入size,由调用者回收
+    void transfer(T* source,std::size_t count,bool move,std::false_type)
+    {
+        for(std::size_t i = 0; i < count; i++)
+        {
+            if(move)
+                append(std::move_if_noexcept(source[i]));
+            else
+                append(static_cast<const T&>(source[i]));
+        }
+    }
+};
 
 /**
  *SharedArray是一个隐式共享数据类,通过拷贝、移动、赋值所创建的多个副本共享同一数据
  *任何可能修改数据的行为都会导致数据分离,创建独立的拷贝
  *在不使用SharedArray&或者SharedArray*的前提下,这个类是线程安全的
+ *
+ *引用计数和元素存放在同一块内存中(见SharedArrayData),拷贝只是一次relaxed原子加法;
+ *分离时非平凡类型逐个调用拷贝构造函数,平凡可复制的类型使用memcpy
+ *
+ *reserve、push_back、append、resize、insert按几何级数扩容:独占数据并且容量足够时原地追加,
+ *需要扩容或者数据被共享时分配一个新的数据块,旧元素只移动(独占)或复制(共享)一次,分离和扩容不会各自分配一次
+ *和std::vector一样,append和insert的范围不能来自当前数组本身(append(const SharedArray&)除外)
+ *
+ *SharedArray是数据块上的一个视图(起始位置和长度),slice()返回的子数组与原数组共享同一个数据块,
+ *只有在修改子数组时才复制子数组范围内的元素,一个数据报可以拆分成多个字段交给不同的线程而不需要memcpy;
+ *数据块在最后一个引用它的数组或者子数组析构时释放
+ *
+ *operator[]、begin()、end()以及类型转换都是只读的,即使通过非const引用访问也不会分离,遍历共享的数组不会复制数据;
+ *修改元素需要调用edit(),它只在数据被共享时分离一次,定义SHAREDARRAY_DEBUG时每次分离都记录在SharedArrayDetach中
+ *
+ *mapFile()创建的数组直接引用文件的映射区域,读取时才由操作系统按页载入,启动时不需要把整个文件读入内存
  */
 template <typename T>
 class SharedArray
 {
+    using Data = SharedArrayData<T>;
+
 public:
+    enum MapMode{ReadOnly,CopyOnWrite};
+
     typedef size_t size_type;
     typedef const T& const_reference;
     typedef T& reference;
@@ -21,110 +336,356 @@ public:
     typedef const T* const_pointer;
     typedef T value_type;
 
-    typedef T* iterator;
+    typedef const T* iterator;
     typedef const T* const_iterator;
     typedef std::reverse_iterator<iterator> reverse_iterator;
     typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
 
-    SharedArray(){}
+    /**
+     * @brief The Editor class : edit()返回的可写句柄
+     * 创建时数据已经与其他数组分离,之后通过它读写元素不再检查引用计数;Editor应当只在局部使用,
+     * 它存在期间复制、扩容或者截短原数组会使写入被其他数组看到或者访问已经释放的内存,与std::vector迭代器的失效规则类似
+     * 定义SHAREDARRAY_DEBUG时Editor记录创建时的数据块,通过operator[]写入时检查数据块没有被再次共享
+     */
+    class Editor
+    {
+    public:
+        inline T& operator[] (std::size_t index) const noexcept
+        {
+#ifdef SHAREDARRAY_DEBUG
+            assert((block == nullptr || block->writable()) && "SharedArray::Editor used after the array was shared again");
+#endif
+            return first[index];
+        }
+
+        inline T* data() const noexcept
+        {
+            return first;
+        }
+
+        inline T* begin() const noexcept
+        {
+            return first;
+        }
+
+        inline T* end() const noexcept
+        {
+            return first + count;
+        }
+
+        inline std::size_t size() const noexcept
+        {
+            return count;
+        }
+
+    private:
+        friend class SharedArray;
+
+#ifdef SHAREDARRAY_DEBUG
+        Editor(Data* data,T* elements,std::size_t size) noexcept:block(data),first(elements),count(size){}
+#else
+        Editor(Data*,T* elements,std::size_t size) noexcept:first(elements),count(size){}
+#endif
+
+    private:
+#ifdef SHAREDARRAY_DEBUG
+        Data* block;
+#endif
+        T* first;
+        std::size_t count;
+    };
+
+    SharedArray() noexcept {}
+
+    ///count个值初始化的元素
+    explicit SharedArray(std::size_t count)
+    {
+        fill(count,[](Data* data){data->append();});
+    }
+
+    SharedArray(std::size_t count,const T& value)
+    {
+        fill(count,[&value](Data* data){data->append(value);});
+    }
+
+    SharedArray(std::initializer_list<T> list)
+    {
+        fill(list.size(),[&list](Data* data){data->copy(list.begin(),list.end());});
+    }
 
-    SharedArray(T* array,std::size_t length) noexcept
+    ///接管new T[count]创建的数组,元素被移动到共享数据块中,原数组随后用delete[]释放
+    SharedArray(T* array,std::size_t count)
     {
-        data = std::shared_ptr<T>(array);
-        size = length;
+        try
+        {
+            fill(count,[array,count](Data* data){data->transfer(array,count,true);});
+        }
+        catch(...)
+        {
+            delete[] array;
+            throw;
+        }
+        delete[] array;
     }
 
     SharedArray(const SharedArray& other) noexcept
+        :d(other.d),ptr(other.ptr),length(other.length)
     {
-        data = other.data;
-        size = other.size;
+        Data::retain(d);
     }
 
     SharedArray(SharedArray&& other) noexcept
+        :d(other.d),ptr(other.ptr),length(other.length)
     {
-        data = std::move(other.data);
-        size = other.size;
+        other.d = nullptr;
+        other.ptr = nullptr;
+        other.length = 0;
+    }
+
+    ~SharedArray()
+    {
+        Data::release(d);
     }
 
     SharedArray& operator = (const SharedArray& other) noexcept
     {
-        data = other.data;
-        size = other.size;
+        Data::retain(other.d);
+        Data::release(d);
+        d = other.d;
+        ptr = other.ptr;
+        length = other.length;
         return *this;
     }
 
     SharedArray& operator = (SharedArray&& other) noexcept
     {
-        data = std::move(other.data);
-        size = other.size;
+        swap(other);
+        return *this;
     }
 
     void* operator new (size_t) = delete ;
 
     void* operator new[](size_t) = delete;
 
-    inline operator T*() noexcept
+    void swap(SharedArray& other) noexcept
     {
-        detach();
-        return data.get();
+        std::swap(d,other.d);
+        std::swap(ptr,other.ptr);
+        std::swap(length,other.length);
     }
 
-    inline operator const T* () const noexcept
+    inline std::size_t size() const noexcept
     {
-        return data.get();
-    };
+        return length;
+    }
 
-    inline T& operator[] (std::size_t index)
+    inline bool empty() const noexcept
     {
-        detach();
-        return (data.get()[index]);
+        return length == 0;
     }
 
-    inline const T& operator[] (std::size_t index) const
+    ///不重新分配内存时最多可以容纳的元素数量,子数组之后还有其他元素时等于size()
+    inline std::size_t capacity() const noexcept
     {
-        return (data.get()[index]);
+        return atEnd() ? d->capacity - offset() : length;
     }
 
-    inline iterator begin()
+    ///保证容量不小于capacity并且不与其他SharedArray共享数据
+    void reserve(std::size_t capacity)
     {
-        detach();
-        return data.get();
+        if(capacity <= this->capacity() && isDetached())
+            return;
+        grow(length,std::max(capacity,length),[](Data*){},SharedArrayDetach::Reserve);
     }
 
-    inline const_iterator begin() const noexcept
+    ///与其他数组分离并返回可写句柄,只读访问不需要调用edit()
+    Editor edit()
     {
-        return data.get();
+        detach(SharedArrayDetach::Edit);
+        return Editor(d,ptr,length);
     }
 
-    inline const_iterator cbegin() const noexcept
+    /**
+     * @brief mapFile : 把文件映射为数组,元素数量为文件大小除以sizeof(T),文件为空时返回空数组
+     * ReadOnly使用只读映射,第一次写入时把视图范围内的元素复制到匿名内存;
+     * CopyOnWrite使用可写的MAP_PRIVATE映射,独占数据时原地写入,由操作系统只复制被写入的页面;
+     * 两种模式都不会修改文件,打开或者映射失败时抛出std::system_error
+     */
+    static SharedArray mapFile(const std::string& path,MapMode mode = ReadOnly)
+    {
+        static_assert(std::is_trivially_copyable<T>::value,"mapFile requires a trivially copyable element type");
+
+        std::size_t bytes = 0;
+        void* address = SharedArrayPrivate::mapFile(path,mode == CopyOnWrite,bytes);
+        SharedArray array;
+        if(address != nullptr)
+            array.reset(Data::map(static_cast<T*>(address),bytes / sizeof(T),bytes,mode == ReadOnly));
+        return array;
+    }
+
+    ///与当前数组共享数据块的子数组[offset,offset + count),超出当前数组的部分被截掉
+    SharedArray slice(std::size_t offset,std::size_t count = std::size_t(-1)) const noexcept
     {
-        return data.get();
+        SharedArray result(*this);
+        offset = std::min(offset,length);
+        result.ptr = ptr + offset;
+        result.length = std::min(count,length - offset);
+        return result;
     }
 
-    inline iterator end()
+    ///两个数组(包括子数组)是否引用同一个数据块
+    inline bool isSharedWith(const SharedArray& other) const noexcept
     {
-        detach();
-        return data.get()+size;
+        return d != nullptr && d == other.d;
     }
 
-    inline const_iterator end() const
+    template<typename...Args>
+    void emplace_back(Args&&...args)
     {
-        return data.get()+size;
+        if(available(1))
+        {
+            d->append(std::forward<Args>(args)...);
+            ++length;
+            return;
+        }
+
+        //参数可能引用当前数组中的元素,先构造再扩容
+        T value(std::forward<Args>(args)...);
+        grow(length,grownCapacity(length + 1),[&value](Data* data){data->append(std::move(value));},SharedArrayDetach::Append);
     }
 
-    inline const_iterator cend() const
+    void push_back(const T& value)
+    {
+        emplace_back(value);
+    }
+
+    void push_back(T&& value)
+    {
+        emplace_back(std::move(value));
+    }
+
+    template<typename Iterator>
+    void append(Iterator first,Iterator last)
+    {
+        insert(length,first,last,typename std::iterator_traits<Iterator>::iterator_category(),SharedArrayDetach::Append);
+    }
+
+    void append(const T* values,std::size_t count)
+    {
+        insert(length,values,values + count,std::forward_iterator_tag(),SharedArrayDetach::Append);
+    }
+
+    ///当前数组为空时直接共享other的数据
+    void append(const SharedArray& other)
+    {
+        if(empty())
+        {
+            *this = other;
+            return;
+        }
+
+        //持有一个引用,other就是自身时扩容过程中旧元素会被复制而不是移动
+        SharedArray source(other);
+        append(source.cbegin(),source.cend());
+    }
+
+    void resize(std::size_t count)
+    {
+        resizeWith(count,[](Data* data){data->append();});
+    }
+
+    void resize(std::size_t count,const T& value)
+    {
+        if(count > length && !available(count - length))
+        {
+            //value可能是当前数组中的元素
+            T copy(value);
+            resizeWith(count,[&copy](Data* data){data->append(copy);});
+        }
+        else
+        {
+            resizeWith(count,[&value](Data* data){data->append(value);});
+        }
+    }
+
+    const_iterator insert(const_iterator position,const T& value)
+    {
+        return emplace(position,value);
+    }
+
+    const_iterator insert(const_iterator position,T&& value)
     {
-        return data.get()+size;
+        return emplace(position,std::move(value));
     }
 
-    inline reverse_iterator rbegin()
+    template<typename Iterator>
+    const_iterator insert(const_iterator position,Iterator first,Iterator last)
     {
-        return reverse_iterator(end());
+        return insert(std::size_t(position - constData()),first,last,typename std::iterator_traits<Iterator>::iterator_category(),SharedArrayDetach::Insert);
+    }
+
+    template<typename...Args>
+    const_iterator emplace(const_iterator position,Args&&...args)
+    {
+        const std::size_t index = std::size_t(position - constData());
+        if(available(1))
+        {
+            d->append(std::forward<Args>(args)...);
+            ++length;
+            std::rotate(ptr + index,ptr + length - 1,ptr + length);
+        }
+        else
+        {
+            T value(std::forward<Args>(args)...);
+            grow(index,grownCapacity(length + 1),[&value](Data* data){data->append(std::move(value));},SharedArrayDetach::Insert);
+        }
+        return ptr + index;
     }
 
-    inline reverse_iterator rend()
+    ///没有和其他SharedArray共享数据并且不是只读映射时返回true,此时写操作不会复制数据
+    inline bool isDetached() const noexcept
     {
-        return reverse_iterator(begin());
+        return d == nullptr || d->writable();
+    }
+
+    inline const T* data() const noexcept
+    {
+        return ptr;
+    }
+
+    inline const T* constData() const noexcept
+    {
+        return ptr;
+    }
+
+    inline operator const T* () const noexcept
+    {
+        return ptr;
+    };
+
+    inline const T& operator[] (std::size_t index) const
+    {
+        return ptr[index];
+    }
+
+    inline const_iterator begin() const noexcept
+    {
+        return ptr;
+    }
+
+    inline const_iterator cbegin() const noexcept
+    {
+        return ptr;
+    }
+
+    inline const_iterator end() const
+    {
+        return ptr + length;
+    }
+
+    inline const_iterator cend() const
+    {
+        return ptr + length;
     }
 
     inline const_reverse_iterator rbegin() const
@@ -148,20 +709,180 @@ public:
     }
 
 private:
-    void detach()
+    ///视图在数据块中的起始位置
+    std::size_t offset() const noexcept
     {
-        //detach无需判空,对空指针的写操作会直接导致段错误,所以如果能写就必定能拷贝
-        if(data.use_count() > 1)
+        return std::size_t(ptr - d->begin());
+    }
+
+    ///视图是否延伸到数据块中最后一个元素,只有这时才能在数据块末尾原地追加
+    bool atEnd() const noexcept
+    {
+        return d != nullptr && ptr + length == d->begin() + d->size;
+    }
+
+    ///独占数据、视图位于数据块末尾并且剩余容量不少于count时可以原地追加
+    bool available(std::size_t count) const noexcept
+    {
+        return atEnd() && d->capacity - d->size >= count && isDetached();
+    }
+
+    ///几何级数扩容:独占数据时按容量翻倍,共享数据时按元素数量翻倍
+    std::size_t grownCapacity(std::size_t required) const noexcept
+    {
+        const std::size_t base = isDetached() ? capacity() : length;
+        return std::max(required,base * 2);
+    }
+
+    ///改为引用一个新的数据块,视图覆盖其中所有元素
+    void reset(Data* data) noexcept
+    {
+        Data::release(d);
+        d = data;
+        ptr = data->begin();
+        length = data->size;
+    }
+
+    ///分配容量为capacity的新数据块,依次放入[0,index)的元素、insert追加的元素和[index,size)的元素,
+    ///独占数据时移动旧元素,共享数据时复制旧元素并按reason计数
+    template<typename Insert>
+    void grow(std::size_t index,std::size_t capacity,Insert insert,SharedArrayDetach::Reason reason)
+    {
+        Data* data = Data::allocate(capacity);
+        const bool move = isDetached();
+        if(!move)
+            countDetach(reason);
+        try
         {
-            std::shared_ptr<T> newData = std::shared_ptr<T>(new T[size],std::default_delete<T[]>());
-            memcpy(newData.get(),data.get(),sizeof (T) * size);
-            data = newData;
+            data->transfer(ptr,index,move);
+            insert(data);
+            data->transfer(ptr + index,length - index,move);
         }
+        catch(...)
+        {
+            Data::destroy(data);
+            throw;
+        }
+        reset(data);
+    }
+
+    template<typename Iterator>
+    const_iterator insert(std::size_t index,Iterator first,Iterator last,std::forward_iterator_tag,SharedArrayDetach::Reason reason)
+    {
+        const std::size_t count = std::size_t(std::distance(first,last));
+        if(count == 0)
+            return ptr + index;
+
+        if(available(count))
+        {
+            //追加到末尾再旋转到插入位置
+            const std::size_t before = d->size;
+            try
+            {
+                d->copy(first,last);
+            }
+            catch(...)
+            {
+                d->truncate(before);
+                throw;
+            }
+            length += count;
+            std::rotate(ptr + index,ptr + length - count,ptr + length);
+        }
+        else
+        {
+            grow(index,grownCapacity(length + count),[first,last](Data* data){data->copy(first,last);},reason);
+        }
+        return ptr + index;
+    }
+
+    ///单遍迭代器无法预先得到元素数量,先收集到临时数组中
+    template<typename Iterator>
+    const_iterator insert(std::size_t index,Iterator first,Iterator last,std::input_iterator_tag,SharedArrayDetach::Reason reason)
+    {
+        SharedArray values;
+        for(; first != last; ++first)
+            values.push_back(*first);
+        return insert(index,values.ptr,values.ptr + values.length,std::forward_iterator_tag(),reason);
+    }
+
+    template<typename Construct>
+    void resizeWith(std::size_t count,Construct construct)
+    {
+        if(count == length)
+            return;
+
+        if(count < length)
+        {
+            //独占数据时析构被截掉的元素,共享数据时只缩短视图,不需要复制
+            if(atEnd() && isDetached())
+                d->truncate(offset() + count);
+            length = count;
+            return;
+        }
+
+        if(!available(count - length))
+            grow(length,grownCapacity(count),[](Data*){},SharedArrayDetach::Resize);
+
+        const std::size_t before = d->size;
+        try
+        {
+            for(std::size_t i = length; i < count; i++)
+                construct(d);
+        }
+        catch(...)
+        {
+            d->truncate(before);
+            throw;
+        }
+        length = count;
+    }
+
+    ///分配count个元素的数据块并用construct构造元素直到元素数量达到count,构造失败时释放已经构造的元素
+    template<typename Construct>
+    void fill(std::size_t count,Construct construct)
+    {
+        if(count == 0)
+            return;
+
+        Data* data = Data::allocate(count);
+        try
+        {
+            while(data->size < count)
+                construct(data);
+        }
+        catch(...)
+        {
+            Data::destroy(data);
+            throw;
+        }
+        reset(data);
+    }
+
+    void detach(SharedArrayDetach::Reason reason)
+    {
+        //引用计数为1时当前对象独占数据,acquire保证看到其他副本释放之前的写入;
+        //只复制视图范围内的元素,视图位于数据块末尾时保留剩余的容量
+        if(d != nullptr && !d->writable())
+        {
+            countDetach(reason);
+            reset(Data::clone(ptr,length,atEnd() ? d->capacity - offset() : length));
+        }
+    }
+
+    void countDetach(SharedArrayDetach::Reason reason) const noexcept
+    {
+#ifdef SHAREDARRAY_DEBUG
+        SharedArrayDetach::record(reason,sizeof(T) * length);
+#else
+        (void)reason;
+#endif
     }
 
 private:
-    std::shared_ptr<T> data = nullptr;
-    size_t size = 0;
+    Data* d = nullptr;
+    T* ptr = nullptr;//视图的起始位置
+    std::size_t length = 0;//视图中的元素数量
 };
 
 #endif // SHAREDARRAY_H
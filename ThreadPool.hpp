@@ -2,42 +2,333 @@
 #define THREADPOOL_H
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <mutex>
 #include <thread>
 #include <future>
 #include <condition_variable>
-#include <queue>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <shared_mutex>
+#include <stdexcept>
+#include <ostream>
 #include "FunctionTraits.hpp"
+#include "ThreadPoolPrivate.hpp"
+
+class ThreadQueue;
+
+/**
+ * @brief The StealingScheduler class : 工作窃取模式下所有线程共享的调度状态
+ * 线程池外部提交的任务进入全局注入队列,线程池内部线程提交的任务进入该线程自己的无锁双端队列
+ * 空闲线程依次从自己的双端队列、全局注入队列、其他线程的双端队列中获取任务,获取不到任务时才进入休眠
+ */
+class StealingScheduler
+{
+    using Task = ThreadPoolPrivate::TaskWrapper;
+    using Clock = std::chrono::steady_clock;
+
+    friend class ThreadQueue;
+    friend class ThreadPool;
+private:
+    StealingScheduler() = default;
+
+    ~StealingScheduler()
+    {
+        clear();
+    }
+
+    StealingScheduler(const StealingScheduler&) = delete ;
+
+    StealingScheduler& operator = (const StealingScheduler&) = delete ;
+
+    ///丢弃全局注入队列中还没有被执行的任务,对应的future会得到broken_promise,只能在所有线程停止之后调用
+    ///销毁恢复协程的任务时协程会被恢复,协程结束时可能又提交新的任务,所以每次只在锁中取出一个任务,直到队列为空
+    void clear()
+    {
+        while (true)
+        {
+            Task* task = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_InjectMutex);
+                if(!m_Injected.pop(task))
+                    return;
+            }
+            releaseTask(task);
+        }
+    }
+
+    ///是否有等待执行的任务,休眠线程用这个函数判断是否需要醒来窃取任务
+    bool hasWork() const noexcept
+    {
+        return m_Queued.load(std::memory_order_acquire) > 0;
+    }
+
+    ///等待执行和正在执行的任务数量之和
+    std::size_t pending() const noexcept
+    {
+        return m_Pending.count();
+    }
+
+    ///阻塞直到线程池中所有任务执行完毕
+    void waitForDrain()
+    {
+        m_Pending.wait();
+    }
+
+    ///任务节点从TaskAllocator中分配,稳定状态下不会产生堆分配
+    static Task* allocateTask(Task&& task)
+    {
+        ThreadPoolPrivate::TaskAllocator<Task> allocator;
+        Task* node = allocator.allocate(1);
+        return ::new (node) Task(std::move(task));
+    }
+
+    static void releaseTask(Task* task) noexcept
+    {
+        ThreadPoolPrivate::TaskAllocator<Task> allocator;
+        task->~Task();
+        allocator.deallocate(task,1);
+    }
+
+    ///提交一个任务,如果当前线程是本线程池的线程并且任务是普通优先级,则压入线程自己的双端队列,否则压入全局注入队列
+    void submit(Task* task,unsigned level);
+
+    ///提交一个带截止时间的任务,这种任务总是压入全局注入队列,按截止时间排序
+    void submit(Task* task,unsigned level,Clock::time_point deadline);
+
+    ///按队列容量提交任务,全局注入队列已满时按policy处理,返回Full时任务没有被提交,由调用者处理
+    ///线程池内部线程压入自己双端队列的任务不受容量限制
+    template<typename...TimePoint>
+    ThreadPoolPrivate::Admission offer(Task* task,unsigned level,unsigned policy,TimePoint...deadline);
+
+    ///每一个任务队列的容量,0表示不限制
+    std::size_t capacity() const noexcept
+    {
+        return m_Capacity.load(std::memory_order_relaxed);
+    }
+
+    ///修改容量并预先分配全局注入队列的存储空间,唤醒所有等待队列空出位置的线程
+    void setCapacity(std::size_t capacity,unsigned policy)
+    {
+        std::unique_lock<std::mutex> lock(m_InjectMutex);
+        m_Injected.reserve(capacity);
+        m_Capacity.store(capacity,std::memory_order_relaxed);
+        m_Overflow.store(policy,std::memory_order_relaxed);
+        m_NotFull.notify_all();
+    }
+
+    ///当前线程提交任务时使用的溢出策略,线程池内部的线程等待自己所在线程池的队列可能永远等不到,所以Block按CallerRuns处理
+    unsigned overflowPolicy() const noexcept;
+
+    ///记录一次队列已满以及采取的处理方式
+    void overflowed(unsigned policy) noexcept
+    {
+        m_Overflowed[policy].fetch_add(1,std::memory_order_relaxed);
+    }
+
+    std::uint64_t overflowCount(unsigned policy) const noexcept
+    {
+        return m_Overflowed[policy].load(std::memory_order_relaxed);
+    }
+
+    ///某一优先级中等待执行的任务数量
+    std::size_t depth(unsigned level) const noexcept
+    {
+        return m_Depth[level].load(std::memory_order_relaxed);
+    }
+
+    ///批量提交任务,所有任务在一次加锁中压入队列,然后按任务数量唤醒休眠线程
+    void submitBatch(Task** first,Task** last);
+
+    ///从全局注入队列的指定优先级中取出一个任务
+    bool takeInjected(Task*& task,unsigned level)
+    {
+        std::unique_lock<std::mutex> lock(m_InjectMutex);
+        if(!m_Injected.pop(task,level))
+            return false;
+
+        if(m_Blocked != 0)
+            m_NotFull.notify_one();
+        return true;
+    }
+
+    ///把已经被取消的任务从全局注入队列中移除并追加到cancelled中,线程自己的双端队列中被取消的任务在执行时跳过
+    void takeCancelled(std::vector<Task*>& cancelled)
+    {
+        std::unique_lock<std::mutex> lock(m_InjectMutex);
+        const std::size_t removed = m_Injected.removeIf([](Task* task){
+            return task->cancelled();
+        },[this,&cancelled](Task* task,unsigned level){
+            m_Depth[level].fetch_sub(1,std::memory_order_relaxed);
+            m_Queued.fetch_sub(1,std::memory_order_acq_rel);
+            cancelled.push_back(task);
+        });
+
+        if(removed != 0 && m_Blocked != 0)
+            m_NotFull.notify_all();
+    }
+
+    void inject(Task* task,unsigned level)
+    {
+        std::unique_lock<std::mutex> lock(m_InjectMutex);
+        m_Injected.push(std::move(task),level);
+    }
+
+    ///从其他线程的双端队列中窃取一个任务,每次从不同的线程开始尝试,避免所有窃取者争抢同一个队列
+    bool steal(ThreadQueue* thief,Task*& task);
+
+    void registerQueue(ThreadQueue* queue)
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(m_QueuesMutex);
+        m_Queues.push_back(queue);
+    }
+
+    void unregisterQueue(ThreadQueue* queue)
+    {
+        {
+            std::unique_lock<std::shared_timed_mutex> lock(m_QueuesMutex);
+            m_Queues.erase(std::remove(m_Queues.begin(),m_Queues.end(),queue),m_Queues.end());
+        }
+        removeSleeper(queue);
+    }
+
+    void addSleeper(ThreadQueue* queue)
+    {
+        std::unique_lock<std::mutex> lock(m_SleepMutex);
+        m_Sleepers.push_back(queue);
+        m_SleeperCount.store(m_Sleepers.size(),std::memory_order_seq_cst);
+    }
+
+    void removeSleeper(ThreadQueue* queue)
+    {
+        std::unique_lock<std::mutex> lock(m_SleepMutex);
+        m_Sleepers.erase(std::remove(m_Sleepers.begin(),m_Sleepers.end(),queue),m_Sleepers.end());
+        m_SleeperCount.store(m_Sleepers.size(),std::memory_order_seq_cst);
+    }
+
+    ///唤醒一个休眠中的线程,没有休眠线程时只需要一次原子读取
+    void wakeOne();
+
+    ///任务执行完毕之后由执行线程调用
+    void finishTask()
+    {
+        m_Pending.finish();
+    }
+
+private:
+    std::mutex m_InjectMutex;
+    ThreadPoolPrivate::PriorityTaskQueue<Task*> m_Injected;//全局注入队列
+    std::condition_variable m_NotFull;
+    std::size_t m_Blocked = 0;//等待全局注入队列空出位置的线程数量
+    std::atomic<std::size_t> m_Capacity{0};
+    std::atomic<unsigned> m_Overflow{ThreadPoolPrivate::BlockOverflow};
+    std::atomic<std::uint64_t> m_Overflowed[ThreadPoolPrivate::OverflowCount] = {};//队列已满的次数,按处理方式分类
+
+    std::shared_timed_mutex m_QueuesMutex;
+    std::vector<ThreadQueue*> m_Queues;//可以被窃取的线程
+
+    std::mutex m_SleepMutex;
+    std::vector<ThreadQueue*> m_Sleepers;//正在休眠的线程
+    std::atomic<std::size_t> m_SleeperCount{0};
+
+    std::atomic<std::size_t> m_Queued{0};//注入队列和所有双端队列中等待执行的任务数量
+    ThreadPoolPrivate::TaskCounter m_Pending;//整个线程池中等待执行和正在执行的任务数量,包括每个线程自己的任务队列中的任务
+    std::atomic<std::size_t> m_Depth[ThreadPoolPrivate::LevelCount] = {};//每一个优先级中等待执行的任务数量
+    std::atomic<std::size_t> m_StealIndex{0};
+};
+
 /**
  * @brief The ThreadQueue class
  */
 class ThreadQueue
 {
-    using TimePoint = std::chrono::time_point<std::chrono::system_clock,std::chrono::nanoseconds>;
-
     friend class ThreadPool;
+    friend class StealingScheduler;
 private:
-    ThreadQueue()
+    ThreadQueue(StealingScheduler* scheduler,ThreadPoolPrivate::Heartbeat* heartbeat):
+        m_Scheduler(scheduler),m_Heartbeat(heartbeat)
+    {
+        start();
+    }
+
+    ~ThreadQueue()
+    {
+        stop();
+    }
+
+    ///启动工作线程并开始接收任务,被stop()停止的ThreadQueue可以再次启动
+    void start()
     {
         m_Stop.store(false,std::memory_order_relaxed);
-        m_Stoped.store(true,std::memory_order_relaxed);
+        m_LastActive.store(m_Heartbeat->epoch(),std::memory_order_relaxed);
+        m_Pinned = false;
+        m_Scheduler->registerQueue(this);
         m_Thread = std::thread(&ThreadQueue::run,this);
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Active.store(true,std::memory_order_release);
     }
 
-    ~ThreadQueue()
+    ///停止接收任务并结束工作线程,自己的任务队列中剩余的任务留在队列中,由调用者转移给其他线程
+    void stop()
     {
-        m_Stop.store(true,std::memory_order_relaxed);
-        m_CV.notify_one();
+        requestStop();
+        join();
+    }
 
-        while (!m_Stoped.load(std::memory_order_relaxed)) {
-            std::this_thread::yield();
+    ///标记为停止接收任务并通知工作线程退出,不等待线程结束
+    void requestStop()
+    {
+        {
+            //在锁中标记为停止接收任务,之后addTask()一定会失败,不会有任务被添加到即将停止的线程中
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Active.store(false,std::memory_order_release);
+            m_Stop.store(true,std::memory_order_relaxed);
+            m_NotFull.notify_all();
         }
+        m_CV.notify_one();
+    }
 
+    ///等待requestStop()之后的工作线程结束,然后把双端队列中剩余的任务交给其他线程
+    void join()
+    {
         if (m_Thread.joinable())
             m_Thread.join();
+
+        //线程已经退出,此时停止线程的调用者成为双端队列唯一的持有者,将剩余的任务转移到全局注入队列中交给其他线程执行
+        m_Scheduler->unregisterQueue(this);
+        StealingScheduler::Task* task = nullptr;
+        bool moved = false;
+        while (m_Local.pop(task))
+        {
+            m_Scheduler->inject(task,ThreadPoolPrivate::NormalLevel);
+            moved = true;
+        }
+        if(moved)
+            m_Scheduler->wakeOne();
+    }
+
+    ///是否正在接收任务
+    bool active() const noexcept
+    {
+        return m_Active.load(std::memory_order_acquire);
+    }
+
+    ///等待执行和正在执行的任务数量,只读取原子计数,不需要加锁
+    std::size_t load() const noexcept
+    {
+        std::size_t load = m_BusySince.load(std::memory_order_relaxed) != 0 ? 1 : 0;
+        for(unsigned level = 0; level < ThreadPoolPrivate::LevelCount; level++)
+            load += m_Depth[level].load(std::memory_order_relaxed);
+        return load;
+    }
+
+    ///线程最后一次执行完任务时的纪元
+    std::uint64_t lastActive() const noexcept
+    {
+        return m_LastActive.load(std::memory_order_relaxed);
     }
 
     ThreadQueue(const ThreadQueue&) = delete ;
@@ -60,289 +351,2233 @@ private:
         return m_TaskQue.size();
     }
 
-    void addTask(const std::function<void()>&& task)
+    ///当前线程所属的ThreadQueue,不是线程池中的线程时为nullptr
+    static ThreadQueue*& current() noexcept
+    {
+        static thread_local ThreadQueue* queue = nullptr;
+        return queue;
+    }
+
+    ///某一优先级中等待执行的任务数量
+    std::size_t depth(unsigned level) const noexcept
     {
+        return m_Depth[level].load(std::memory_order_relaxed);
+    }
+
+    ///添加一个任务,任务队列已满时按policy处理:Block等待队列空出位置,DropOldest丢弃最早提交的低优先级任务,其他策略返回Full
+    ///线程已经停止接收任务时返回Stopped,返回Stopped和Full时task不会被移动
+    template<typename...TimePoint>
+    ThreadPoolPrivate::Admission addTask(ThreadPoolPrivate::TaskWrapper&& task,unsigned level,unsigned policy,TimePoint...deadline)
+    {
+        ThreadPoolPrivate::TaskWrapper dropped;//在锁外销毁
         std::unique_lock<std::mutex> lock(m_Mutex);
+        if(!m_Active.load(std::memory_order_relaxed))
+            return ThreadPoolPrivate::Stopped;
+
+        const std::size_t capacity = m_Scheduler->capacity();
+        if(capacity != 0 && m_TaskQue.size() >= capacity)
+        {
+            m_Scheduler->overflowed(policy);
+            if(policy == ThreadPoolPrivate::BlockOverflow)
+            {
+                m_Blocked++;
+                m_NotFull.wait(lock,[this](){
+                    const std::size_t limit = m_Scheduler->capacity();
+                    return !m_Active.load(std::memory_order_relaxed) || limit == 0 || m_TaskQue.size() < limit;
+                });
+                m_Blocked--;
+                if(!m_Active.load(std::memory_order_relaxed))
+                    return ThreadPoolPrivate::Stopped;
+            }
+            else if(policy == ThreadPoolPrivate::DropOldestOverflow)
+            {
+                unsigned droppedLevel = 0;
+                m_TaskQue.dropOldest(dropped,droppedLevel);
+                m_Depth[droppedLevel].fetch_sub(1,std::memory_order_relaxed);
+            }
+            else
+            {
+                return ThreadPoolPrivate::Full;
+            }
+        }
+
+        m_Scheduler->m_Pending.add(1);
         bool isEmpty = this->m_TaskQue.empty();
-        m_TaskQue.emplace(std::move(task));
+        m_TaskQue.push(std::move(task),level,deadline...);
+        m_Depth[level].fetch_add(1,std::memory_order_relaxed);
+#ifdef THREADPOOL_METRICS
+        m_Metrics.enqueued(m_TaskQue.size());
+#endif
         lock.unlock();
 
         //仅在队列为空的情况下才唤醒线程
         if(isEmpty)
             m_CV.notify_one();
+
+        if(dropped)
+        {
+            dropped.reset();
+            m_Scheduler->finishTask();
+        }
+        return ThreadPoolPrivate::Admitted;
+    }
+
+    ///预先分配capacity个任务的存储空间,并唤醒等待队列空出位置的线程
+    void reserve(std::size_t capacity)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_TaskQue.reserve(capacity);
+        m_NotFull.notify_all();
+    }
+
+    ///把已经被取消的任务从任务队列中移除并追加到cancelled中,由调用者在锁外执行
+    void takeCancelled(std::vector<ThreadPoolPrivate::TaskWrapper>& cancelled)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        const std::size_t removed = m_TaskQue.removeIf([](const ThreadPoolPrivate::TaskWrapper& task){
+            return task.cancelled();
+        },[this,&cancelled](ThreadPoolPrivate::TaskWrapper&& task,unsigned level){
+            m_Depth[level].fetch_sub(1,std::memory_order_relaxed);
+            cancelled.push_back(std::move(task));
+        });
+
+        if(removed != 0 && m_Blocked != 0)
+            m_NotFull.notify_all();
+    }
+
+    ///批量添加任务,整个批次只加锁一次并且最多唤醒一次线程,批量任务不受队列容量限制;线程已经停止接收任务时返回false,任务不会被移动
+    bool addTasks(ThreadPoolPrivate::TaskWrapper* first,ThreadPoolPrivate::TaskWrapper* last)
+    {
+        if(first == last)
+            return true;
+
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        if(!m_Active.load(std::memory_order_relaxed))
+            return false;
+
+        m_Scheduler->m_Pending.add(static_cast<std::size_t>(last - first));
+        bool isEmpty = this->m_TaskQue.empty();
+        m_Depth[ThreadPoolPrivate::NormalLevel].fetch_add(static_cast<std::size_t>(last - first),std::memory_order_relaxed);
+        for(; first != last; ++first)
+            m_TaskQue.push(std::move(*first),ThreadPoolPrivate::NormalLevel);
+#ifdef THREADPOOL_METRICS
+        m_Metrics.enqueued(m_TaskQue.size());
+#endif
+        lock.unlock();
+
+        if(isEmpty)
+            m_CV.notify_one();
+        return true;
     }
 
-    //这个函数只能在ThreadQueue对象刚刚创建还没有开始执行任务的时候调用,否则目标对象other没有对任务队列加锁,是不安全的行为
-    //所以这个函数仅仅只能用于转移任务队列到闲置的线程
+    //将当前线程等待执行的任务转移到other,用于把被占用线程的任务转移到闲置线程
+    //闲置线程的工作线程可能正在检查自己的任务队列,所以两个队列都需要加锁
     void moveTasks(ThreadQueue& other)
     {
         {
-            std::unique_lock<std::mutex> lock(m_Mutex);
-            other.m_TaskQue = std::move(this->m_TaskQue);
+            std::unique_lock<std::mutex> lock(m_Mutex,std::defer_lock);
+            std::unique_lock<std::mutex> otherLock(other.m_Mutex,std::defer_lock);
+            std::lock(lock,otherLock);
+#ifdef THREADPOOL_METRICS
+            m_Metrics.migrated(other.m_Metrics,m_TaskQue.size());
+#endif
+            m_TaskQue.moveTo(other.m_TaskQue);
+#ifdef THREADPOOL_METRICS
+            other.m_Metrics.enqueued(other.m_TaskQue.size());
+#endif
+            for(unsigned level = 0; level < ThreadPoolPrivate::LevelCount; level++)
+                other.m_Depth[level].fetch_add(m_Depth[level].exchange(0,std::memory_order_relaxed),std::memory_order_relaxed);
+
+            if(m_Blocked != 0)
+                m_NotFull.notify_all();
         }
         other.m_CV.notify_one();
     }
 
-    bool occupied() const noexcept
+    ///把线程分配到node节点的cpu上,只能在线程被发布到线程池之前调用
+    void place(unsigned node,unsigned cpu)
     {
-        bool occupyFlag = false;
-        //如果起始时间大于结束时间,说明任务正在执行,如果执行时间大于10s,则进一步认为线程池被占用了,否则说明线程正在闲置
-        if(m_Start > m_End)
-        {
-            std::chrono::nanoseconds interval = std::chrono::system_clock::now() - m_Start;
-            double time = std::chrono::duration_cast<std::chrono::duration<double,std::ratio<1,1000>>>(interval).count();
+        m_Node = node;
+        m_Cpu = cpu;
+    }
 
-            occupyFlag = time > 10*1000;
+    ///pin为true时把线程绑定到分配给它的CPU,否则允许线程在所有CPU上运行
+    void pin(bool pin)
+    {
+        if(pin)
+        {
+            m_Pinned = ThreadPoolPrivate::setThreadAffinity(m_Thread,std::vector<unsigned>(1,m_Cpu));
+        }
+        else if(m_Pinned)
+        {
+            ThreadPoolPrivate::setThreadAffinity(m_Thread,allCpus());
+            m_Pinned = false;
         }
-        return occupyFlag;
+    }
+
+    static std::vector<unsigned> allCpus()
+    {
+        std::vector<unsigned> cpus;
+        for(const std::vector<unsigned>& node : ThreadPoolPrivate::CpuTopology::system().nodes())
+            cpus.insert(cpus.end(),node.begin(),node.end());
+        return cpus;
+    }
+
+    ///是否正在执行任务
+    bool busy() const noexcept
+    {
+        return m_BusySince.load(std::memory_order_relaxed) != 0;
+    }
+
+    bool occupied() const noexcept
+    {
+        //m_BusySince不为0说明任务正在执行,如果执行时间超过了线程池设定的阈值,则进一步认为线程被占用了
+        return m_Heartbeat->expired(m_BusySince.load(std::memory_order_relaxed));
     }
 
     bool isIdle()
     {
         std::unique_lock<std::mutex> lock(m_Mutex);
-        return m_TaskQue.empty() && (m_End >= m_Start);
+        return m_TaskQue.empty() && m_Local.empty() && m_BusySince.load(std::memory_order_acquire) == 0;
     }
 
-    ///等待当前线程任务完成
-    void wait(std::promise<bool>&& p)
+    ///从自己的任务队列中取出指定优先级的任务,用原子计数跳过空的优先级,避免无谓的加锁
+    bool takeOwnTask(ThreadPoolPrivate::TaskWrapper& task,unsigned level)
     {
+        if(m_Depth[level].load(std::memory_order_relaxed) == 0)
+            return false;
+
         std::unique_lock<std::mutex> lock(m_Mutex);
-        if(m_TaskQue.empty() && (m_End >= m_Start))
+        if(!m_TaskQue.pop(task,level))
+            return false;
+
+        m_Depth[level].fetch_sub(1,std::memory_order_relaxed);
+        if(m_Blocked != 0)
+            m_NotFull.notify_one();
+        return true;
+    }
+
+    ///获取一个指定优先级的工作窃取模式任务
+    ///普通优先级的任务优先从自己的双端队列获取,然后是全局注入队列,最后从其他线程窃取;其他优先级的任务只存在于全局注入队列中
+    bool takeStealingTask(StealingScheduler::Task*& task,unsigned level)
+    {
+        if(!m_Scheduler->hasWork() || m_Scheduler->depth(level) == 0)
+            return false;
+
+        bool taken = false;
+        if(level == ThreadPoolPrivate::NormalLevel)
         {
-            p.set_value(false);
+            taken = m_Local.pop(task) || m_Scheduler->takeInjected(task,level);
+            if(!taken && m_Scheduler->steal(this,task))
+            {
+                taken = true;
+#ifdef THREADPOOL_METRICS
+                m_Metrics.stole();
+#endif
+            }
         }
         else
         {
-            m_DoneFlag.store(true);
-            m_Done = std::move(p);
+            taken = m_Scheduler->takeInjected(task,level);
+        }
+
+        if(taken)
+        {
+            m_Scheduler->m_Depth[level].fetch_sub(1,std::memory_order_relaxed);
+            m_Scheduler->m_Queued.fetch_sub(1,std::memory_order_acq_rel);
+        }
+        return taken;
+    }
+
+    ///按优先级从高到低获取任务,同一优先级中先检查自己的任务队列,再检查工作窃取模式的任务
+    bool takeTask(ThreadPoolPrivate::TaskWrapper& task,StealingScheduler::Task*& stolen)
+    {
+        for(unsigned level = 0; level < ThreadPoolPrivate::LevelCount; level++)
+        {
+            if(takeOwnTask(task,level) || takeStealingTask(stolen,level))
+                return true;
         }
+        return false;
+    }
+
+    ///执行任务并且记录任务开始执行时的纪元
+    template<typename Task>
+    void execute(Task& task)
+    {
+        m_BusySince.store(m_Heartbeat->epoch(),std::memory_order_relaxed);
+#ifdef THREADPOOL_METRICS
+        const std::uint64_t start = ThreadPoolPrivate::metricsNow();
+        task();
+        m_Metrics.finished(task.stamp(),start);
+#else
+        task();
+#endif
+        m_LastActive.store(m_Heartbeat->epoch(),std::memory_order_relaxed);
+        m_BusySince.store(0,std::memory_order_release);
     }
 
     void run()
     {
-        m_Stoped.store(false);
+        current() = this;
         while (!m_Stop.load(std::memory_order_relaxed))
         {
-            if(this->empty())
+            ThreadPoolPrivate::TaskWrapper task;
+            StealingScheduler::Task* stolen = nullptr;
+            if(takeTask(task,stolen))
             {
-                std::unique_lock<std::mutex> lock(m_Mutex);
-                if(m_DoneFlag.load())
+                if(stolen != nullptr)
+                {
+                    execute(*stolen);
+
+                    StealingScheduler::releaseTask(stolen);
+                    m_Scheduler->finishTask();
+                }
+                else
                 {
-                    //m_DoneFlag控制线程只在调用了wait(std::promise<bool>&& p)之后设置一次promise
-                    m_Done.set_value(true);
-                    m_DoneFlag.store(false);
+                    execute(task);
+                    task = ThreadPoolPrivate::TaskWrapper();
+                    m_Scheduler->finishTask();
                 }
-                m_CV.wait(lock,[this](){return !m_TaskQue.empty() || m_Stop.load(std::memory_order_relaxed);});
             }
             else
             {
-                std::unique_lock<std::mutex> lock(m_Mutex);
-                std::function<void()> task = std::move(m_TaskQue.front());
-                m_TaskQue.pop();
-                lock.unlock();
-
-                m_Start = std::chrono::system_clock::now();
-                task();
-                m_End = std::chrono::system_clock::now();
+                //先登记为休眠线程再检查等待条件,这样提交任务的线程要么能找到这个线程并唤醒它,要么这个线程能看到新提交的任务
+                m_Scheduler->addSleeper(this);
+                {
+                    std::unique_lock<std::mutex> lock(m_Mutex);
+                    m_CV.wait(lock,[this](){
+                        return !m_TaskQue.empty() || m_Stop.load(std::memory_order_relaxed) || m_Scheduler->hasWork();
+                    });
+                }
+                m_Scheduler->removeSleeper(this);
             }
         }
-        m_Stoped.store(true);
     }
 
 private:
-    std::queue<std::function<void()>> m_TaskQue;
+    ThreadPoolPrivate::PriorityTaskQueue<ThreadPoolPrivate::TaskWrapper> m_TaskQue;
+    std::atomic<std::size_t> m_Depth[ThreadPoolPrivate::LevelCount] = {};//每一个优先级中等待执行的任务数量
+    ThreadPoolPrivate::WorkStealingDeque<StealingScheduler::Task*> m_Local;//工作窃取模式下本线程提交的任务
+    StealingScheduler* m_Scheduler = nullptr;
+    ThreadPoolPrivate::Heartbeat* m_Heartbeat = nullptr;
     std::thread m_Thread;
     std::mutex m_Mutex;
     std::condition_variable m_CV;
+    std::condition_variable m_NotFull;//有界队列已满时提交任务的线程在这里等待
+    std::size_t m_Blocked = 0;//等待队列空出位置的线程数量
     std::atomic<bool> m_Stop;
-    std::atomic<bool> m_Stoped;
-    std::atomic<bool> m_DoneFlag{false};
-    std::promise<bool> m_Done;
-    TimePoint m_Start = std::chrono::system_clock::now();
-    //结束时间小于或者等于起始时间都能代表线程闲置,由于系统缓存的原因,在重复执行同一个任务时有可能会在1ns内完成,此时两个时刻就是相等的
-    TimePoint m_End =  std::chrono::system_clock::now();
+    std::atomic<std::uint64_t> m_BusySince{0};//当前任务开始执行时的心跳纪元,为0表示线程闲置
+    std::atomic<std::uint64_t> m_LastActive{0};//最后一次执行完任务时的心跳纪元,用于判断闲置时长
+    std::atomic<bool> m_Active{false};//为false时addTask()失败,线程即将停止或者已经停止
+    unsigned m_Node = 0;//线程所属的NUMA节点
+    unsigned m_Cpu = 0;//分配给线程的CPU,只有m_Pinned为true时线程才真正被绑定到这个CPU上
+    bool m_Pinned = false;
+#ifdef THREADPOOL_METRICS
+    ThreadPoolPrivate::WorkerMetrics m_Metrics;
+    std::size_t m_Id = 0;//线程在追踪记录中的编号,在线程池中唯一
+#endif
 };
 
-/**
- * @brief The ThreadPool class
- *
- *如果在添加新的任务的时候有线程池被占用了,就创建一个新的线程池,然后将被占用线程池中的任务移动到新的线程池中
- *如果在添加新的任务时检测到之前被占用的线程池现在已经闲置了,就释放掉多余的线程池,使活跃的线程池数量尽量和CPU核心数保持一致
- */
-class ThreadPool
+inline void StealingScheduler::submit(Task* task,unsigned level)
 {
-public:
-    enum Distribution{
-        Ordered,//按线程池顺序依次分配任务
-        Balanced//按线程池任务分布情况均匀地将任务分配给线程
-    };
+    //先增加计数再压入任务,保证任务被取走时计数不会小于0
+    m_Pending.add(1);
+    m_Depth[level].fetch_add(1,std::memory_order_relaxed);
+    m_Queued.fetch_add(1,std::memory_order_seq_cst);
+
+    ThreadQueue* queue = ThreadQueue::current();
+    if(level == ThreadPoolPrivate::NormalLevel && queue != nullptr && queue->m_Scheduler == this)
+        queue->m_Local.push(task);
+    else
+        inject(task,level);
 
-    ThreadPool(unsigned size = 0)
+    wakeOne();
+}
+
+inline void StealingScheduler::submit(Task* task,unsigned level,Clock::time_point deadline)
+{
+    m_Pending.add(1);
+    m_Depth[level].fetch_add(1,std::memory_order_relaxed);
+    m_Queued.fetch_add(1,std::memory_order_seq_cst);
     {
-        if(size >  std::thread::hardware_concurrency() || size == 0)
-            size = std::thread::hardware_concurrency();
+        std::unique_lock<std::mutex> lock(m_InjectMutex);
+        m_Injected.push(std::move(task),level,deadline);
+    }
+    wakeOne();
+}
 
-        for(unsigned i = 0; i < size; i++)
-        {
-            m_Threads.push_back(new ThreadQueue());
-        }
-        m_CurrentThread = m_Threads.begin();
+template<typename...TimePoint>
+ThreadPoolPrivate::Admission StealingScheduler::offer(Task* task,unsigned level,unsigned policy,TimePoint...deadline)
+{
+    const std::size_t capacity = m_Capacity.load(std::memory_order_relaxed);
+    ThreadQueue* queue = ThreadQueue::current();
+    if(capacity == 0 || (sizeof...(deadline) == 0 && level == ThreadPoolPrivate::NormalLevel && queue != nullptr && queue->m_Scheduler == this))
+    {
+        submit(task,level,deadline...);
+        return ThreadPoolPrivate::Admitted;
     }
 
-    ~ThreadPool()
+    Task* dropped = nullptr;
     {
-        std::vector<ThreadQueue*>::iterator it = m_Threads.begin();
-        while (it != m_Threads.end())
+        std::unique_lock<std::mutex> lock(m_InjectMutex);
+        if(m_Injected.size() >= capacity)
         {
-            //如果线程未被占用,就结束线程,**对于被占用的线程暂时不处理**
-            if( !(*it)->occupied() )
+            overflowed(policy);
+            if(policy == ThreadPoolPrivate::BlockOverflow)
+            {
+                m_Blocked++;
+                m_NotFull.wait(lock,[this](){
+                    const std::size_t limit = m_Capacity.load(std::memory_order_relaxed);
+                    return limit == 0 || m_Injected.size() < limit;
+                });
+                m_Blocked--;
+            }
+            else if(policy == ThreadPoolPrivate::DropOldestOverflow)
+            {
+                unsigned droppedLevel = 0;
+                m_Injected.dropOldest(dropped,droppedLevel);
+                m_Depth[droppedLevel].fetch_sub(1,std::memory_order_relaxed);
+                m_Queued.fetch_sub(1,std::memory_order_acq_rel);
+            }
+            else
             {
-                delete (*it);
-                ++it;
+                return ThreadPoolPrivate::Full;
             }
         }
+
+        m_Pending.add(1);
+        m_Depth[level].fetch_add(1,std::memory_order_relaxed);
+        m_Queued.fetch_add(1,std::memory_order_seq_cst);
+        m_Injected.push(std::move(task),level,deadline...);
     }
+    wakeOne();
 
-    ThreadPool(const ThreadPool&) = delete ;
+    //被丢弃的任务在锁外销毁,它的future会得到broken_promise
+    if(dropped != nullptr)
+    {
+        releaseTask(dropped);
+        finishTask();
+    }
+    return ThreadPoolPrivate::Admitted;
+}
 
-    ThreadPool(ThreadPool&& other) = delete ;
+inline unsigned StealingScheduler::overflowPolicy() const noexcept
+{
+    const unsigned policy = m_Overflow.load(std::memory_order_relaxed);
+    ThreadQueue* queue = ThreadQueue::current();
+    if(policy == ThreadPoolPrivate::BlockOverflow && queue != nullptr && queue->m_Scheduler == this)
+        return ThreadPoolPrivate::CallerRunsOverflow;
+    return policy;
+}
 
-    ThreadPool& operator = (const ThreadPool&) = delete ;
+inline void StealingScheduler::submitBatch(Task** first,Task** last)
+{
+    const std::size_t count = static_cast<std::size_t>(last - first);
+    if(count == 0)
+        return;
 
-    ThreadPool& operator = (ThreadPool&&) = delete ;
+    m_Pending.add(count);
+    m_Depth[ThreadPoolPrivate::NormalLevel].fetch_add(count,std::memory_order_relaxed);
+    m_Queued.fetch_add(count,std::memory_order_seq_cst);
 
-    ///启动一个后台任务,返回值是一个与std::packaged_task相关联的future,当传入的函数抛出异常时异常会被保存到future中,因此不会对线程池的while循环造成破坏
-    ///对future调用get()等同于同步执行任务,当前线程会阻塞直到后台任务完成并获取返回值
-    ///不对future调用get()等同于异步执行任务,当前线程会继续向下执行并忽视返回值
-    template<Distribution Mode = Ordered,typename Func,typename...Args,typename ReturnType = typename MetaUtility::FunctionTraits<Func>::ReturnType>
-    std::future<ReturnType> run(Func func,Args&&...args)
+    ThreadQueue* queue = ThreadQueue::current();
+    if(queue != nullptr && queue->m_Scheduler == this)
     {
-        //1.检测是否存在新的被占用的线程
-        detectNewIdleThread();
-
-        //2.清除线程池中多余的闲置线程
-        deleteIdleThread();
+        for(Task** it = first; it != last; ++it)
+            queue->m_Local.push(*it);
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(m_InjectMutex);
+        for(Task** it = first; it != last; ++it)
+            m_Injected.push(std::move(*it),ThreadPoolPrivate::NormalLevel);
+    }
 
-        //3.按要求查找一个未被占用的线程
-        ThreadQueue* t = useableThread<Mode>();
+    for(std::size_t i = 0; i < count && m_SleeperCount.load(std::memory_order_seq_cst) > 0; i++)
+        wakeOne();
+}
 
-        //4.封装任务并且将任务添加到线程队列中
-        auto task = std::make_shared<std::packaged_task<ReturnType()>>(std::bind(func,std::forward<Args>(args)...));
-        std::future<ReturnType> future = task->get_future();
-        t->addTask([task](){(*task)();});
-        return future;
+inline bool StealingScheduler::steal(ThreadQueue* thief,Task*& task)
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_QueuesMutex);
+    const std::size_t count = m_Queues.size();
+    const std::size_t start = m_StealIndex.fetch_add(1,std::memory_order_relaxed);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        ThreadQueue* victim = m_Queues[(start + i) % count];
+        if(victim != thief && victim->m_Local.steal(task))
+            return true;
+    }
+    return false;
+}
+
+inline void StealingScheduler::wakeOne()
+{
+    if(m_SleeperCount.load(std::memory_order_seq_cst) == 0)
+        return;
+
+    //持有m_SleepMutex时唤醒线程,ThreadQueue析构前会在这个锁下把自己从休眠列表中移除,因此这里的指针一定有效
+    std::unique_lock<std::mutex> sleepLock(m_SleepMutex);
+    if(m_Sleepers.empty())
+        return;
+
+    ThreadQueue* queue = m_Sleepers.back();
+    m_Sleepers.pop_back();
+    m_SleeperCount.store(m_Sleepers.size(),std::memory_order_seq_cst);
+    {
+        std::unique_lock<std::mutex> lock(queue->m_Mutex);
+    }
+    queue->m_CV.notify_one();
+}
+
+/**
+ * @brief The TaskFuture class : 支持后续任务的future
+ * 和std::shared_future类似,TaskFuture可以被拷贝,多个副本共享同一个结果
+ * then()注册的后续任务在前一个任务完成时才会被提交到线程池中执行,不会阻塞任何一个线程去等待前一个任务
+ */
+template<typename T>
+class TaskFuture
+{
+    template<typename>
+    friend class TaskFuture;
+    friend class ThreadPool;
+    friend class TaskGraph;
+
+    using State = ThreadPoolPrivate::FutureState<T>;
+
+    ///后续任务的返回值类型,void类型的TaskFuture的后续任务不接受参数,其他类型的后续任务接受前一个任务的返回值
+    template<typename Func,typename U = T>
+    struct ContinuationResult
+    {
+        using type = decltype(std::declval<Func&>()(std::declval<const U&>()));
+    };
+
+    template<typename Func>
+    struct ContinuationResult<Func,void>
+    {
+        using type = decltype(std::declval<Func&>()());
+    };
+
+public:
+    TaskFuture() = default;
+
+    ///future是否关联了一个任务
+    bool valid() const noexcept
+    {
+        return m_State != nullptr;
+    }
+
+    bool ready() const
+    {
+        return m_State->ready();
+    }
+
+    void wait() const
+    {
+        m_State->wait();
+    }
+
+    ///阻塞直到任务完成并返回结果的引用,任务抛出的异常会在这里重新抛出
+    typename State::Reference get() const
+    {
+        return m_State->get();
+    }
+
+    ///注册一个后续任务,当前任务完成之后func会被提交到线程池中执行,参数是当前任务的返回值
+    ///如果当前任务抛出了异常,func不会被执行,异常会直接传递给返回的TaskFuture
+    template<typename Func,typename ReturnType = typename ContinuationResult<Func>::type>
+    TaskFuture<ReturnType> then(Func func) const
+    {
+        std::shared_ptr<State> prev = m_State;
+        auto next = ThreadPoolPrivate::makeFutureState<ReturnType>(prev->executor());
+        prev->onReady([prev,next,func]() mutable {
+            prev->executor()([prev,next,func]() mutable {
+                if(prev->error())
+                {
+                    next->setException(prev->error());
+                    return;
+                }
+                auto call = [&prev,&func]() -> ReturnType {return invoke(func,*prev);};
+                ThreadPoolPrivate::fulfil(*next,call);
+            });
+        });
+        return TaskFuture<ReturnType>(next);
+    }
+
+#ifdef THREADPOOL_COROUTINE
+    ///在协程中等待任务完成,不阻塞线程,等待的协程在线程池中恢复执行
+    auto operator co_await() const noexcept
+    {
+        struct Awaiter
+        {
+            std::shared_ptr<State> state;
+
+            bool await_ready() const
+            {
+                return state->ready();
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) const
+            {
+                std::shared_ptr<State> current = state;
+                current->onReady([current,handle](){
+                    current->executor()(ThreadPoolPrivate::ResumeTask(handle));
+                });
+            }
+
+            typename State::Reference await_resume() const
+            {
+                return state->get();
+            }
+        };
+        return Awaiter{m_State};
+    }
+#endif
+
+private:
+    explicit TaskFuture(std::shared_ptr<State> state):m_State(std::move(state)){}
+
+    template<typename Func,typename U>
+    static auto invoke(Func& func,const ThreadPoolPrivate::FutureState<U>& state) -> decltype(func(state.get()))
+    {
+        return func(state.get());
+    }
+
+    template<typename Func>
+    static auto invoke(Func& func,const ThreadPoolPrivate::FutureState<void>& state) -> decltype(func())
+    {
+        state.get();
+        return func();
+    }
+
+private:
+    std::shared_ptr<State> m_State;
+};
+
+#ifdef THREADPOOL_COROUTINE
+/**
+ * @brief The Task class : 协程任务
+ * 返回Task<T>的函数是一个协程,调用时不会立即执行,被co_await或者交给ThreadPool::spawn()之后才开始执行
+ * 协程结束时直接恢复等待它的协程,整个过程不会阻塞任何线程
+ */
+template<typename T = void>
+class Task
+{
+public:
+    struct promise_type : ThreadPoolPrivate::TaskPromise<T>
+    {
+        Task get_return_object() noexcept
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    Task(Task&& other) noexcept:m_Handle(std::exchange(other.m_Handle,nullptr)){}
+
+    Task& operator = (Task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            if(m_Handle)
+                m_Handle.destroy();
+            m_Handle = std::exchange(other.m_Handle,nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete ;
+
+    Task& operator = (const Task&) = delete ;
+
+    ~Task()
+    {
+        if(m_Handle)
+            m_Handle.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return m_Handle.done();
+    }
+
+    ///开始执行这个协程,结束时恢复awaiting
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_Handle.promise().setContinuation(awaiting);
+        return m_Handle;
+    }
+
+    T await_resume()
+    {
+        return m_Handle.promise().take();
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle):m_Handle(handle){}
+
+private:
+    std::coroutine_handle<promise_type> m_Handle;
+};
+#endif
+
+/**
+ * @brief The TaskCancelled class : 任务在开始执行之前被取消时,future中保存的异常
+ */
+class TaskCancelled : public std::runtime_error
+{
+public:
+    TaskCancelled():std::runtime_error("task cancelled"){}
+};
+
+class CancellationSource;
+
+/**
+ * @brief The CancellationToken class : 取消令牌
+ * 由CancellationSource创建,可以被任意拷贝;默认构造的令牌永远不会被取消
+ * 正在执行的任务可以通过cancelled()或者throwIfCancelled()检查自己是否已经被取消
+ */
+class CancellationToken
+{
+    friend class CancellationSource;
+public:
+    CancellationToken() = default;
+
+    bool cancelled() const noexcept
+    {
+        return m_State != nullptr && m_State->cancelled.load(std::memory_order_acquire);
+    }
+
+    ///已经被取消时抛出TaskCancelled,在任务中调用时异常会被保存到future中
+    void throwIfCancelled() const
+    {
+        if(cancelled())
+            throw TaskCancelled();
+    }
+
+private:
+    explicit CancellationToken(const std::shared_ptr<ThreadPoolPrivate::CancelState>& state):m_State(state){}
+
+private:
+    std::shared_ptr<ThreadPoolPrivate::CancelState> m_State;
+};
+
+/**
+ * @brief The CancellationSource class : 取消源
+ * cancel()之后所有关联令牌的任务中,还在队列中等待的任务不会再被执行,它们的future会得到TaskCancelled
+ * 线程池的控制线程会尽快把这些任务从队列中移除,正在执行的任务需要自己检查令牌
+ */
+class CancellationSource
+{
+public:
+    CancellationSource():
+        m_State(std::allocate_shared<ThreadPoolPrivate::CancelState>(ThreadPoolPrivate::TaskAllocator<ThreadPoolPrivate::CancelState>())){}
+
+    CancellationToken token() const
+    {
+        return CancellationToken(m_State);
+    }
+
+    ///取消所有关联的任务,可以被多次调用
+    void cancel() noexcept
+    {
+        if(!m_State->cancelled.exchange(true,std::memory_order_acq_rel))
+            ThreadPoolPrivate::cancelEpoch().fetch_add(1,std::memory_order_release);
+    }
+
+    bool cancelled() const noexcept
+    {
+        return m_State->cancelled.load(std::memory_order_acquire);
+    }
+
+private:
+    std::shared_ptr<ThreadPoolPrivate::CancelState> m_State;
+};
+
+/**
+ * @brief The ThreadPool class
+ *
+ *线程池内部的控制线程在后台检测被占用的线程,把被占用线程中等待执行的任务转移到闲置线程中,必要时启动新的线程
+ *控制线程还会根据排队情况和闲置时长在设定的上下限之间增加或者停止线程
+ */
+class ThreadPool
+{
+public:
+    enum Distribution{
+        Ordered,//按线程池顺序依次分配任务
+        Balanced,//按线程池任务分布情况均匀地将任务分配给线程
+        Stealing//工作窃取:任务进入全局注入队列或提交线程自己的无锁队列,空闲线程主动从其他线程窃取任务
+    };
+
+    enum Priority{
+        High = ThreadPoolPrivate::HighLevel,//高优先级,例如对延迟敏感的控制消息
+        Normal = ThreadPoolPrivate::NormalLevel,//默认优先级
+        Background = ThreadPoolPrivate::BackgroundLevel//后台任务,只有在没有更高优先级任务时才会被执行
+    };
+
+    ///有界队列已满时的处理方式
+    enum Overflow{
+        Block = ThreadPoolPrivate::BlockOverflow,//等待队列空出位置,线程池内部的线程提交任务时按CallerRuns处理
+        Reject = ThreadPoolPrivate::RejectOverflow,//放弃提交,post()返回false,run()和async()返回的future得到broken_promise
+        DropOldest = ThreadPoolPrivate::DropOldestOverflow,//丢弃队列中优先级最低并且最早提交的任务,被丢弃任务的future得到broken_promise
+        CallerRuns = ThreadPoolPrivate::CallerRunsOverflow//在提交任务的线程中直接执行任务
+    };
+
+    ///队列已满的次数,按采取的处理方式分类
+    struct OverflowStats
+    {
+        std::uint64_t blocked = 0;
+        std::uint64_t rejected = 0;
+        std::uint64_t dropped = 0;
+        std::uint64_t callerRuns = 0;
+
+        std::uint64_t full() const noexcept
+        {
+            return blocked + rejected + dropped + callerRuns;
+        }
+    };
+
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    enum : std::size_t {ThreadCapacity = 1024};//线程数量上限的最大值
+
+    ///size同时也是线程数量的下限,控制线程不会停止线程使线程数量少于size
+    ThreadPool(unsigned size = 0):m_Threads(ThreadCapacity)
+    {
+        if(size >  std::thread::hardware_concurrency() || size == 0)
+            size = std::thread::hardware_concurrency();
+        size = std::max(size,1u);
+
+        m_MinThreads.store(size,std::memory_order_relaxed);
+        for(unsigned i = 0; i < size; i++)
+        {
+            addThread();
+        }
+        m_Controller = std::thread(&ThreadPool::control,this);
+    }
+
+    ~ThreadPool()
+    {
+        //先标记为正在析构,之后提交的任务不再选择线程,直接进入全局注入队列
+        m_Stopping.store(true,std::memory_order_release);
+
+        //先停止控制线程,之后线程数量不再变化
+        {
+            std::unique_lock<std::mutex> lock(m_ControlMutex);
+            m_ControlStop = true;
+        }
+        m_ControlCV.notify_one();
+        m_Controller.join();
+
+        //阻塞任务中可能还会向计算线程提交任务,所以先停止阻塞线程
+        m_Blocking.stop();
+
+        //未到期的定时器不再提交到线程池,在sleepFor()中挂起的协程在这里被恢复并得到broken_promise
+        m_Heartbeat.clearTimers();
+
+        //每一个线程都会执行完正在执行的任务之后才结束
+        //正在执行的任务还可能读取其他线程的状态,所以先停止所有线程,全部停止之后才释放ThreadQueue对象
+        for(ThreadQueue* thread : m_Threads)
+            thread->stop();
+
+        //丢弃还没有执行的工作窃取任务,对应的future得到broken_promise,等待恢复的协程在这里被恢复并得到broken_promise
+        m_Scheduler.clear();
+        for(ThreadQueue* thread : m_Threads)
+            delete thread;
+    }
+
+    ThreadPool(const ThreadPool&) = delete ;
+
+    ThreadPool(ThreadPool&& other) = delete ;
+
+    ThreadPool& operator = (const ThreadPool&) = delete ;
+
+    ThreadPool& operator = (ThreadPool&&) = delete ;
+
+    ///设置线程被认为已被占用的任务执行时长(毫秒),默认10秒
+    void setOccupiedThreshold(std::size_t msec) noexcept
+    {
+        m_Heartbeat.setThreshold(msec);
+    }
+
+    std::size_t occupiedThreshold() const noexcept
+    {
+        return static_cast<std::size_t>(m_Heartbeat.threshold());
+    }
+
+    ///启动一个后台任务,返回值是一个与std::packaged_task相关联的future,当传入的函数抛出异常时异常会被保存到future中,因此不会对线程池的while循环造成破坏
+    ///对future调用get()等同于同步执行任务,当前线程会阻塞直到后台任务完成并获取返回值
+    ///不对future调用get()等同于异步执行任务,当前线程会继续向下执行并忽视返回值
+    ///模板参数Level指定任务优先级,线程总是先执行高优先级的任务
+    template<Distribution Mode = Ordered,Priority Level = Normal,typename Func,typename...Args,
+             typename = typename std::enable_if<!std::is_same<typename std::decay<Func>::type,CancellationToken>::value>::type,
+             typename ReturnType = typename MetaUtility::FunctionTraits<Func>::ReturnType>
+    std::future<ReturnType> run(Func func,Args&&...args)
+    {
+        //封装任务并且按要求将任务添加到一个未被占用的线程或者工作窃取队列中,线程数量的调整由控制线程在后台完成
+        std::future<ReturnType> future;
+        dispatch<Mode>(makeTask<ReturnType>(future,func,std::forward<Args>(args)...),Level);
+        return future;
+    }
+
+    ///在阻塞线程中启动一个会长时间阻塞的任务(文件、串口、网络等I/O),返回值和run()相同
+    ///阻塞线程和计算线程分开,数量由setBlockingLimits()单独限制,阻塞任务不会占用计算线程,也不会触发被占用线程的任务转移
+    ///阻塞任务不受队列容量和优先级的影响
+    template<typename Func,typename...Args,typename ReturnType = typename MetaUtility::FunctionTraits<Func>::ReturnType>
+    std::future<ReturnType> runBlocking(Func func,Args&&...args)
+    {
+        std::future<ReturnType> future;
+        m_Blocking.submit(makeTask<ReturnType>(future,func,std::forward<Args>(args)...));
+        return future;
+    }
+
+    ///启动一个可以被取消的后台任务,token被取消时如果任务还没有开始执行,任务会被跳过,future得到TaskCancelled
+    ///已经开始执行的任务不会被打断,任务可以自己持有token的拷贝并定期检查
+    template<Distribution Mode = Ordered,Priority Level = Normal,typename Token,typename Func,typename...Args,
+             typename = typename std::enable_if<std::is_same<Token,CancellationToken>::value>::type,
+             typename ReturnType = typename MetaUtility::FunctionTraits<Func>::ReturnType>
+    std::future<ReturnType> run(const Token& token,Func func,Args&&...args)
+    {
+        std::promise<ReturnType> promise(std::allocator_arg,ThreadPoolPrivate::TaskAllocator<char>());
+        std::future<ReturnType> future = promise.get_future();
+        auto bound = std::bind(func,std::forward<Args>(args)...);
+        dispatch<Mode>(CancellableTask<ReturnType,decltype(bound)>(token,std::move(promise),std::move(bound)),Level);
+        return future;
+    }
+
+    ///启动一个带截止时间的后台任务,同一优先级中带截止时间的任务按截止时间最早优先的顺序执行,并且先于不带截止时间的任务执行
+    ///截止时间只用于排序,任务超过截止时间之后依然会被执行
+    template<Distribution Mode = Ordered,Priority Level = Normal,typename Func,typename...Args,typename ReturnType = typename MetaUtility::FunctionTraits<Func>::ReturnType>
+    std::future<ReturnType> runBefore(Deadline deadline,Func func,Args&&...args)
+    {
+        std::future<ReturnType> future;
+        dispatch<Mode>(makeTask<ReturnType>(future,func,std::forward<Args>(args)...),Level,deadline);
+        return future;
+    }
+
+    ///启动一个后台任务但不返回future,适用于不关心返回值的任务,省去了promise和共享状态的开销
+    ///由于没有future保存异常,任务中抛出的异常会被直接忽略,以免破坏线程的while循环
+    ///任务队列已满并且溢出策略为Reject时返回false,任务不会被执行
+    template<Distribution Mode = Ordered,Priority Level = Normal,typename Func,typename...Args>
+    bool post(Func func,Args&&...args)
+    {
+        auto bound = std::bind(func,std::forward<Args>(args)...);
+        return dispatch<Mode>([bound]() mutable {
+            try
+            {
+                bound();
+            }
+            catch (...){}
+        },Level);
+    }
+
+    ///启动一个后台任务并返回TaskFuture,可以通过then()注册后续任务,或者通过whenAll()/whenAny()组合多个任务
+    ///后续任务以工作窃取模式提交,在线程池内部完成的任务的后续任务会优先由同一个线程执行
+    template<Distribution Mode = Ordered,Priority Level = Normal,typename Func,typename...Args,typename ReturnType = typename MetaUtility::FunctionTraits<Func>::ReturnType>
+    TaskFuture<ReturnType> async(Func func,Args&&...args)
+    {
+        auto state = ThreadPoolPrivate::makeFutureState<ReturnType>(executor());
+        auto bound = std::bind(func,std::forward<Args>(args)...);
+        dispatch<Mode>(ThreadPoolPrivate::StateTask<ReturnType,decltype(bound)>(state,std::move(bound)),Level);
+        return TaskFuture<ReturnType>(state);
+    }
+
+    ///所有future都完成之后就绪,结果按输入顺序保存在vector中,任意一个任务抛出异常时返回的TaskFuture保存第一个被检测到的异常
+    template<typename T>
+    static TaskFuture<std::vector<T>> whenAll(const std::vector<TaskFuture<T>>& futures)
+    {
+        struct Context
+        {
+            std::vector<TaskFuture<T>> futures;
+            std::atomic<std::size_t> remaining;
+        };
+
+        auto state = ThreadPoolPrivate::makeFutureState<std::vector<T>>(futures.empty() ? ThreadPoolPrivate::Executor() : futures.front().m_State->executor());
+        if(futures.empty())
+        {
+            state->setValue();
+            return TaskFuture<std::vector<T>>(state);
+        }
+
+        auto context = std::make_shared<Context>();
+        context->futures = futures;
+        context->remaining.store(futures.size(),std::memory_order_relaxed);
+        for(const TaskFuture<T>& future : futures)
+        {
+            future.m_State->onReady([context,state](){
+                if(context->remaining.fetch_sub(1,std::memory_order_acq_rel) != 1)
+                    return;
+
+                std::vector<T> values;
+                values.reserve(context->futures.size());
+                for(const TaskFuture<T>& f : context->futures)
+                {
+                    if(f.m_State->error())
+                    {
+                        state->setException(f.m_State->error());
+                        return;
+                    }
+                    values.push_back(f.get());
+                }
+                state->setValue(std::move(values));
+            });
+        }
+        return TaskFuture<std::vector<T>>(state);
+    }
+
+    ///所有future都完成之后就绪,用于等待多个返回值类型不同或者没有返回值的任务,结果需要从原来的future中获取
+    template<typename...T>
+    static TaskFuture<void> whenAll(const TaskFuture<T>&...futures)
+    {
+        auto state = ThreadPoolPrivate::makeFutureState<void>(firstExecutor(futures...));
+        auto remaining = std::make_shared<std::atomic<std::size_t>>(sizeof...(T) + 1);
+        auto error = std::make_shared<std::exception_ptr>();
+        auto errorLock = std::make_shared<std::mutex>();
+
+        auto finish = [state,remaining,error,errorLock](){
+            if(remaining->fetch_sub(1,std::memory_order_acq_rel) != 1)
+                return;
+            if(*error)
+                state->setException(*error);
+            else
+                state->setValue();
+        };
+
+        //展开参数包,为每一个future注册完成回调
+        int expand[] = {0,(futures.m_State->onReady([finish,error,errorLock,futures](){
+            if(futures.m_State->error())
+            {
+                std::unique_lock<std::mutex> lock(*errorLock);
+                if(!*error)
+                    *error = futures.m_State->error();
+            }
+            finish();
+        }),0)...};
+        (void)expand;
+
+        finish();
+        return TaskFuture<void>(state);
+    }
+
+    ///任意一个future完成之后就绪,结果是最先完成的future在输入中的下标,即使这个任务抛出了异常
+    template<typename T>
+    static TaskFuture<std::size_t> whenAny(const std::vector<TaskFuture<T>>& futures)
+    {
+        auto state = ThreadPoolPrivate::makeFutureState<std::size_t>(futures.empty() ? ThreadPoolPrivate::Executor() : futures.front().m_State->executor());
+        if(futures.empty())
+        {
+            state->setException(std::make_exception_ptr(std::invalid_argument("whenAny requires at least one future")));
+            return TaskFuture<std::size_t>(state);
+        }
+
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        for(std::size_t i = 0; i < futures.size(); i++)
+        {
+            futures[i].m_State->onReady([state,done,i](){
+                if(!done->exchange(true,std::memory_order_acq_rel))
+                    state->setValue(i);
+            });
+        }
+        return TaskFuture<std::size_t>(state);
+    }
+
+#ifdef THREADPOOL_COROUTINE
+    ///线程池析构时还没有恢复的协程会在析构函数中被恢复,此时co_await抛出broken_promise
+    class ScheduleAwaiter
+    {
+    public:
+        explicit ScheduleAwaiter(ThreadPool* pool):m_Pool(pool){}
+
+        bool await_ready() const noexcept {return false;}
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_Pool->submitContinuation(ThreadPoolPrivate::ResumeTask(handle,&m_Cancelled));
+        }
+
+        void await_resume() const
+        {
+            if(m_Cancelled)
+                throw std::future_error(std::future_errc::broken_promise);
+        }
+
+    private:
+        ThreadPool* m_Pool;
+        bool m_Cancelled = false;
+    };
+
+    class SleepAwaiter
+    {
+    public:
+        SleepAwaiter(ThreadPool* pool,std::size_t msec):m_Pool(pool),m_Msec(msec){}
+
+        bool await_ready() const noexcept {return false;}
+
+        ///由心跳线程的时间轮计时,到期之后协程被提交回线程池,而不是在心跳线程中恢复
+        ///线程池析构时未到期的定时器被丢弃,协程在析构函数中被恢复并得到broken_promise
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            ThreadPool* pool = m_Pool;
+            ThreadPoolPrivate::ResumeTask resume(handle,&m_Cancelled);
+            if(m_Msec == 0)
+            {
+                pool->submitContinuation(std::move(resume));
+                return;
+            }
+            pool->m_Heartbeat.after(m_Msec,[pool,resume = std::move(resume)]() mutable {
+                pool->submitContinuation(std::move(resume));
+            });
+        }
+
+        void await_resume() const
+        {
+            if(m_Cancelled)
+                throw std::future_error(std::future_errc::broken_promise);
+        }
+
+    private:
+        ThreadPool* m_Pool;
+        std::size_t m_Msec;
+        bool m_Cancelled = false;
+    };
+
+    ///co_await pool.schedule()之后协程在线程池的线程中继续执行
+    ScheduleAwaiter schedule() noexcept
+    {
+        return ScheduleAwaiter(this);
+    }
+
+    ///co_await pool.sleepFor(msec)挂起协程至少msec毫秒,等待期间不占用任何线程,精度为心跳线程的更新间隔(10毫秒)
+    SleepAwaiter sleepFor(std::size_t msec) noexcept
+    {
+        return SleepAwaiter(this,msec);
+    }
+
+    ///在线程池中启动一个协程任务,返回的TaskFuture在协程结束时就绪
+    template<typename T>
+    TaskFuture<T> spawn(Task<T> task)
+    {
+        auto state = ThreadPoolPrivate::makeFutureState<T>(executor());
+        drive(this,std::move(task),state);
+        return TaskFuture<T>(state);
+    }
+#endif
+
+    ///某一优先级中等待执行(不包括正在执行)的任务数量
+    std::size_t queueDepth(Priority level) const noexcept
+    {
+        std::size_t depth = m_Scheduler.depth(level);
+        for(const ThreadQueue* queue : m_Threads)
+            depth += queue->depth(level);
+        return depth;
+    }
+
+    ///对[begin,end)中的每一个元素执行func(*it),所有元素按grain大小切分成分块后批量提交
+    ///grain为0时根据元素数量和线程数量静态地选择分块大小(见batchGrain()),返回的future在所有分块执行完毕之后就绪,分块中抛出的第一个异常会被保存到future中
+    template<Distribution Mode = Ordered,typename Iterator,typename Func>
+    std::future<void> runBatch(Iterator begin,Iterator end,Func func,std::size_t grain = 0)
+    {
+        const std::size_t count = static_cast<std::size_t>(std::distance(begin,end));
+        grain = batchGrain(count,grain);
+
+        return submitBatch<Mode>(count,grain,[&begin,&func](std::size_t first,std::size_t last){
+            Iterator chunkBegin = begin;
+            std::advance(begin,last - first);
+            Iterator chunkEnd = begin;
+            return [chunkBegin,chunkEnd,func]() mutable {
+                for(Iterator it = chunkBegin; it != chunkEnd; ++it)
+                    func(*it);
+            };
+        });
+    }
+
+    ///对[first,last)中的每一个下标执行func(i),分块方式和返回值与runBatch相同
+    template<Distribution Mode = Ordered,typename Index,typename Func>
+    std::future<void> parallelFor(Index first,Index last,std::size_t grain,Func func)
+    {
+        const std::size_t count = last > first ? static_cast<std::size_t>(last - first) : 0;
+        grain = batchGrain(count,grain);
+
+        return submitBatch<Mode>(count,grain,[first,&func](std::size_t chunkFirst,std::size_t chunkLast){
+            const Index from = first + static_cast<Index>(chunkFirst);
+            const Index to = first + static_cast<Index>(chunkLast);
+            return [from,to,func]() mutable {
+                for(Index i = from; i != to; ++i)
+                    func(i);
+            };
+        });
+    }
+
+    ///设置线程数量的上下限,控制线程只在这个范围内增加或者停止线程,maxThreads不能超过ThreadCapacity
+    ///默认下限为构造函数中的size,上限为ThreadCapacity
+    void setThreadLimits(unsigned minThreads,unsigned maxThreads) noexcept
+    {
+        minThreads = std::max(minThreads,1u);
+        maxThreads = std::min<unsigned>(std::max(maxThreads,minThreads),ThreadCapacity);
+        m_MinThreads.store(minThreads,std::memory_order_relaxed);
+        m_MaxThreads.store(maxThreads,std::memory_order_relaxed);
+        m_ControlCV.notify_one();
+    }
+
+    ///闲置超过msec毫秒的线程会被停止,直到线程数量等于下限,默认为5秒
+    void setKeepAlive(std::size_t msec) noexcept
+    {
+        m_KeepAlive.store(msec,std::memory_order_relaxed);
+    }
+
+    ///所有线程都在执行任务并且有任务在排队的状态持续超过msec毫秒时增加一个线程,为0时(默认)只在线程被占用时增加线程
+    void setLatencyTarget(std::size_t msec) noexcept
+    {
+        m_LatencyTarget.store(msec,std::memory_order_relaxed);
+    }
+
+    ///正在运行的线程数量
+    std::size_t threadCount() const noexcept
+    {
+        return m_ActiveCount.load(std::memory_order_relaxed);
+    }
+
+    ///设置阻塞线程数量的上下限,默认为0和512,没有闲置的阻塞线程并且线程数量没有达到上限时提交阻塞任务会启动一个新的线程
+    void setBlockingLimits(unsigned minThreads,unsigned maxThreads)
+    {
+        m_Blocking.setLimits(minThreads,std::max(minThreads,maxThreads));
+    }
+
+    ///闲置超过msec毫秒的阻塞线程会退出,直到线程数量等于下限,默认为10秒
+    void setBlockingKeepAlive(std::size_t msec)
+    {
+        m_Blocking.setKeepAlive(msec);
+    }
+
+    ///正在运行的阻塞线程数量
+    std::size_t blockingThreadCount() const
+    {
+        return m_Blocking.threadCount();
+    }
+
+    ///设置每一个任务队列的容量以及队列已满时的处理方式,capacity为0(默认)表示不限制
+    ///每一个线程的任务队列和工作窃取模式的全局注入队列都会预先分配存储空间,之后提交任务不会再为队列分配内存
+    ///批量提交的分块、then()注册的后续任务以及协程的恢复不受容量限制
+    void setQueueCapacity(std::size_t capacity,Overflow policy = Block)
+    {
+        std::unique_lock<std::mutex> lock(m_ControlMutex);
+        m_Scheduler.setCapacity(capacity,policy);
+        for(ThreadQueue* thread : m_Threads)
+            thread->reserve(capacity);
+    }
+
+    std::size_t queueCapacity() const noexcept
+    {
+        return m_Scheduler.capacity();
+    }
+
+    OverflowStats overflowStats() const noexcept
+    {
+        OverflowStats stats;
+        stats.blocked = m_Scheduler.overflowCount(ThreadPoolPrivate::BlockOverflow);
+        stats.rejected = m_Scheduler.overflowCount(ThreadPoolPrivate::RejectOverflow);
+        stats.dropped = m_Scheduler.overflowCount(ThreadPoolPrivate::DropOldestOverflow);
+        stats.callerRuns = m_Scheduler.overflowCount(ThreadPoolPrivate::CallerRunsOverflow);
+        return stats;
+    }
+
+    ///所有线程共享一个未完成任务计数器,计数归零时唤醒所有等待者,多个线程可以同时调用
+    void waitforDone()
+    {
+        m_Scheduler.waitForDrain();
+    }
+
+    ///线程在CPU拓扑中的位置
+    struct ThreadPlacement
+    {
+        unsigned node;//线程所属的NUMA节点下标,对应Topology::nodes中的下标
+        unsigned cpu;//分配给线程的CPU编号
+        bool pinned;//线程是否真正被绑定到了cpu上
+    };
+
+    ///线程池检测到的CPU拓扑以及每一个线程的位置
+    struct Topology
+    {
+        std::vector<std::vector<unsigned>> nodes;//每一个NUMA节点中可以使用的CPU编号
+        std::vector<ThreadPlacement> threads;
+        bool affinity;//是否开启了线程绑定
+    };
+
+    ///开启之后每一个线程都被绑定到一个CPU上,线程在NUMA节点之间轮流分配,之后新建的线程也会被绑定;关闭之后线程可以在所有CPU上运行
+    ///线程绑定只在Linux下有效,其他平台上线程只会被分组到一个节点中
+    void setThreadAffinity(bool enable)
+    {
+        std::unique_lock<std::mutex> lock(m_ControlMutex);
+        m_Affinity = enable;
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(thread->active())
+                thread->pin(enable);
+        }
+    }
+
+    ///只包含正在运行的线程
+    Topology topology() const
+    {
+        std::unique_lock<std::mutex> lock(m_ControlMutex);
+        Topology topology;
+        topology.nodes = ThreadPoolPrivate::CpuTopology::system().nodes();
+        topology.affinity = m_Affinity;
+        for(const ThreadQueue* thread : m_Threads)
+        {
+            if(thread->active())
+                topology.threads.push_back(ThreadPlacement{thread->m_Node,thread->m_Cpu,thread->m_Pinned});
+        }
+        return topology;
+    }
+
+    ///把任务提交给node节点上的线程,适用于需要访问某一个节点内存的任务;node是Topology::nodes中的下标
+    ///任务总是进入节点中某一个线程自己的任务队列,所以Stealing模式在这里等同于Balanced模式;节点中没有可用线程时按Mode正常提交
+    template<Distribution Mode = Ordered,Priority Level = Normal,typename Func,typename...Args,typename ReturnType = typename MetaUtility::FunctionTraits<Func>::ReturnType>
+    std::future<ReturnType> runOnNode(unsigned node,Func func,Args&&...args)
+    {
+        std::future<ReturnType> future;
+        ThreadPoolPrivate::TaskWrapper task = makeTask<ReturnType>(future,func,std::forward<Args>(args)...);
+        //线程可能在查找之后被控制线程停止,此时addTask()返回Stopped,重新查找
+        const unsigned policy = m_Scheduler.overflowPolicy();
+        ThreadPoolPrivate::Admission admission = ThreadPoolPrivate::Stopped;
+        ThreadQueue* thread = nodeThread<Mode>(node);
+        while (thread != nullptr && (admission = thread->addTask(std::move(task),Level,policy)) == ThreadPoolPrivate::Stopped)
+            thread = nodeThread<Mode>(node);
+
+        if(admission == ThreadPoolPrivate::Full)
+            overflow(std::move(task),policy);
+        else if(thread == nullptr)
+            dispatch<Mode>(std::move(task),Level);
+        return future;
+    }
+
+#ifdef THREADPOOL_METRICS
+    using LatencyHistogram = ThreadPoolPrivate::LatencyHistogram;
+
+    ///一个线程的统计数据,时间单位为纳秒
+    struct WorkerStats : ThreadPoolPrivate::WorkerMetrics::Snapshot
+    {
+        std::size_t id = 0;
+        unsigned node = 0;
+        bool active = false;//线程是否正在运行,被控制线程停止的线程保留它的统计数据
+    };
+
+    ///线程池统计数据的快照,workers包含线程池创建过的所有线程
+    struct Metrics
+    {
+        std::vector<WorkerStats> workers;
+        std::uint64_t migrations = 0;//控制线程把被占用线程的任务队列转移给其他线程的次数
+        std::size_t pending = 0;//等待执行和正在执行的任务数量
+        LatencyHistogram queueLatency;//所有线程的任务从创建到开始执行的延迟
+        LatencyHistogram runLatency;//所有线程的任务执行时间
+    };
+
+    Metrics metrics() const
+    {
+        std::unique_lock<std::mutex> lock(m_ControlMutex);
+        Metrics metrics;
+        metrics.migrations = m_Migrations.load(std::memory_order_relaxed);
+        metrics.pending = m_Scheduler.pending();
+        for(const ThreadQueue* thread : m_Threads)
+        {
+            WorkerStats stats;
+            static_cast<ThreadPoolPrivate::WorkerMetrics::Snapshot&>(stats) = thread->m_Metrics.snapshot();
+            stats.id = thread->m_Id;
+            stats.node = thread->m_Node;
+            stats.active = thread->active();
+            metrics.queueLatency.merge(stats.queueLatency);
+            metrics.runLatency.merge(stats.runLatency);
+            metrics.workers.push_back(stats);
+        }
+        return metrics;
+    }
+
+    ///开启之后每一个任务的开始时间和执行时长都会被记录下来,每个线程最多记录WorkerMetrics::TraceCapacity个任务
+    void setTracing(bool enable)
+    {
+        std::unique_lock<std::mutex> lock(m_ControlMutex);
+        m_Tracing = enable;
+        for(ThreadQueue* thread : m_Threads)
+            thread->m_Metrics.setTracing(enable);
+    }
+
+    ///以Chrome trace格式(chrome://tracing或者Perfetto)输出并清空已经记录的任务
+    void exportTrace(std::ostream& out)
+    {
+        std::unique_lock<std::mutex> lock(m_ControlMutex);
+        auto micros = [](std::uint64_t nanos){
+            std::string fraction = std::to_string(nanos % 1000);
+            return std::to_string(nanos / 1000) + "." + std::string(3 - fraction.size(),'0') + fraction;
+        };
+        auto write = [&out,&micros](std::size_t id,const std::vector<ThreadPoolPrivate::TraceEvent>& events,bool& first){
+            for(const ThreadPoolPrivate::TraceEvent& event : events)
+            {
+                out<<(first ? "" : ",\n")<<"{\"name\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":"<<id
+                   <<",\"ts\":"<<micros(event.start)<<",\"dur\":"<<micros(event.duration)<<"}";
+                first = false;
+            }
+        };
+
+        bool first = true;
+        out<<"{\"traceEvents\":[\n";
+
+        for(ThreadQueue* thread : m_Threads)
+        {
+            out<<(first ? "" : ",\n")<<"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"<<thread->m_Id
+               <<",\"args\":{\"name\":\"worker "<<thread->m_Id<<" (node "<<thread->m_Node<<")\"}}";
+            first = false;
+            write(thread->m_Id,thread->m_Metrics.takeTrace(),first);
+        }
+        out<<"\n]}\n";
+    }
+#endif
+
+    ///线程池中等待执行和正在执行的任务数量
+    std::size_t pendingTasks() const noexcept
+    {
+        return m_Scheduler.pending();
+    }
+
+private:
+    friend class TaskGraph;
+    friend class TaskGroup;
+
+    ///TaskFuture的后续任务通过这个Executor提交到线程池
+    ThreadPoolPrivate::Executor executor() noexcept
+    {
+        ThreadPoolPrivate::Executor executor;
+        executor.context = this;
+        executor.schedule = [](void* pool,ThreadPoolPrivate::TaskWrapper&& task){
+            static_cast<ThreadPool*>(pool)->submitContinuation(std::move(task));
+        };
+        return executor;
+    }
+
+    ///以工作窃取模式提交一个普通优先级的任务,不检测和调整线程,可以在线程池内部的线程中安全调用
+    void submitContinuation(ThreadPoolPrivate::TaskWrapper&& task)
+    {
+        m_Scheduler.submit(StealingScheduler::allocateTask(std::move(task)),ThreadPoolPrivate::NormalLevel);
+    }
+
+#ifdef THREADPOOL_COROUTINE
+    template<typename T>
+    static ThreadPoolPrivate::DetachedCoroutine drive(ThreadPool* pool,Task<T> task,std::shared_ptr<ThreadPoolPrivate::FutureState<T>> state)
+    {
+        try
+        {
+            co_await pool->schedule();
+            if constexpr (std::is_void<T>::value)
+            {
+                co_await task;
+                state->setValue();
+            }
+            else
+            {
+                state->setValue(co_await task);
+            }
+        }
+        catch (...)
+        {
+            state->setException(std::current_exception());
+        }
+    }
+#endif
+
+    static ThreadPoolPrivate::Executor firstExecutor() noexcept
+    {
+        return ThreadPoolPrivate::Executor();
+    }
+
+    template<typename T,typename...Rest>
+    static ThreadPoolPrivate::Executor firstExecutor(const TaskFuture<T>& future,const Rest&...) noexcept
+    {
+        return future.m_State->executor();
+    }
+
+    ///关联了CancellationToken的任务,执行时如果已经被取消则不调用func,直接把TaskCancelled写入promise
+    ///TaskWrapper通过cancelled()识别这种任务,控制线程据此把它们提前从队列中移除
+    template<typename ReturnType,typename Func>
+    class CancellableTask
+    {
+    public:
+        CancellableTask(const CancellationToken& token,std::promise<ReturnType>&& promise,Func&& func):
+            m_Token(token),m_Promise(std::move(promise)),m_Func(std::move(func)){}
+
+        void operator()()
+        {
+            if(m_Token.cancelled())
+                m_Promise.set_exception(std::make_exception_ptr(TaskCancelled()));
+            else
+                ThreadPoolPrivate::PromiseTask<ReturnType,Func>(std::move(m_Promise),std::move(m_Func))();
+        }
+
+        bool cancelled() const noexcept
+        {
+            return m_Token.cancelled();
+        }
+
+    private:
+        CancellationToken m_Token;
+        std::promise<ReturnType> m_Promise;
+        Func m_Func;
+    };
+
+    ///promise的共享状态从内存池中分配,任务对象内联保存在TaskWrapper中,稳定状态下整个提交过程不产生堆分配
+    template<typename ReturnType,typename Func,typename...Args>
+    ThreadPoolPrivate::TaskWrapper makeTask(std::future<ReturnType>& future,Func func,Args&&...args)
+    {
+        std::promise<ReturnType> promise(std::allocator_arg,ThreadPoolPrivate::TaskAllocator<char>());
+        future = promise.get_future();
+        auto bound = std::bind(func,std::forward<Args>(args)...);
+        return ThreadPoolPrivate::PromiseTask<ReturnType,decltype(bound)>(std::move(promise),std::move(bound));
     }
 
-    void waitforDone()
+    ///自动分块时每个线程大约分到4个分块,既能减少提交次数,又能在分块耗时不均匀时留出负载均衡的余地
+    ///这是只根据元素数量和线程数量计算的静态估计,不会根据分块的实际耗时或者空闲线程的数量再拆分分块,分块耗时差别很大时应该由调用者传入更小的grain
+    std::size_t batchGrain(std::size_t count,std::size_t grain) const noexcept
+    {
+        if(grain == 0)
+            grain = count / (threadCount() * 4);
+        return grain == 0 ? 1 : grain;
+    }
+
+    ///按grain切分[0,count),makeChunk(first,last)返回一个分块需要执行的可调用对象,所有分块共享同一个完成状态
+    template<Distribution Mode,typename MakeChunk>
+    std::future<void> submitBatch(std::size_t count,std::size_t grain,MakeChunk makeChunk)
+    {
+        using Body = decltype(makeChunk(std::size_t(0),std::size_t(0)));
+        using Chunk = ThreadPoolPrivate::BatchChunk<Body>;
+
+        const std::size_t chunkCount = (count + grain - 1) / grain;
+        auto state = std::make_shared<ThreadPoolPrivate::BatchState>(chunkCount == 0 ? 1 : chunkCount);
+        std::future<void> future = state->future();
+        if(chunkCount == 0)
+        {
+            //空范围直接完成
+            state->finishChunk();
+            return future;
+        }
+
+        std::vector<ThreadPoolPrivate::TaskWrapper> chunks;
+        chunks.reserve(chunkCount);
+        for(std::size_t first = 0; first < count; first += grain)
+            chunks.emplace_back(Chunk(state,makeChunk(first,std::min(first + grain,count))));
+
+        dispatchBatch<Mode>(chunks);
+        return future;
+    }
+
+    ///将分块连续地平均分配给所有未被占用的线程,每个线程只加锁一次
+    template<Distribution Mode>
+    typename std::enable_if<Mode != Stealing>::type
+    dispatchBatch(std::vector<ThreadPoolPrivate::TaskWrapper>& chunks)
     {
-        std::vector<ThreadQueue*>::iterator it = m_Threads.begin();
-        while (it != m_Threads.end())
+        std::vector<ThreadQueue*> useable;
+        for(ThreadQueue* queue : m_Threads)
         {
-            std::promise<bool> p;
-            std::future<bool> f = p.get_future();
-            (*it)->wait(std::move(p));
-            f.get();
+            if(queue->active() && !queue->occupied())
+                useable.push_back(queue);
+        }
+        if(useable.empty())
+            useable.push_back(useableThread<Mode>());
 
-            ++it;
+        const std::size_t per = chunks.size() / useable.size();
+        const std::size_t extra = chunks.size() % useable.size();
+        ThreadPoolPrivate::TaskWrapper* first = chunks.data();
+        for(std::size_t i = 0; i < useable.size(); i++)
+        {
+            ThreadPoolPrivate::TaskWrapper* last = first + per + (i < extra ? 1 : 0);
+            if(useable[i] == nullptr || !useable[i]->addTasks(first,last))
+            {
+                //线程在查找之后被停止了,这一部分分块逐个提交,分块同样不受队列容量限制
+                //没有正在运行的线程时分块进入全局注入队列
+                for(ThreadPoolPrivate::TaskWrapper* it = first; it != last; ++it)
+                {
+                    ThreadQueue* thread = stopping() ? nullptr : useableThread<Mode>();
+                    while (thread != nullptr && !thread->addTasks(it,it + 1))
+                        thread = useableThread<Mode>();
+                    if(thread == nullptr)
+                        m_Scheduler.submit(StealingScheduler::allocateTask(std::move(*it)),ThreadPoolPrivate::NormalLevel);
+                }
+            }
+            first = last;
         }
     }
 
-private:
+    template<Distribution Mode>
+    typename std::enable_if<Mode == Stealing>::type
+    dispatchBatch(std::vector<ThreadPoolPrivate::TaskWrapper>& chunks)
+    {
+        std::vector<StealingScheduler::Task*> nodes;
+        nodes.reserve(chunks.size());
+        for(ThreadPoolPrivate::TaskWrapper& chunk : chunks)
+            nodes.push_back(StealingScheduler::allocateTask(std::move(chunk)));
+        m_Scheduler.submitBatch(nodes.data(),nodes.data() + nodes.size());
+    }
+
+    ///提交一个任务,任务被放弃时返回false
+    template<Distribution Mode,typename...TimePoint>
+    typename std::enable_if<Mode != Stealing,bool>::type
+    dispatch(ThreadPoolPrivate::TaskWrapper&& task,unsigned level,TimePoint...deadline)
+    {
+        //线程可能在被选中之后被控制线程停止,此时addTask()返回Stopped,任务没有被移动,重新选择一个线程
+        //线程池正在析构或者所有线程都已经停止时任务进入全局注入队列,还在运行的线程会继续执行它,否则在线程池析构时被丢弃
+        const unsigned policy = m_Scheduler.overflowPolicy();
+        ThreadQueue* thread = stopping() ? nullptr : useableThread<Mode>();
+        while (thread != nullptr)
+        {
+            const ThreadPoolPrivate::Admission admission = thread->addTask(std::move(task),level,policy,deadline...);
+            if(admission == ThreadPoolPrivate::Admitted)
+                return true;
+            if(admission == ThreadPoolPrivate::Full)
+                return overflow(std::move(task),policy);
+            thread = useableThread<Mode>();
+        }
+
+        m_Scheduler.submit(StealingScheduler::allocateTask(std::move(task)),level,deadline...);
+        return true;
+    }
+
+    template<Distribution Mode,typename...TimePoint>
+    typename std::enable_if<Mode == Stealing,bool>::type
+    dispatch(ThreadPoolPrivate::TaskWrapper&& task,unsigned level,TimePoint...deadline)
+    {
+        const unsigned policy = m_Scheduler.overflowPolicy();
+        StealingScheduler::Task* node = StealingScheduler::allocateTask(std::move(task));
+        if(m_Scheduler.offer(node,level,policy,deadline...) == ThreadPoolPrivate::Admitted)
+            return true;
+
+        const bool executed = overflow(std::move(*node),policy);
+        StealingScheduler::releaseTask(node);
+        return executed;
+    }
+
+    ///线程池是否正在析构
+    bool stopping() const noexcept
+    {
+        return m_Stopping.load(std::memory_order_acquire);
+    }
+
+    ///任务队列已满并且没有被Block或者DropOldest处理的任务,CallerRuns在当前线程中执行任务,Reject直接销毁任务
+    bool overflow(ThreadPoolPrivate::TaskWrapper&& task,unsigned policy)
+    {
+        ThreadPoolPrivate::TaskWrapper rejected(std::move(task));
+        if(policy != ThreadPoolPrivate::CallerRunsOverflow)
+            return false;
+
+        rejected();
+        return true;
+    }
+
     template<Distribution Mode>
     typename std::enable_if<Mode == Ordered,ThreadQueue*>::type
     useableThread()
     {
-        //按顺序查找线程,返回一个未被占用的线程
-        //按run函数中的顺序调用可以始终保证线程池中有未被占用的线程,因此不会陷入死循环
-        while (true)
+        //按顺序查找一个正在运行并且未被占用的线程,只读取原子变量,不需要加锁
+        //所有线程都被占用时返回第一个正在运行的线程,控制线程会把它的任务转移给新的线程
+        //游标只用于分散任务,多个提交线程同时读写时偶尔选中同一个线程也没有关系,所以不使用fetch_add()
+        const std::size_t count = m_Threads.size();
+        std::size_t index = m_Cursor.load(std::memory_order_relaxed);
+        ThreadQueue* fallback = nullptr;
+        for(std::size_t i = 0; i < count; i++)
         {
-            if(m_CurrentThread == m_Threads.end() )
-                m_CurrentThread =  m_Threads.begin();
+            if(++index >= count)
+                index = 0;
 
-            if( (*m_CurrentThread)->occupied() )
-                ++m_CurrentThread;
-            else
-                return *m_CurrentThread++;//返回当前线程指针并让这个指针指向下一个位置
+            ThreadQueue* thread = m_Threads[index];
+            if(!thread->active())
+                continue;
+
+            if(!thread->occupied())
+            {
+                m_Cursor.store(index,std::memory_order_relaxed);
+                return thread;
+            }
+
+            if(fallback == nullptr)
+                fallback = thread;
         }
+        m_Cursor.store(index,std::memory_order_relaxed);
+        return fallback;
     }
 
     template<Distribution Mode>
     typename std::enable_if<Mode == Balanced,ThreadQueue*>::type
     useableThread()
     {
-        //按任务数量查找线程,返回一个当前任务数量最少且未被占用的线程
-        //按run函数中的顺序调用可以始终保证线程池中有未被占用的线程,因此不会返回错误指针
-        auto it = std::min_element(m_Threads.cbegin(),m_Threads.cend(),[](ThreadQueue* t1,ThreadQueue* t2){
-            const bool t1_avail = !t1->occupied();
-            const bool t2_avail = !t2->occupied();
+        //按任务数量查找线程,返回一个当前任务数量最少且未被占用的线程,任务数量从原子计数中读取,不需要加锁
+        ThreadQueue* found = nullptr;
+        bool foundAvail = false;
+        std::size_t foundLoad = 0;
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(!thread->active())
+                continue;
 
-            if (t1_avail != t2_avail)
-                return t1_avail;
+            const bool avail = !thread->occupied();
+            const std::size_t load = thread->load();
+            if(found == nullptr || (avail && !foundAvail) || (avail == foundAvail && load < foundLoad))
+            {
+                found = thread;
+                foundAvail = avail;
+                foundLoad = load;
+            }
+        }
+        return found;
+    }
 
-            return t1_avail ? (t1->size() < t2->size()) : false;
-        });
-        return *it;
+    ///在node节点的线程中查找一个正在运行并且未被占用的线程,Ordered模式在节点内轮流选择,其他模式选择任务最少的线程
+    template<Distribution Mode>
+    ThreadQueue* nodeThread(unsigned node)
+    {
+        ThreadQueue* found = nullptr;
+        const std::size_t count = m_Threads.size();
+        const std::size_t start = Mode == Ordered ? m_NodeCursor.fetch_add(1,std::memory_order_relaxed) : 0;
+        for(std::size_t i = 0; i < count; i++)
+        {
+            ThreadQueue* thread = m_Threads[(start + i) % count];
+            if(thread->m_Node != node || !thread->active() || thread->occupied())
+                continue;
+
+            if(Mode == Ordered)
+                return thread;
+
+            if(found == nullptr || thread->load() < found->load())
+                found = thread;
+        }
+        return found;
     }
 
-    void deleteIdleThread()
+    ///控制线程:定期检查被占用的线程,并且根据排队情况和闲置时长增加或者停止线程
+    ///线程数量的调整全部在这里完成,提交任务的线程只访问被选中的线程
+    void control()
     {
-        if(m_Threads.size() > std::thread::hardware_concurrency())
+        std::unique_lock<std::mutex> lock(m_ControlMutex);
+        while (!m_ControlStop)
         {
-            std::vector<ThreadQueue*>::iterator it = m_Threads.begin();
-            while (it != m_Threads.end())
-            {
-                if( (*it)->isIdle() )
-                {
-                    delete (*it);
-                    it = m_Threads.erase(it);
-                }
-                else
-                    ++it;
+            m_ControlCV.wait_for(lock,std::chrono::milliseconds(ControlInterval));
+            if(m_ControlStop)
+                break;
 
-                if(m_Threads.size() <= std::thread::hardware_concurrency())
-                    break;
+            rebalance();
+            ThreadQueue* stopping = resize();
+            purgeCancelled();
+
+            //等待线程结束时不能持有锁,线程中正在执行的任务可能会调用需要这个锁的接口
+            if(stopping != nullptr)
+            {
+                lock.unlock();
+                stopping->join();
+                lock.lock();
+                removeThread(stopping);
             }
         }
     }
 
-    void detectNewIdleThread()
+    ///有CancellationSource被取消之后,把所有被取消的任务从队列中移除,并在控制线程中执行它们
+    ///被取消的任务执行时只会把TaskCancelled写入future,不会调用原来的函数
+    void purgeCancelled()
+    {
+        const std::uint64_t epoch = ThreadPoolPrivate::cancelEpoch().load(std::memory_order_acquire);
+        if(epoch == m_CancelEpoch)
+            return;
+        m_CancelEpoch = epoch;
+
+        std::vector<ThreadPoolPrivate::TaskWrapper> cancelled;
+        for(ThreadQueue* thread : m_Threads)
+            thread->takeCancelled(cancelled);
+
+        std::vector<StealingScheduler::Task*> injected;
+        m_Scheduler.takeCancelled(injected);
+
+        for(ThreadPoolPrivate::TaskWrapper& task : cancelled)
+        {
+            task();
+            m_Scheduler.finishTask();
+        }
+        for(StealingScheduler::Task* task : injected)
+        {
+            (*task)();
+            StealingScheduler::releaseTask(task);
+            m_Scheduler.finishTask();
+        }
+    }
+
+    ///把被占用的线程中等待执行的任务转移给闲置线程,没有闲置线程时启动一个新的线程
+    ///这样处理是为了确保任务不会因为前面长时间执行的任务而被阻塞
+    void rebalance()
+    {
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(!thread->active() || !thread->occupied() || thread->empty())
+                continue;
+
+            ThreadQueue* to = findIdleThread();
+            if(to == nullptr)
+                to = addThread();
+            if(to == nullptr)
+                to = useableThread<Balanced>();
+            if(to == nullptr || to == thread)
+                continue;
+
+            thread->moveTasks(*to);
+#ifdef THREADPOOL_METRICS
+            m_Migrations.fetch_add(1,std::memory_order_relaxed);
+#endif
+        }
+
+        //工作窃取模式的任务不属于某一个线程,无法转移,所有线程都被占用时只能启动一个新的线程来执行它们
+        //这种情况与目标延迟无关,未设置目标延迟时也需要处理
+        if(m_Scheduler.hasWork() && !hasFreeThread())
+            addThread();
+    }
+
+    ///是否存在正在运行并且没有被占用的线程
+    bool hasFreeThread() const
+    {
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(thread->active() && !thread->occupied())
+                return true;
+        }
+        return false;
+    }
+
+    ThreadQueue* resize()
     {
-        //反向迭代,如果有被占用的线程可以将新建的线程添加到容器最后,避免遍历新添加的线程
-        std::vector<ThreadQueue*>::reverse_iterator it = m_Threads.rbegin();
-        while (it != m_Threads.rend())
+        const std::uint64_t now = m_Heartbeat.epoch();
+        const std::size_t minThreads = m_MinThreads.load(std::memory_order_relaxed);
+        const std::size_t maxThreads = m_MaxThreads.load(std::memory_order_relaxed);
+
+        //1.线程数量少于下限时补足
+        while (threadCount() < minThreads && addThread() != nullptr){}
+
+        //2.所有线程都在执行任务并且有任务在排队,这个状态持续超过目标延迟时增加一个线程,然后重新计时
+        const std::size_t latency = m_LatencyTarget.load(std::memory_order_relaxed);
+        if(latency != 0 && saturated())
         {
-            if( (*it)->occupied() && !(*it)->empty() )
+            if(m_SaturatedSince == 0)
+                m_SaturatedSince = now;
+            else if(now - m_SaturatedSince >= latency)
             {
-                ThreadQueue* to = findIdleThread();
-                if(to == nullptr)
-                {
-                    to = new ThreadQueue();
-                    m_Threads.push_back(to);
-                }
+                addThread();
+                m_SaturatedSince = 0;
+            }
+        }
+        else
+        {
+            m_SaturatedSince = 0;
+        }
+
+        //3.停止一个闲置时间超过keepalive的线程,线程数量超过上限时不需要等待keepalive
+        //每次最多停止一个线程,避免负载短暂下降时线程数量剧烈变化
+        //这里只标记线程停止接收任务,返回给control()在锁外等待线程结束
+        if(threadCount() <= minThreads)
+            return nullptr;
 
-                (*it)->moveTasks(*to);
+        const std::size_t keepAlive = m_KeepAlive.load(std::memory_order_relaxed);
+        const bool overLimit = threadCount() > maxThreads;
+        for(std::size_t i = m_Threads.size(); i > 0; i--)
+        {
+            ThreadQueue* thread = m_Threads[i - 1];
+            if(thread->active() && thread->isIdle() && (overLimit || now - thread->lastActive() > keepAlive))
+            {
+                thread->requestStop();
+                m_ActiveCount.fetch_sub(1,std::memory_order_relaxed);
+                return thread;
             }
-            ++it;
         }
+        return nullptr;
     }
 
-    ThreadQueue* findIdleThread()
+    ///所有正在运行的线程都在执行任务,并且还有任务在排队
+    bool saturated() const
     {
-        std::vector<ThreadQueue*>::iterator it = m_Threads.begin();
-        while (it != m_Threads.end())
+        bool queued = m_Scheduler.hasWork();
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(!thread->active())
+                continue;
+            if(!thread->busy())
+                return false;
+            queued = queued || thread->load() > 1;
+        }
+        return queued;
+    }
+
+    ///启动一个线程,优先重新启动线程数量最少的节点上已经停止的线程,否则新建一个线程并分配到这个节点中线程数量最少的CPU上
+    ///线程数量达到上限时返回nullptr,只能在构造函数和控制线程中调用
+    ThreadQueue* addThread()
+    {
+        if(threadCount() >= m_MaxThreads.load(std::memory_order_relaxed))
+            return nullptr;
+
+        const std::vector<std::vector<unsigned>>& nodes = ThreadPoolPrivate::CpuTopology::system().nodes();
+        std::vector<std::size_t> perNode(nodes.size(),0);
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(thread->active())
+                perNode[thread->m_Node]++;
+        }
+        const unsigned node = static_cast<unsigned>(std::min_element(perNode.begin(),perNode.end()) - perNode.begin());
+
+        ThreadQueue* stopped = nullptr;
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(thread->active())
+                continue;
+            if(stopped == nullptr || (thread->m_Node == node && stopped->m_Node != node))
+                stopped = thread;
+        }
+
+        if(stopped != nullptr)
+        {
+            stopped->start();
+            stopped->pin(m_Affinity);
+            m_ActiveCount.fetch_add(1,std::memory_order_relaxed);
+            return stopped;
+        }
+
+        if(m_Threads.size() == m_Threads.capacity())
+            return nullptr;
+
+        std::vector<std::size_t> perCpu(nodes[node].size(),0);
+        for(ThreadQueue* thread : m_Threads)
         {
-            if( (*it)->isIdle() )
-                return (*it);
+            if(thread->m_Node != node)
+                continue;
+            auto it = std::find(nodes[node].begin(),nodes[node].end(),thread->m_Cpu);
+            if(it != nodes[node].end())
+                perCpu[static_cast<std::size_t>(it - nodes[node].begin())]++;
+        }
+        const unsigned cpu = nodes[node][static_cast<std::size_t>(std::min_element(perCpu.begin(),perCpu.end()) - perCpu.begin())];
+
+        ThreadQueue* thread = new ThreadQueue(&m_Scheduler,&m_Heartbeat);
+        thread->reserve(m_Scheduler.capacity());
+        thread->place(node,cpu);
+        thread->pin(m_Affinity);
+#ifdef THREADPOOL_METRICS
+        thread->m_Id = m_Threads.size();
+        thread->m_Metrics.setTracing(m_Tracing);
+#endif
+        m_Threads.push(thread);
+        m_ActiveCount.fetch_add(1,std::memory_order_relaxed);
+        return thread;
+    }
 
-            ++it;
+    ///线程已经被resize()停止并且已经结束,ThreadQueue对象保留到线程池析构,所以提交任务的线程持有的指针一直有效
+    void removeThread(ThreadQueue* thread)
+    {
+        //在线程被停止之前提交的任务转移给其他线程
+        if(!thread->empty())
+        {
+            ThreadQueue* to = findIdleThread();
+            if(to == nullptr)
+                to = useableThread<Balanced>();
+            if(to != nullptr)
+                thread->moveTasks(*to);
         }
+    }
 
+    ThreadQueue* findIdleThread()
+    {
+        for(ThreadQueue* thread : m_Threads)
+        {
+            if(thread->active() && thread->isIdle())
+                return thread;
+        }
         return nullptr;
     }
 
 private:
-    std::vector<ThreadQueue*> m_Threads;
-    std::vector<ThreadQueue*>::iterator m_CurrentThread;
+    enum : std::size_t {ControlInterval = 10};//控制线程的检查间隔,单位为毫秒
+
+    StealingScheduler m_Scheduler;//必须在m_Threads之前声明,保证所有线程析构之后调度器才析构
+    ThreadPoolPrivate::BlockingLane m_Blocking{m_Scheduler.m_Pending};
+    ThreadPoolPrivate::Heartbeat m_Heartbeat;
+    ThreadPoolPrivate::SlotArray<ThreadQueue> m_Threads;//线程只会被停止,不会被移除,只有构造函数和控制线程会添加线程
+    std::atomic<std::size_t> m_ActiveCount{0};
+    std::atomic<std::size_t> m_Cursor{0};//Ordered模式的查找起点
+    std::atomic<std::size_t> m_NodeCursor{0};//runOnNode()在Ordered模式下的查找起点
+
+    std::atomic<std::size_t> m_MinThreads{1};
+    std::atomic<std::size_t> m_MaxThreads{ThreadCapacity};
+    std::atomic<std::size_t> m_KeepAlive{5 * 1000};
+    std::atomic<std::size_t> m_LatencyTarget{0};
+    std::uint64_t m_SaturatedSince = 0;//所有线程开始饱和时的纪元,只由控制线程访问
+    std::uint64_t m_CancelEpoch = 0;//控制线程最后一次移除被取消任务时的取消纪元
+
+    mutable std::mutex m_ControlMutex;//控制线程每次检查时持有,修改线程绑定和读取统计数据时也需要持有
+    std::condition_variable m_ControlCV;
+    bool m_ControlStop = false;
+    bool m_Affinity = false;
+    std::atomic<bool> m_Stopping{false};//析构函数开始执行之后为true
+#ifdef THREADPOOL_METRICS
+    bool m_Tracing = false;
+    std::atomic<std::uint64_t> m_Migrations{0};
+#endif
+    std::thread m_Controller;
+};
+
+/**
+ * @brief The TaskGroup class : 任务组
+ * 通过任务组提交的任务仍然由线程池执行,但是wait()只等待这个任务组中的任务,不需要等待整个线程池空闲
+ * 任务中抛出的第一个异常会在wait()中重新抛出,析构时会等待所有任务完成
+ */
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadPool& pool):m_Pool(pool){}
+
+    ~TaskGroup()
+    {
+        m_Counter.wait();
+    }
+
+    TaskGroup(const TaskGroup&) = delete ;
+
+    TaskGroup& operator = (const TaskGroup&) = delete ;
+
+    ///任务被有界队列拒绝时返回false,被拒绝或者被丢弃的任务会在wait()中抛出broken_promise
+    template<ThreadPool::Distribution Mode = ThreadPool::Ordered,ThreadPool::Priority Level = ThreadPool::Normal,typename Func,typename...Args>
+    bool run(Func func,Args&&...args)
+    {
+        auto bound = std::bind(func,std::forward<Args>(args)...);
+        m_Counter.add(1);
+        return m_Pool.dispatch<Mode>(GroupTask<decltype(bound)>(this,std::move(bound)),Level);
+    }
+
+    ///阻塞直到任务组中的任务全部完成,如果有任务抛出了异常,则重新抛出第一个异常并清除它
+    void wait()
+    {
+        m_Counter.wait();
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(m_ErrorMutex);
+            error.swap(m_Error);
+        }
+        if(error)
+            std::rethrow_exception(error);
+    }
+
+    ///任务组中等待执行和正在执行的任务数量
+    std::size_t pending() const noexcept
+    {
+        return m_Counter.count();
+    }
+
+private:
+    ///执行任务并在结束时减少任务组的计数,任务在执行之前被销毁时同样减少计数,并记录broken_promise
+    template<typename Func>
+    class GroupTask
+    {
+    public:
+        GroupTask(TaskGroup* group,Func&& func):m_Group(group),m_Func(std::move(func)){}
+
+        GroupTask(GroupTask&& other):m_Group(other.m_Group),m_Func(std::move(other.m_Func))
+        {
+            other.m_Group = nullptr;
+        }
+
+        ~GroupTask()
+        {
+            if(m_Group != nullptr)
+                m_Group->finish(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+
+        void operator()()
+        {
+            TaskGroup* group = m_Group;
+            m_Group = nullptr;
+            try
+            {
+                m_Func();
+            }
+            catch (...)
+            {
+                group->finish(std::current_exception());
+                return;
+            }
+            group->finish(nullptr);
+        }
+
+    private:
+        TaskGroup* m_Group;
+        Func m_Func;
+    };
+
+    void finish(std::exception_ptr error)
+    {
+        if(error)
+        {
+            std::unique_lock<std::mutex> lock(m_ErrorMutex);
+            if(!m_Error)
+                m_Error = error;
+        }
+        m_Counter.finish();
+    }
+
+private:
+    ThreadPool& m_Pool;
+    ThreadPoolPrivate::TaskCounter m_Counter;
+    std::mutex m_ErrorMutex;
+    std::exception_ptr m_Error;
+};
+
+/**
+ * @brief The TaskGraph class : 有向无环任务图
+ * 用add()添加节点,用precede()添加依赖关系,run()把整个任务图提交到线程池
+ * 没有前驱的节点立即执行,其他节点在所有前驱执行完毕之后由完成最后一个前驱的线程立即提交,不需要任何线程阻塞等待
+ */
+class TaskGraph
+{
+    struct NodeInfo
+    {
+        std::function<void()> func;
+        std::vector<std::size_t> successors;
+        std::size_t inputs = 0;
+    };
+
+    ///一次执行过程的状态,拷贝了节点信息,因此TaskGraph对象可以在执行过程中被销毁或者再次执行
+    struct Execution
+    {
+        std::vector<NodeInfo> nodes;
+        std::unique_ptr<std::atomic<std::size_t>[]> inputs;
+        std::atomic<std::size_t> unfinished{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::shared_ptr<ThreadPoolPrivate::FutureState<void>> done;
+        ThreadPool* pool = nullptr;
+    };
+
+public:
+    using Node = std::size_t;
+
+    ///添加一个节点,返回节点编号
+    template<typename Func>
+    Node add(Func func)
+    {
+        NodeInfo node;
+        node.func = std::move(func);
+        m_Nodes.push_back(std::move(node));
+        return m_Nodes.size() - 1;
+    }
+
+    ///before执行完毕之后才能执行after
+    void precede(Node before,Node after)
+    {
+        m_Nodes[before].successors.push_back(after);
+        m_Nodes[after].inputs++;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_Nodes.size();
+    }
+
+    ///执行任务图,返回的TaskFuture在所有节点执行完毕之后就绪
+    ///某个节点抛出异常之后还没有开始执行的节点都不再执行,第一个异常会被保存到返回的TaskFuture中;任务图中存在环时直接返回std::logic_error
+    TaskFuture<void> run(ThreadPool& pool) const
+    {
+        auto execution = std::make_shared<Execution>();
+        execution->pool = &pool;
+        execution->done = ThreadPoolPrivate::makeFutureState<void>(pool.executor());
+
+        if(hasCycle())
+        {
+            execution->done->setException(std::make_exception_ptr(std::logic_error("TaskGraph contains a cycle")));
+            return TaskFuture<void>(execution->done);
+        }
+
+        if(m_Nodes.empty())
+        {
+            execution->done->setValue();
+            return TaskFuture<void>(execution->done);
+        }
+
+        execution->nodes = m_Nodes;
+        execution->inputs.reset(new std::atomic<std::size_t>[m_Nodes.size()]);
+        for(std::size_t i = 0; i < m_Nodes.size(); i++)
+            execution->inputs[i].store(m_Nodes[i].inputs,std::memory_order_relaxed);
+        execution->unfinished.store(m_Nodes.size(),std::memory_order_relaxed);
+
+        for(std::size_t i = 0; i < m_Nodes.size(); i++)
+        {
+            if(m_Nodes[i].inputs == 0)
+                schedule(execution,i);
+        }
+        return TaskFuture<void>(execution->done);
+    }
+
+private:
+    static void schedule(const std::shared_ptr<Execution>& execution,std::size_t index)
+    {
+        execution->pool->submitContinuation([execution,index](){
+            execute(execution,index);
+        });
+    }
+
+    static void execute(const std::shared_ptr<Execution>& execution,std::size_t index)
+    {
+        if(!execution->failed.load(std::memory_order_acquire))
+        {
+            try
+            {
+                execution->nodes[index].func();
+            }
+            catch (...)
+            {
+                //只有第一个把failed置为true的线程会写入error
+                if(!execution->failed.exchange(true,std::memory_order_acq_rel))
+                    execution->error = std::current_exception();
+            }
+        }
+
+        for(std::size_t next : execution->nodes[index].successors)
+        {
+            if(execution->inputs[next].fetch_sub(1,std::memory_order_acq_rel) == 1)
+                schedule(execution,next);
+        }
+
+        if(execution->unfinished.fetch_sub(1,std::memory_order_acq_rel) == 1)
+        {
+            if(execution->failed.load(std::memory_order_acquire))
+                execution->done->setException(execution->error);
+            else
+                execution->done->setValue();
+        }
+    }
+
+    ///按拓扑排序检查是否存在环
+    bool hasCycle() const
+    {
+        std::vector<std::size_t> inputs(m_Nodes.size());
+        std::vector<std::size_t> ready;
+        for(std::size_t i = 0; i < m_Nodes.size(); i++)
+        {
+            inputs[i] = m_Nodes[i].inputs;
+            if(inputs[i] == 0)
+                ready.push_back(i);
+        }
+
+        std::size_t visited = 0;
+        while (!ready.empty())
+        {
+            std::size_t node = ready.back();
+            ready.pop_back();
+            visited++;
+            for(std::size_t next : m_Nodes[node].successors)
+            {
+                if(--inputs[next] == 0)
+                    ready.push_back(next);
+            }
+        }
+        return visited != m_Nodes.size();
+    }
+
+private:
+    std::vector<NodeInfo> m_Nodes;
 };
 
 #endif // THREADPOOL_H
@@ -0,0 +1,2008 @@
+#ifndef THREADPOOLPRIVATE_HPP
+#define THREADPOOLPRIVATE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define THREADPOOL_COROUTINE 1
+#endif
+
+namespace ThreadPoolPrivate
+{
+    ///任务优先级,数值越小优先级越高
+    enum PriorityLevel : unsigned {HighLevel = 0,NormalLevel = 1,BackgroundLevel = 2,LevelCount = 3};
+
+    ///有界队列已满时的处理方式
+    enum OverflowPolicy : unsigned {BlockOverflow = 0,RejectOverflow = 1,DropOldestOverflow = 2,CallerRunsOverflow = 3,OverflowCount = 4};
+
+    ///向有界队列添加任务的结果,Stopped和Full时任务没有被移动
+    enum Admission : unsigned {Admitted,Stopped,Full};
+
+    class SpinLock
+    {
+    public:
+        void lock() noexcept
+        {
+            while (m_Flag.test_and_set(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+
+        void unlock() noexcept
+        {
+            m_Flag.clear(std::memory_order_release);
+        }
+
+    private:
+        std::atomic_flag m_Flag = ATOMIC_FLAG_INIT;
+    };
+
+    /**
+     * @brief The TaskBlockPool class : 固定大小内存块的线程安全空闲链表
+     * 被释放的内存块不会归还给系统,而是挂到空闲链表上等待下一次分配,因此在稳定状态下分配和释放都不会调用::operator new
+     * 每一种块大小只有一个全局实例,实例本身故意不析构,避免程序退出时静态对象析构顺序导致的悬空访问
+     */
+    template<std::size_t Size>
+    class TaskBlockPool
+    {
+        struct Node
+        {
+            Node* next;
+        };
+
+        static_assert(Size >= sizeof(Node),"block size is too small");
+
+    public:
+        static TaskBlockPool& instance()
+        {
+            static TaskBlockPool* pool = new TaskBlockPool();
+            return *pool;
+        }
+
+        void* allocate()
+        {
+            m_Lock.lock();
+            Node* node = m_Free;
+            if(node != nullptr)
+                m_Free = node->next;
+            m_Lock.unlock();
+
+            return node != nullptr ? node : ::operator new(Size);
+        }
+
+        void deallocate(void* ptr) noexcept
+        {
+            Node* node = static_cast<Node*>(ptr);
+            m_Lock.lock();
+            node->next = m_Free;
+            m_Free = node;
+            m_Lock.unlock();
+        }
+
+    private:
+        TaskBlockPool() = default;
+
+    private:
+        SpinLock m_Lock;
+        Node* m_Free = nullptr;
+    };
+
+    /**
+     * @brief The TaskAllocator class : 从TaskBlockPool中分配单个对象的分配器
+     * 用于std::promise的共享状态和工作窃取模式的任务节点,大小按16字节向上取整,相近大小的类型共用同一个TaskBlockPool
+     */
+    template<typename T>
+    class TaskAllocator
+    {
+        ///块大小只在分配和释放时计算,std::promise会把分配器rebind到void,此时不能对T求sizeof
+        static constexpr std::size_t blockSize() noexcept
+        {
+            return (sizeof(T) + 15) / 16 * 16;
+        }
+
+    public:
+        using value_type = T;
+
+        TaskAllocator() noexcept = default;
+
+        template<typename U>
+        TaskAllocator(const TaskAllocator<U>&) noexcept {}
+
+        T* allocate(std::size_t n)
+        {
+            if(n == 1 && alignof(T) <= alignof(std::max_align_t))
+                return static_cast<T*>(TaskBlockPool<blockSize()>::instance().allocate());
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T* ptr,std::size_t n) noexcept
+        {
+            if(n == 1 && alignof(T) <= alignof(std::max_align_t))
+                TaskBlockPool<blockSize()>::instance().deallocate(ptr);
+            else
+                ::operator delete(ptr);
+        }
+
+        template<typename U>
+        bool operator == (const TaskAllocator<U>&) const noexcept {return true;}
+
+        template<typename U>
+        bool operator != (const TaskAllocator<U>&) const noexcept {return false;}
+    };
+
+#ifdef THREADPOOL_METRICS
+    ///统计和追踪使用的单调时钟,单位为纳秒
+    inline std::uint64_t metricsNow() noexcept
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    /**
+     * @brief The LatencyHistogram struct : 以2为底的对数直方图
+     * 第i个桶统计[2^i,2^(i+1))纳秒的样本,第0个桶同时统计0纳秒的样本
+     */
+    struct LatencyHistogram
+    {
+        enum : std::size_t {BucketCount = 64};
+
+        std::uint64_t buckets[BucketCount] = {};
+
+        static std::size_t bucket(std::uint64_t nanos) noexcept
+        {
+            std::size_t index = 0;
+            while (nanos >>= 1)
+                index++;
+            return index;
+        }
+
+        std::uint64_t count() const noexcept
+        {
+            std::uint64_t total = 0;
+            for(std::uint64_t value : buckets)
+                total += value;
+            return total;
+        }
+
+        ///返回第p(0~1)分位的样本所在的桶的上界,单位为纳秒,没有样本时返回0
+        std::uint64_t percentile(double p) const noexcept
+        {
+            const std::uint64_t total = count();
+            if(total == 0)
+                return 0;
+
+            const std::uint64_t rank = static_cast<std::uint64_t>(p * static_cast<double>(total - 1));
+            std::uint64_t seen = 0;
+            for(std::size_t i = 0; i < BucketCount; i++)
+            {
+                seen += buckets[i];
+                if(seen > rank)
+                    return i + 1 < BucketCount ? (std::uint64_t(1) << (i + 1)) : ~std::uint64_t(0);
+            }
+            return ~std::uint64_t(0);
+        }
+
+        void merge(const LatencyHistogram& other) noexcept
+        {
+            for(std::size_t i = 0; i < BucketCount; i++)
+                buckets[i] += other.buckets[i];
+        }
+    };
+
+    ///一个任务在追踪中的记录,时间单位为纳秒
+    struct TraceEvent
+    {
+        std::uint64_t start;
+        std::uint64_t duration;
+    };
+
+    /**
+     * @brief The WorkerMetrics class : 一个工作线程的统计数据
+     * 大部分计数只由工作线程自己写入,使用relaxed原子操作,读取快照时不需要加锁;追踪记录在开启追踪时才会写入
+     */
+    class WorkerMetrics
+    {
+    public:
+        enum : std::size_t {TraceCapacity = 1 << 20};//每一个线程最多保存的追踪记录数量
+
+        struct Snapshot
+        {
+            std::uint64_t executed = 0;//执行的任务数量
+            std::uint64_t highWater = 0;//任务队列长度的最大值
+            std::uint64_t busyNanos = 0;//执行任务的累计时间
+            std::uint64_t steals = 0;//从其他线程窃取的任务数量
+            std::uint64_t migratedIn = 0;//从被占用的线程转移过来的任务数量
+            std::uint64_t migratedOut = 0;//因为线程被占用而转移出去的任务数量
+            LatencyHistogram queueLatency;//任务从创建到开始执行的延迟
+            LatencyHistogram runLatency;//任务的执行时间
+        };
+
+        void enqueued(std::size_t depth) noexcept
+        {
+            std::uint64_t current = m_HighWater.load(std::memory_order_relaxed);
+            while (depth > current && !m_HighWater.compare_exchange_weak(current,depth,std::memory_order_relaxed)){}
+        }
+
+        void stole() noexcept
+        {
+            m_Steals.fetch_add(1,std::memory_order_relaxed);
+        }
+
+        void migrated(WorkerMetrics& to,std::size_t count) noexcept
+        {
+            m_MigratedOut.fetch_add(count,std::memory_order_relaxed);
+            to.m_MigratedIn.fetch_add(count,std::memory_order_relaxed);
+        }
+
+        ///记录一个从stamp时刻创建、从start时刻开始执行、刚刚执行完毕的任务
+        void finished(std::uint64_t stamp,std::uint64_t start) noexcept
+        {
+            const std::uint64_t end = metricsNow();
+            const std::uint64_t duration = end - start;
+            m_Executed.fetch_add(1,std::memory_order_relaxed);
+            m_BusyNanos.fetch_add(duration,std::memory_order_relaxed);
+            m_RunLatency[LatencyHistogram::bucket(duration)].fetch_add(1,std::memory_order_relaxed);
+            if(stamp != 0 && stamp <= start)
+                m_QueueLatency[LatencyHistogram::bucket(start - stamp)].fetch_add(1,std::memory_order_relaxed);
+
+            if(m_Tracing.load(std::memory_order_relaxed))
+            {
+                std::unique_lock<SpinLock> lock(m_TraceLock);
+                if(m_Trace.size() < TraceCapacity)
+                    m_Trace.push_back(TraceEvent{start,duration});
+            }
+        }
+
+        void setTracing(bool enable) noexcept
+        {
+            m_Tracing.store(enable,std::memory_order_relaxed);
+        }
+
+        Snapshot snapshot() const noexcept
+        {
+            Snapshot snapshot;
+            snapshot.executed = m_Executed.load(std::memory_order_relaxed);
+            snapshot.highWater = m_HighWater.load(std::memory_order_relaxed);
+            snapshot.busyNanos = m_BusyNanos.load(std::memory_order_relaxed);
+            snapshot.steals = m_Steals.load(std::memory_order_relaxed);
+            snapshot.migratedIn = m_MigratedIn.load(std::memory_order_relaxed);
+            snapshot.migratedOut = m_MigratedOut.load(std::memory_order_relaxed);
+            for(std::size_t i = 0; i < LatencyHistogram::BucketCount; i++)
+            {
+                snapshot.queueLatency.buckets[i] = m_QueueLatency[i].load(std::memory_order_relaxed);
+                snapshot.runLatency.buckets[i] = m_RunLatency[i].load(std::memory_order_relaxed);
+            }
+            return snapshot;
+        }
+
+        ///取出并清空追踪记录
+        std::vector<TraceEvent> takeTrace()
+        {
+            std::vector<TraceEvent> events;
+            std::unique_lock<SpinLock> lock(m_TraceLock);
+            events.swap(m_Trace);
+            return events;
+        }
+
+    private:
+        std::atomic<std::uint64_t> m_Executed{0};
+        std::atomic<std::uint64_t> m_HighWater{0};
+        std::atomic<std::uint64_t> m_BusyNanos{0};
+        std::atomic<std::uint64_t> m_Steals{0};
+        std::atomic<std::uint64_t> m_MigratedIn{0};
+        std::atomic<std::uint64_t> m_MigratedOut{0};
+        std::atomic<std::uint64_t> m_QueueLatency[LatencyHistogram::BucketCount] = {};
+        std::atomic<std::uint64_t> m_RunLatency[LatencyHistogram::BucketCount] = {};
+        std::atomic<bool> m_Tracing{false};
+        SpinLock m_TraceLock;
+        std::vector<TraceEvent> m_Trace;
+    };
+#endif
+
+    /**
+     * @brief The TaskWrapper class : 只能移动的void()可调用对象包装器
+     * 不超过InlineSize字节且移动构造不抛异常的可调用对象直接保存在对象内部的缓冲区中,不会产生堆分配,更大的可调用对象才会分配到堆上
+     */
+    class TaskWrapper
+    {
+        enum : std::size_t {InlineSize = 64};
+
+        struct Operations
+        {
+            void (*invoke)(void*);
+            void (*move)(void* from,void* to) noexcept;
+            void (*destroy)(void*) noexcept;
+            bool (*cancelled)(const void*) noexcept;
+        };
+
+        ///可调用对象提供cancelled()成员函数时,任务可以在执行之前被提前从队列中移除
+        template<typename F>
+        static auto isCancelled(const F& func,int) noexcept -> decltype(bool(func.cancelled()))
+        {
+            return func.cancelled();
+        }
+
+        template<typename F>
+        static bool isCancelled(const F&,long) noexcept
+        {
+            return false;
+        }
+
+        template<typename F>
+        struct InlineOperations
+        {
+            static void invoke(void* buf) {(*static_cast<F*>(buf))();}
+
+            static void move(void* from,void* to) noexcept
+            {
+                ::new (to) F(std::move(*static_cast<F*>(from)));
+                static_cast<F*>(from)->~F();
+            }
+
+            static void destroy(void* buf) noexcept {static_cast<F*>(buf)->~F();}
+
+            static bool cancelled(const void* buf) noexcept {return isCancelled(*static_cast<const F*>(buf),0);}
+
+            static const Operations table;
+        };
+
+        template<typename F>
+        struct HeapOperations
+        {
+            static F*& pointer(void* buf) noexcept {return *static_cast<F**>(buf);}
+
+            static void invoke(void* buf) {(*pointer(buf))();}
+
+            static void move(void* from,void* to) noexcept
+            {
+                ::new (to) F*(pointer(from));
+            }
+
+            static void destroy(void* buf) noexcept {delete pointer(buf);}
+
+            static bool cancelled(const void* buf) noexcept {return isCancelled(**static_cast<F* const*>(buf),0);}
+
+            static const Operations table;
+        };
+
+        template<typename F>
+        using IsInline = std::integral_constant<bool,sizeof(F) <= InlineSize
+                                                     && alignof(std::max_align_t) % alignof(F) == 0
+                                                     && std::is_nothrow_move_constructible<F>::value>;
+
+    public:
+        TaskWrapper() noexcept = default;
+
+        template<typename Func,typename F = typename std::decay<Func>::type,
+                 typename = typename std::enable_if<!std::is_same<F,TaskWrapper>::value>::type>
+        TaskWrapper(Func&& func)
+        {
+            construct<F>(std::forward<Func>(func),IsInline<F>());
+#ifdef THREADPOOL_METRICS
+            m_Stamp = metricsNow();
+#endif
+        }
+
+        TaskWrapper(TaskWrapper&& other) noexcept
+        {
+            moveFrom(other);
+        }
+
+        TaskWrapper& operator = (TaskWrapper&& other) noexcept
+        {
+            if(this != &other)
+            {
+                reset();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        TaskWrapper(const TaskWrapper&) = delete ;
+
+        TaskWrapper& operator = (const TaskWrapper&) = delete ;
+
+        ~TaskWrapper()
+        {
+            reset();
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_Ops != nullptr;
+        }
+
+        void operator()()
+        {
+            m_Ops->invoke(m_Buffer);
+        }
+
+        ///任务是否已经被取消,被取消的任务执行时不会调用原来的函数
+        bool cancelled() const noexcept
+        {
+            return m_Ops != nullptr && m_Ops->cancelled(m_Buffer);
+        }
+
+        void reset() noexcept
+        {
+            if(m_Ops != nullptr)
+            {
+                m_Ops->destroy(m_Buffer);
+                m_Ops = nullptr;
+            }
+        }
+
+#ifdef THREADPOOL_METRICS
+        ///任务被创建的时刻,用于统计任务从提交到开始执行的延迟
+        std::uint64_t stamp() const noexcept
+        {
+            return m_Stamp;
+        }
+#endif
+
+    private:
+        template<typename F,typename Func>
+        void construct(Func&& func,std::true_type)
+        {
+            ::new (static_cast<void*>(m_Buffer)) F(std::forward<Func>(func));
+            m_Ops = &InlineOperations<F>::table;
+        }
+
+        template<typename F,typename Func>
+        void construct(Func&& func,std::false_type)
+        {
+            ::new (static_cast<void*>(m_Buffer)) F*(new F(std::forward<Func>(func)));
+            m_Ops = &HeapOperations<F>::table;
+        }
+
+        void moveFrom(TaskWrapper& other) noexcept
+        {
+            if(other.m_Ops != nullptr)
+            {
+                other.m_Ops->move(other.m_Buffer,m_Buffer);
+                m_Ops = other.m_Ops;
+                other.m_Ops = nullptr;
+            }
+#ifdef THREADPOOL_METRICS
+            m_Stamp = other.m_Stamp;
+#endif
+        }
+
+    private:
+        alignas(std::max_align_t) unsigned char m_Buffer[InlineSize];
+        const Operations* m_Ops = nullptr;
+#ifdef THREADPOOL_METRICS
+        std::uint64_t m_Stamp = 0;
+#endif
+    };
+
+    template<typename F>
+    const TaskWrapper::Operations TaskWrapper::InlineOperations<F>::table = {&invoke,&move,&destroy,&cancelled};
+
+    template<typename F>
+    const TaskWrapper::Operations TaskWrapper::HeapOperations<F>::table = {&invoke,&move,&destroy,&cancelled};
+
+    /**
+     * @brief The PromiseTask class : 执行函数并将返回值或者异常写入promise
+     * 用来代替std::packaged_task,promise的共享状态由TaskAllocator分配,所以整个任务可以内联保存在TaskWrapper中
+     */
+    template<typename ReturnType,typename Func>
+    class PromiseTask
+    {
+    public:
+        PromiseTask(std::promise<ReturnType>&& promise,Func&& func):
+            m_Promise(std::move(promise)),m_Func(std::move(func)){}
+
+        void operator()()
+        {
+            try
+            {
+                m_Promise.set_value(m_Func());
+            }
+            catch (...)
+            {
+                m_Promise.set_exception(std::current_exception());
+            }
+        }
+
+    private:
+        std::promise<ReturnType> m_Promise;
+        Func m_Func;
+    };
+
+    template<typename Func>
+    class PromiseTask<void,Func>
+    {
+    public:
+        PromiseTask(std::promise<void>&& promise,Func&& func):
+            m_Promise(std::move(promise)),m_Func(std::move(func)){}
+
+        void operator()()
+        {
+            try
+            {
+                m_Func();
+                m_Promise.set_value();
+            }
+            catch (...)
+            {
+                m_Promise.set_exception(std::current_exception());
+            }
+        }
+
+    private:
+        std::promise<void> m_Promise;
+        Func m_Func;
+    };
+
+    /**
+     * @brief The Executor class : TaskFuture用于提交后续任务的调度回调
+     * 由线程池提供,context指向线程池,没有设置schedule时直接在当前线程中执行任务
+     */
+    struct Executor
+    {
+        void* context = nullptr;
+        void (*schedule)(void*,TaskWrapper&&) = nullptr;
+
+        void operator()(TaskWrapper&& task) const
+        {
+            if(schedule != nullptr)
+                schedule(context,std::move(task));
+            else
+                task();
+        }
+    };
+
+    ///保存TaskFuture的结果,void类型没有结果
+    template<typename T>
+    class FutureValue
+    {
+    public:
+        using Reference = const T&;
+
+        FutureValue() = default;
+
+        FutureValue(const FutureValue&) = delete ;
+
+        FutureValue& operator = (const FutureValue&) = delete ;
+
+        ~FutureValue()
+        {
+            if(m_Valid)
+                reinterpret_cast<T*>(m_Buffer)->~T();
+        }
+
+        template<typename...Args>
+        void emplace(Args&&...args)
+        {
+            ::new (static_cast<void*>(m_Buffer)) T(std::forward<Args>(args)...);
+            m_Valid = true;
+        }
+
+        Reference get() const noexcept
+        {
+            return *reinterpret_cast<const T*>(m_Buffer);
+        }
+
+        T& get() noexcept
+        {
+            return *reinterpret_cast<T*>(m_Buffer);
+        }
+
+    private:
+        alignas(T) unsigned char m_Buffer[sizeof(T)];
+        bool m_Valid = false;
+    };
+
+    template<>
+    class FutureValue<void>
+    {
+    public:
+        using Reference = void;
+
+        void emplace() noexcept {}
+
+        void get() const noexcept {}
+    };
+
+    /**
+     * @brief The FutureState class : TaskFuture的共享状态
+     * 任务完成时在完成任务的线程中依次调用所有通过onReady()注册的回调,回调一般只负责把真正的后续任务提交给Executor
+     */
+    template<typename T>
+    class FutureState
+    {
+    public:
+        using Reference = typename FutureValue<T>::Reference;
+
+        explicit FutureState(Executor executor = Executor()):m_Executor(executor){}
+
+        FutureState(const FutureState&) = delete ;
+
+        FutureState& operator = (const FutureState&) = delete ;
+
+        template<typename...Args>
+        void setValue(Args&&...args)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Value.emplace(std::forward<Args>(args)...);
+            complete(lock);
+        }
+
+        void setException(std::exception_ptr error)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_Error = error;
+            complete(lock);
+        }
+
+        bool ready() const
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            return m_Ready;
+        }
+
+        void wait() const
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_CV.wait(lock,[this](){return m_Ready;});
+        }
+
+        ///阻塞直到任务完成,任务抛出的异常会在这里重新抛出
+        Reference get() const
+        {
+            wait();
+            if(m_Error)
+                std::rethrow_exception(m_Error);
+            return m_Value.get();
+        }
+
+        ///只能在任务完成之后调用
+        std::exception_ptr error() const noexcept
+        {
+            return m_Error;
+        }
+
+        const Executor& executor() const noexcept
+        {
+            return m_Executor;
+        }
+
+        ///注册一个完成回调,如果任务已经完成则立即在当前线程中调用
+        void onReady(TaskWrapper&& callback)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if(!m_Ready)
+            {
+                m_Callbacks.push_back(std::move(callback));
+                return;
+            }
+            lock.unlock();
+            callback();
+        }
+
+    private:
+        void complete(std::unique_lock<std::mutex>& lock)
+        {
+            m_Ready = true;
+            std::vector<TaskWrapper> callbacks;
+            callbacks.swap(m_Callbacks);
+            lock.unlock();
+
+            m_CV.notify_all();
+            for(TaskWrapper& callback : callbacks)
+                callback();
+        }
+
+    private:
+        mutable std::mutex m_Mutex;
+        mutable std::condition_variable m_CV;
+        bool m_Ready = false;
+        FutureValue<T> m_Value;
+        std::exception_ptr m_Error;
+        std::vector<TaskWrapper> m_Callbacks;
+        const Executor m_Executor;
+    };
+
+    ///执行func并把返回值或者异常写入state
+    template<typename T,typename Func>
+    typename std::enable_if<!std::is_void<T>::value>::type
+    fulfil(FutureState<T>& state,Func& func)
+    {
+        try
+        {
+            state.setValue(func());
+        }
+        catch (...)
+        {
+            state.setException(std::current_exception());
+        }
+    }
+
+    template<typename T,typename Func>
+    typename std::enable_if<std::is_void<T>::value>::type
+    fulfil(FutureState<T>& state,Func& func)
+    {
+        try
+        {
+            func();
+        }
+        catch (...)
+        {
+            state.setException(std::current_exception());
+            return;
+        }
+        state.setValue();
+    }
+
+    ///共享状态从TaskAllocator中分配,和控制块一起只占用一次内存
+    template<typename T>
+    std::shared_ptr<FutureState<T>> makeFutureState(Executor executor)
+    {
+        return std::allocate_shared<FutureState<T>>(TaskAllocator<FutureState<T>>(),executor);
+    }
+
+    ///每次有CancellationSource被取消时递增,控制线程发现它变化之后才扫描任务队列移除被取消的任务
+    inline std::atomic<std::uint64_t>& cancelEpoch() noexcept
+    {
+        static std::atomic<std::uint64_t> epoch{0};
+        return epoch;
+    }
+
+    ///CancellationSource和它的所有CancellationToken共享的取消标记
+    struct CancelState
+    {
+        std::atomic<bool> cancelled{false};
+    };
+
+    /**
+     * @brief The StateTask class : 执行函数并将结果写入FutureState
+     * 任务在执行之前被销毁时(例如被有界队列丢弃或者线程池析构)FutureState会得到broken_promise,等待结果的线程不会永远阻塞
+     */
+    template<typename T,typename Func>
+    class StateTask
+    {
+    public:
+        StateTask(const std::shared_ptr<FutureState<T>>& state,Func&& func):
+            m_State(state),m_Func(std::move(func)){}
+
+        StateTask(StateTask&&) = default;
+
+        ~StateTask()
+        {
+            if(m_State != nullptr)
+                m_State->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+
+        void operator()()
+        {
+            fulfil(*m_State,m_Func);
+            m_State.reset();
+        }
+
+    private:
+        std::shared_ptr<FutureState<T>> m_State;
+        Func m_Func;
+    };
+
+#ifdef THREADPOOL_COROUTINE
+    /**
+     * @brief The TaskPromiseBase class : 协程Task的promise公共部分
+     * 协程在创建时挂起,直到被co_await时才开始执行;执行结束时直接对称转移到等待它的协程,不经过任何线程调度
+     */
+    class TaskPromiseBase
+    {
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept {return false;}
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().m_Continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+    public:
+        std::suspend_always initial_suspend() const noexcept {return {};}
+
+        FinalAwaiter final_suspend() const noexcept {return {};}
+
+        void unhandled_exception() noexcept
+        {
+            m_Error = std::current_exception();
+        }
+
+        void setContinuation(std::coroutine_handle<> continuation) noexcept
+        {
+            m_Continuation = continuation;
+        }
+
+    protected:
+        void rethrow() const
+        {
+            if(m_Error)
+                std::rethrow_exception(m_Error);
+        }
+
+    private:
+        std::coroutine_handle<> m_Continuation;
+        std::exception_ptr m_Error;
+    };
+
+    template<typename T>
+    class TaskPromise : public TaskPromiseBase
+    {
+    public:
+        template<typename U>
+        void return_value(U&& value)
+        {
+            m_Value.emplace(std::forward<U>(value));
+        }
+
+        ///协程的返回值只能被取出一次
+        T take()
+        {
+            rethrow();
+            return std::move(m_Value.get());
+        }
+
+    private:
+        FutureValue<T> m_Value;
+    };
+
+    template<>
+    class TaskPromise<void> : public TaskPromiseBase
+    {
+    public:
+        void return_void() const noexcept {}
+
+        void take() const
+        {
+            rethrow();
+        }
+    };
+
+    ///立即开始执行并在结束时自行销毁的协程,用于把Task的结果转交给TaskFuture
+    struct DetachedCoroutine
+    {
+        struct promise_type
+        {
+            DetachedCoroutine get_return_object() const noexcept {return {};}
+
+            std::suspend_never initial_suspend() const noexcept {return {};}
+
+            std::suspend_never final_suspend() const noexcept {return {};}
+
+            void return_void() const noexcept {}
+
+            void unhandled_exception() const noexcept {std::terminate();}
+        };
+    };
+
+    /**
+     * @brief The ResumeTask class : 在线程池中恢复一个挂起的协程的任务
+     * 线程池析构时被丢弃的ResumeTask在销毁时同样会恢复协程,并把cancelled设置为true,由等待体在await_resume()中抛出std::future_error(broken_promise)
+     * 这样挂起的协程不会泄漏,而是沿着调用链结束,spawn()返回的TaskFuture得到这个异常
+     */
+    class ResumeTask
+    {
+    public:
+        explicit ResumeTask(std::coroutine_handle<> handle,bool* cancelled = nullptr) noexcept:
+            m_Handle(handle),m_Cancelled(cancelled){}
+
+        ResumeTask(ResumeTask&& other) noexcept:
+            m_Handle(std::exchange(other.m_Handle,nullptr)),m_Cancelled(other.m_Cancelled){}
+
+        ResumeTask(const ResumeTask&) = delete ;
+
+        ResumeTask& operator = (const ResumeTask&) = delete ;
+
+        ~ResumeTask()
+        {
+            if(!m_Handle)
+                return;
+            if(m_Cancelled != nullptr)
+                *m_Cancelled = true;
+            m_Handle.resume();
+        }
+
+        void operator()()
+        {
+            std::exchange(m_Handle,nullptr).resume();
+        }
+
+    private:
+        std::coroutine_handle<> m_Handle;
+        bool* m_Cancelled;
+    };
+#endif
+
+    /**
+     * @brief The BatchState class : 批量任务的聚合完成状态
+     * 每一个分块执行完毕之后计数减一,最后一个分块负责设置promise,分块中第一个被抛出的异常会被保存到future中
+     */
+    class BatchState
+    {
+    public:
+        explicit BatchState(std::size_t chunks):m_Remaining(chunks){}
+
+        std::future<void> future()
+        {
+            return m_Promise.get_future();
+        }
+
+        void fail(std::exception_ptr error) noexcept
+        {
+            if(!m_Failed.exchange(true,std::memory_order_acq_rel))
+                m_Error = error;
+        }
+
+        void finishChunk()
+        {
+            if(m_Remaining.fetch_sub(1,std::memory_order_acq_rel) != 1)
+                return;
+
+            if(m_Failed.load(std::memory_order_acquire))
+                m_Promise.set_exception(m_Error);
+            else
+                m_Promise.set_value();
+        }
+
+    private:
+        std::atomic<std::size_t> m_Remaining;
+        std::atomic<bool> m_Failed{false};
+        std::exception_ptr m_Error;
+        std::promise<void> m_Promise;
+    };
+
+    ///批量任务中的一个分块
+    template<typename Body>
+    class BatchChunk
+    {
+    public:
+        BatchChunk(const std::shared_ptr<BatchState>& state,Body&& body):
+            m_State(state),m_Body(std::move(body)){}
+
+        void operator()()
+        {
+            try
+            {
+                m_Body();
+            }
+            catch (...)
+            {
+                m_State->fail(std::current_exception());
+            }
+            m_State->finishChunk();
+        }
+
+    private:
+        std::shared_ptr<BatchState> m_State;
+        Body m_Body;
+    };
+
+    /**
+     * @brief The RingQueue class : 基于环形缓冲区的先进先出队列
+     * 容量不足时按2倍扩容且从不收缩,队列长度稳定之后入队和出队都不会再分配内存
+     */
+    template<typename T>
+    class RingQueue
+    {
+    public:
+        RingQueue() = default;
+
+        RingQueue(const RingQueue&) = delete ;
+
+        RingQueue& operator = (const RingQueue&) = delete ;
+
+        RingQueue(RingQueue&& other) noexcept
+        {
+            swap(other);
+        }
+
+        ///交换缓冲区,被移动的队列会得到当前队列的缓冲区,这样两个队列的缓冲区都可以继续复用
+        RingQueue& operator = (RingQueue&& other) noexcept
+        {
+            clear();
+            swap(other);
+            return *this;
+        }
+
+        ~RingQueue()
+        {
+            clear();
+            ::operator delete(m_Buffer);
+        }
+
+        bool empty() const noexcept {return m_Size == 0;}
+
+        std::size_t size() const noexcept {return m_Size;}
+
+        std::size_t capacity() const noexcept {return m_Capacity;}
+
+        T& front() noexcept {return m_Buffer[m_Head];}
+
+        ///预先分配至少能容纳capacity个元素的缓冲区
+        void reserve(std::size_t capacity)
+        {
+            if(capacity > m_Capacity)
+                reallocate(capacity);
+        }
+
+        void push(T&& value)
+        {
+            if(m_Size == m_Capacity)
+                reallocate(m_Capacity == 0 ? 16 : m_Capacity * 2);
+
+            ::new (static_cast<void*>(m_Buffer + (m_Head + m_Size) % m_Capacity)) T(std::move(value));
+            ++m_Size;
+        }
+
+        void pop() noexcept
+        {
+            m_Buffer[m_Head].~T();
+            m_Head = (m_Head + 1) % m_Capacity;
+            --m_Size;
+        }
+
+        void clear() noexcept
+        {
+            while (!empty())
+                pop();
+        }
+
+        void swap(RingQueue& other) noexcept
+        {
+            std::swap(m_Buffer,other.m_Buffer);
+            std::swap(m_Capacity,other.m_Capacity);
+            std::swap(m_Head,other.m_Head);
+            std::swap(m_Size,other.m_Size);
+        }
+
+    private:
+        void reallocate(std::size_t capacity)
+        {
+            T* buffer = static_cast<T*>(::operator new(capacity * sizeof(T)));
+            for(std::size_t i = 0; i < m_Size; i++)
+            {
+                T& item = m_Buffer[(m_Head + i) % m_Capacity];
+                ::new (static_cast<void*>(buffer + i)) T(std::move(item));
+                item.~T();
+            }
+
+            ::operator delete(m_Buffer);
+            m_Buffer = buffer;
+            m_Capacity = capacity;
+            m_Head = 0;
+        }
+
+    private:
+        T* m_Buffer = nullptr;
+        std::size_t m_Capacity = 0;
+        std::size_t m_Head = 0;
+        std::size_t m_Size = 0;
+    };
+
+    /**
+     * @brief The TimerWheel class : 单层哈希时间轮
+     * 定时器按到期刻度放入对应的槽中,推进时间轮时只检查经过的槽,到期刻度超过一圈的定时器会留在槽中等待下一圈
+     */
+    class TimerWheel
+    {
+        enum : std::uint64_t {SlotCount = 256};
+
+        struct Timer
+        {
+            std::uint64_t expire;
+            TaskWrapper task;
+        };
+
+    public:
+        ///添加一个在expire刻度到期的定时器,已经过去的刻度会被推迟到下一个刻度
+        ///clear()之后添加的定时器直接在锁外被销毁
+        void add(std::uint64_t expire,TaskWrapper&& task)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if(m_Closed)
+            {
+                lock.unlock();
+                task.reset();
+                return;
+            }
+            expire = std::max(expire,m_Current + 1);
+            m_Slots[expire % SlotCount].push_back(Timer{expire,std::move(task)});
+            m_Count++;
+        }
+
+        ///推进到now刻度,并在持有锁的情况下执行所有到期的定时器,所以定时器回调中不能再调用add()
+        void advance(std::uint64_t now)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if(now <= m_Current)
+                return;
+
+            std::uint64_t steps = std::min<std::uint64_t>(now - m_Current,SlotCount);
+            for(std::uint64_t i = 1; i <= steps && m_Count != 0; i++)
+            {
+                std::vector<Timer>& slot = m_Slots[(m_Current + i) % SlotCount];
+                for(std::size_t j = 0; j < slot.size();)
+                {
+                    if(slot[j].expire > now)
+                    {
+                        j++;
+                        continue;
+                    }
+
+                    TaskWrapper task = std::move(slot[j].task);
+                    if(j != slot.size() - 1)
+                        slot[j] = std::move(slot.back());
+                    slot.pop_back();
+                    m_Count--;
+                    task();
+                }
+            }
+            m_Current = now;
+        }
+
+        ///丢弃所有未到期的定时器,之后不再接受新的定时器,返回时没有正在执行的定时器回调
+        ///销毁回调时可能恢复挂起的协程,协程又可能添加定时器,所以回调在锁外销毁
+        void clear()
+        {
+            std::vector<Timer> dropped;
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Closed = true;
+                for(std::vector<Timer>& slot : m_Slots)
+                {
+                    std::move(slot.begin(),slot.end(),std::back_inserter(dropped));
+                    slot.clear();
+                }
+                m_Count = 0;
+            }
+        }
+
+    private:
+        std::mutex m_Mutex;
+        bool m_Closed = false;
+        std::vector<Timer> m_Slots[SlotCount];
+        std::uint64_t m_Current = 0;
+        std::size_t m_Count = 0;
+    };
+
+    /**
+     * @brief The CpuTopology class : CPU和NUMA节点拓扑
+     * Linux下从sysfs读取每个NUMA节点的CPU列表,并且只保留当前进程允许使用的CPU(例如被taskset或者容器限制时)
+     * 其他平台或者读取失败时认为只有一个节点,节点中包含hardware_concurrency()个CPU
+     */
+    class CpuTopology
+    {
+    public:
+        ///进程启动之后只检测一次
+        static const CpuTopology& system()
+        {
+            static const CpuTopology topology = detect();
+            return topology;
+        }
+
+        ///每一个NUMA节点中可以使用的CPU编号,不包含没有CPU的节点
+        const std::vector<std::vector<unsigned>>& nodes() const noexcept
+        {
+            return m_Nodes;
+        }
+
+        std::size_t cpuCount() const noexcept
+        {
+            std::size_t count = 0;
+            for(const std::vector<unsigned>& node : m_Nodes)
+                count += node.size();
+            return count;
+        }
+
+    private:
+        static CpuTopology detect()
+        {
+            CpuTopology topology;
+#if defined(__linux__)
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            const bool restricted = sched_getaffinity(0,sizeof(allowed),&allowed) == 0;
+
+            for(unsigned node : parseList(readLine("/sys/devices/system/node/online")))
+            {
+                std::vector<unsigned> cpus;
+                for(unsigned cpu : parseList(readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")))
+                {
+                    if(!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu,&allowed)))
+                        cpus.push_back(cpu);
+                }
+                if(!cpus.empty())
+                    topology.m_Nodes.push_back(std::move(cpus));
+            }
+#endif
+            if(topology.m_Nodes.empty())
+            {
+                std::vector<unsigned> cpus(std::max(1u,std::thread::hardware_concurrency()));
+                for(unsigned i = 0; i < cpus.size(); i++)
+                    cpus[i] = i;
+                topology.m_Nodes.push_back(std::move(cpus));
+            }
+            return topology;
+        }
+
+        static std::string readLine(const std::string& path)
+        {
+            std::ifstream file(path);
+            std::string line;
+            std::getline(file,line);
+            return line;
+        }
+
+        ///解析sysfs中的列表格式,例如"0-3,8-11"
+        static std::vector<unsigned> parseList(const std::string& text)
+        {
+            std::vector<unsigned> values;
+            std::size_t pos = 0;
+            while (pos < text.size())
+            {
+                std::size_t end = text.find(',',pos);
+                if(end == std::string::npos)
+                    end = text.size();
+
+                const std::string range = text.substr(pos,end - pos);
+                const std::size_t dash = range.find('-');
+                try
+                {
+                    const unsigned first = static_cast<unsigned>(std::stoul(range.substr(0,dash)));
+                    const unsigned last = dash == std::string::npos ? first : static_cast<unsigned>(std::stoul(range.substr(dash + 1)));
+                    for(unsigned value = first; value <= last; value++)
+                        values.push_back(value);
+                }
+                catch (...)
+                {
+                    return std::vector<unsigned>();
+                }
+                pos = end + 1;
+            }
+            return values;
+        }
+
+    private:
+        std::vector<std::vector<unsigned>> m_Nodes;
+    };
+
+    ///把线程绑定到cpus中的CPU上,只在Linux下有效,其他平台总是返回false
+    inline bool setThreadAffinity(std::thread& thread,const std::vector<unsigned>& cpus)
+    {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(unsigned cpu : cpus)
+        {
+            if(cpu < CPU_SETSIZE)
+                CPU_SET(cpu,&set);
+        }
+        return CPU_COUNT(&set) != 0 && pthread_setaffinity_np(thread.native_handle(),sizeof(set),&set) == 0;
+#else
+        (void)thread;
+        (void)cpus;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief The SlotArray class : 只增不减的定长指针数组
+     * 只有一个写入者调用push(),读取者不需要加锁就可以遍历已经发布的元素;元素在数组析构之前不会被移除,所以读到的指针一直有效
+     */
+    template<typename T>
+    class SlotArray
+    {
+    public:
+        explicit SlotArray(std::size_t capacity):m_Slots(new T*[capacity]),m_Capacity(capacity){}
+
+        SlotArray(const SlotArray&) = delete ;
+
+        SlotArray& operator = (const SlotArray&) = delete ;
+
+        ///先写入元素再发布数量,读取者读到数量之后一定能看到对应的元素
+        bool push(T* value) noexcept
+        {
+            const std::size_t size = m_Size.load(std::memory_order_relaxed);
+            if(size == m_Capacity)
+                return false;
+
+            m_Slots[size] = value;
+            m_Size.store(size + 1,std::memory_order_release);
+            return true;
+        }
+
+        std::size_t size() const noexcept
+        {
+            return m_Size.load(std::memory_order_acquire);
+        }
+
+        std::size_t capacity() const noexcept
+        {
+            return m_Capacity;
+        }
+
+        T* operator[](std::size_t index) const noexcept
+        {
+            return m_Slots[index];
+        }
+
+        T* const* begin() const noexcept
+        {
+            return m_Slots.get();
+        }
+
+        T* const* end() const noexcept
+        {
+            return m_Slots.get() + size();
+        }
+
+    private:
+        std::unique_ptr<T*[]> m_Slots;
+        const std::size_t m_Capacity;
+        std::atomic<std::size_t> m_Size{0};
+    };
+
+    /**
+     * @brief The TaskCounter class : 未完成任务计数器
+     * 提交任务之前调用add(),任务执行完毕之后调用finish(),wait()阻塞直到计数归零
+     * 计数不为0时add()和finish()都只是一次原子操作,只有计数归零的那一次finish()需要加锁唤醒等待者
+     * 最后一次减计数和唤醒都在锁中完成,wait()也总是加锁,所以wait()返回之后计数器可以立即被销毁
+     */
+    class TaskCounter
+    {
+    public:
+        TaskCounter() = default;
+
+        TaskCounter(const TaskCounter&) = delete ;
+
+        TaskCounter& operator = (const TaskCounter&) = delete ;
+
+        void add(std::size_t count = 1) noexcept
+        {
+            m_Count.fetch_add(count,std::memory_order_acq_rel);
+        }
+
+        void finish()
+        {
+            std::size_t count = m_Count.load(std::memory_order_acquire);
+            while (count > 1)
+            {
+                if(m_Count.compare_exchange_weak(count,count - 1,std::memory_order_acq_rel,std::memory_order_acquire))
+                    return;
+            }
+
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if(m_Count.fetch_sub(1,std::memory_order_acq_rel) == 1)
+                m_CV.notify_all();
+        }
+
+        std::size_t count() const noexcept
+        {
+            return m_Count.load(std::memory_order_acquire);
+        }
+
+        ///即使计数已经归零也要加锁,保证最后一个finish()已经离开临界区
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_CV.wait(lock,[this](){return m_Count.load(std::memory_order_acquire) == 0;});
+        }
+
+    private:
+        std::atomic<std::size_t> m_Count{0};
+        std::mutex m_Mutex;
+        std::condition_variable m_CV;
+    };
+
+    /**
+     * @brief The Heartbeat class : 线程池的心跳监视器
+     * 监视线程按固定间隔使用steady_clock更新纪元计数(线程池启动后经过的毫秒数+1),工作线程开始执行任务时把当前纪元写入自己的原子变量
+     * 因此提交任务时判断线程是否被占用只需要读取原子变量,不需要读取系统时钟
+     */
+    class Heartbeat
+    {
+    public:
+        explicit Heartbeat(std::size_t interval = 10):
+            m_Interval(interval),m_Begin(std::chrono::steady_clock::now())
+        {
+            m_Thread = std::thread(&Heartbeat::run,this);
+        }
+
+        ~Heartbeat()
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Stop = true;
+            }
+            m_CV.notify_one();
+
+            if(m_Thread.joinable())
+                m_Thread.join();
+        }
+
+        Heartbeat(const Heartbeat&) = delete ;
+
+        Heartbeat& operator = (const Heartbeat&) = delete ;
+
+        ///当前纪元,精度为监视线程的更新间隔,纪元永远不为0,所以0可以用来表示线程闲置
+        std::uint64_t epoch() const noexcept
+        {
+            return m_Epoch.load(std::memory_order_relaxed);
+        }
+
+        ///任务执行时长超过这个阈值(毫秒)的线程被认为已被占用
+        std::uint64_t threshold() const noexcept
+        {
+            return m_Threshold.load(std::memory_order_relaxed);
+        }
+
+        void setThreshold(std::uint64_t msec) noexcept
+        {
+            m_Threshold.store(msec,std::memory_order_relaxed);
+        }
+
+        ///判断一个从since纪元开始执行的任务是否已经超时,since为0表示线程闲置
+        bool expired(std::uint64_t since) const noexcept
+        {
+            return since != 0 && epoch() - since > threshold();
+        }
+
+        ///msec毫秒之后在监视线程中执行task,精度为监视线程的更新间隔,task只应该把真正的工作提交给其他线程
+        void after(std::size_t msec,TaskWrapper&& task)
+        {
+            //elapsed()按毫秒截断,多等待1毫秒保证实际等待时间不少于msec
+            std::uint64_t expire = elapsed() + msec + 1;
+            m_Timers.add((expire + m_Interval - 1) / m_Interval,std::move(task));
+        }
+
+        ///丢弃所有未到期的定时器,之后添加的定时器也会被直接丢弃
+        void clearTimers()
+        {
+            m_Timers.clear();
+        }
+
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while (!m_Stop)
+            {
+                m_CV.wait_for(lock,std::chrono::milliseconds(m_Interval));
+                std::uint64_t now = elapsed();
+                m_Epoch.store(now + 1,std::memory_order_relaxed);
+
+                lock.unlock();
+                m_Timers.advance(now / m_Interval);
+                lock.lock();
+            }
+        }
+
+        std::uint64_t elapsed() const
+        {
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_Begin);
+            return static_cast<std::uint64_t>(duration.count());
+        }
+
+    private:
+        std::atomic<std::uint64_t> m_Epoch{1};
+        std::atomic<std::uint64_t> m_Threshold{10 * 1000};
+        const std::size_t m_Interval;
+        const std::chrono::steady_clock::time_point m_Begin;
+        std::mutex m_Mutex;
+        std::condition_variable m_CV;
+        bool m_Stop = false;
+        TimerWheel m_Timers;
+        std::thread m_Thread;
+    };
+
+    /**
+     * @brief The BlockingLane class : 执行阻塞任务(文件、串口等I/O)的弹性线程组
+     * 阻塞任务和计算线程分开执行,不会占用计算线程,也不会因为执行时间长而被当作被占用的线程触发任务转移
+     * 提交任务时如果没有闲置线程并且线程数量没有达到上限就启动一个新的线程,闲置超过keepalive并且超过下限的线程自动退出
+     */
+    class BlockingLane
+    {
+        using ThreadList = std::list<std::thread>;
+
+    public:
+        explicit BlockingLane(TaskCounter& pending):m_Pending(pending){}
+
+        ~BlockingLane()
+        {
+            stop();
+        }
+
+        BlockingLane(const BlockingLane&) = delete ;
+
+        BlockingLane& operator = (const BlockingLane&) = delete ;
+
+        ///添加一个任务,已经停止时任务直接被销毁,对应的future得到broken_promise
+        void submit(TaskWrapper&& task)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            if(m_Stop)
+                return;
+
+            m_Pending.add(1);
+            m_Tasks.push(std::move(task));
+
+            //闲置线程足够执行所有排队的任务时只唤醒一个线程,否则启动新的线程
+            if(m_Tasks.size() <= m_Idle || m_Count >= m_MaxThreads)
+            {
+                m_CV.notify_one();
+                return;
+            }
+
+            reap();
+            m_Threads.emplace_back();
+            ThreadList::iterator self = std::prev(m_Threads.end());
+            *self = std::thread(&BlockingLane::run,this,self);
+            m_Count++;
+        }
+
+        ///线程数量上下限,下限以内的线程闲置时不会退出
+        void setLimits(std::size_t minThreads,std::size_t maxThreads)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_MinThreads = minThreads;
+            m_MaxThreads = std::max<std::size_t>(maxThreads,1);
+            m_CV.notify_all();
+        }
+
+        void setKeepAlive(std::size_t msec)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            m_KeepAlive = msec;
+        }
+
+        std::size_t threadCount() const
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            return m_Count;
+        }
+
+        ///正在执行的任务执行完之后所有线程退出,还没有开始执行的任务被丢弃
+        void stop()
+        {
+            ThreadList threads;
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Stop = true;
+                threads.swap(m_Threads);
+                m_Exited.clear();
+            }
+            m_CV.notify_all();
+
+            for(std::thread& thread : threads)
+                thread.join();
+
+            std::size_t discarded = 0;
+            {
+                RingQueue<TaskWrapper> tasks;
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                tasks.swap(m_Tasks);
+                discarded = tasks.size();
+                lock.unlock();
+            }
+            for(; discarded > 0; discarded--)
+                m_Pending.finish();
+        }
+
+    private:
+        void run(ThreadList::iterator self)
+        {
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while (!m_Stop)
+            {
+                if(!m_Tasks.empty())
+                {
+                    TaskWrapper task = std::move(m_Tasks.front());
+                    m_Tasks.pop();
+                    lock.unlock();
+
+                    task();
+                    task.reset();
+                    m_Pending.finish();
+
+                    lock.lock();
+                    continue;
+                }
+
+                m_Idle++;
+                const bool woken = m_CV.wait_for(lock,std::chrono::milliseconds(m_KeepAlive),[this](){
+                    return !m_Tasks.empty() || m_Stop;
+                });
+                m_Idle--;
+
+                if((!woken && m_Count > m_MinThreads) || m_Count > m_MaxThreads)
+                    break;
+            }
+
+            //停止时由stop()负责join,否则把自己登记为已退出,由下一次启动线程时join
+            m_Count--;
+            if(!m_Stop)
+                m_Exited.push_back(self);
+        }
+
+        ///join已经退出的线程并把它们从线程列表中移除
+        void reap()
+        {
+            for(ThreadList::iterator it : m_Exited)
+            {
+                it->join();
+                m_Threads.erase(it);
+            }
+            m_Exited.clear();
+        }
+
+    private:
+        TaskCounter& m_Pending;
+        mutable std::mutex m_Mutex;
+        std::condition_variable m_CV;
+        RingQueue<TaskWrapper> m_Tasks;
+        ThreadList m_Threads;
+        std::vector<ThreadList::iterator> m_Exited;//已经退出但还没有被join的线程
+        std::size_t m_Count = 0;//正在运行的线程数量
+        std::size_t m_Idle = 0;//正在等待任务的线程数量
+        std::size_t m_MinThreads = 0;
+        std::size_t m_MaxThreads = 512;
+        std::size_t m_KeepAlive = 10 * 1000;
+        bool m_Stop = false;
+    };
+
+    /**
+     * @brief The WorkStealingDeque class : Chase-Lev无锁双端队列
+     * 只有持有这个队列的线程可以调用push()和pop(),在队列底部压入和弹出元素,其他线程只能调用steal()从队列顶部窃取元素
+     * T必须是可以被原子读写的类型(通常是指针),队列满时容量会翻倍,旧的缓冲区会保留到队列析构,因为窃取者可能仍在读取旧的缓冲区
+     */
+    template<typename T>
+    class WorkStealingDeque
+    {
+        static_assert(std::is_trivially_copyable<T>::value,"WorkStealingDeque only supports trivially copyable elements");
+
+        struct Array
+        {
+            explicit Array(std::int64_t cap):capacity(cap),mask(cap - 1),buffer(new std::atomic<T>[cap]){}
+
+            T get(std::int64_t index) const noexcept
+            {
+                return buffer[index & mask].load(std::memory_order_relaxed);
+            }
+
+            void put(std::int64_t index,T value) noexcept
+            {
+                buffer[index & mask].store(value,std::memory_order_relaxed);
+            }
+
+            ///将[top,bottom)之间的元素拷贝到一个容量翻倍的新缓冲区中
+            Array* grow(std::int64_t bottom,std::int64_t top) const
+            {
+                Array* array = new Array(capacity * 2);
+                for(std::int64_t i = top; i != bottom; ++i)
+                    array->put(i,get(i));
+                return array;
+            }
+
+            const std::int64_t capacity;
+            const std::int64_t mask;
+            std::unique_ptr<std::atomic<T>[]> buffer;
+        };
+
+    public:
+        ///capacity必须是2的N次幂
+        explicit WorkStealingDeque(std::int64_t capacity = 256)
+        {
+            Array* array = new Array(capacity);
+            m_Garbage.emplace_back(array);
+            m_Array.store(array,std::memory_order_relaxed);
+        }
+
+        WorkStealingDeque(const WorkStealingDeque&) = delete ;
+
+        WorkStealingDeque& operator = (const WorkStealingDeque&) = delete ;
+
+        bool empty() const noexcept
+        {
+            std::int64_t b = m_Bottom.load(std::memory_order_relaxed);
+            std::int64_t t = m_Top.load(std::memory_order_relaxed);
+            return b <= t;
+        }
+
+        std::size_t size() const noexcept
+        {
+            std::int64_t b = m_Bottom.load(std::memory_order_relaxed);
+            std::int64_t t = m_Top.load(std::memory_order_relaxed);
+            return b > t ? static_cast<std::size_t>(b - t) : 0;
+        }
+
+        ///只能由持有队列的线程调用
+        void push(T value)
+        {
+            std::int64_t b = m_Bottom.load(std::memory_order_relaxed);
+            std::int64_t t = m_Top.load(std::memory_order_acquire);
+            Array* array = m_Array.load(std::memory_order_relaxed);
+
+            if(b - t > array->capacity - 1)
+            {
+                array = array->grow(b,t);
+                m_Garbage.emplace_back(array);
+                m_Array.store(array,std::memory_order_release);
+            }
+
+            array->put(b,value);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_Bottom.store(b + 1,std::memory_order_relaxed);
+        }
+
+        ///只能由持有队列的线程调用,从队列底部弹出最后压入的元素
+        bool pop(T& value)
+        {
+            std::int64_t b = m_Bottom.load(std::memory_order_relaxed) - 1;
+            Array* array = m_Array.load(std::memory_order_relaxed);
+            m_Bottom.store(b,std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t t = m_Top.load(std::memory_order_relaxed);
+
+            if(t > b)
+            {
+                //队列为空
+                m_Bottom.store(b + 1,std::memory_order_relaxed);
+                return false;
+            }
+
+            value = array->get(b);
+            if(t == b)
+            {
+                //队列中只剩最后一个元素,需要和窃取者竞争
+                bool won = m_Top.compare_exchange_strong(t,t + 1,std::memory_order_seq_cst,std::memory_order_relaxed);
+                m_Bottom.store(b + 1,std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        ///可以由任意线程调用,从队列顶部窃取最早压入的元素
+        bool steal(T& value)
+        {
+            std::int64_t t = m_Top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t b = m_Bottom.load(std::memory_order_acquire);
+
+            if(t >= b)
+                return false;
+
+            Array* array = m_Array.load(std::memory_order_acquire);
+            value = array->get(t);
+            return m_Top.compare_exchange_strong(t,t + 1,std::memory_order_seq_cst,std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<std::int64_t> m_Top{0};
+        std::atomic<std::int64_t> m_Bottom{0};
+        std::atomic<Array*> m_Array{nullptr};
+        std::vector<std::unique_ptr<Array>> m_Garbage;//只由持有队列的线程修改
+    };
+
+    /**
+     * @brief The PriorityTaskQueue class : 按优先级分层的任务队列
+     * 每一个优先级都有一个先进先出的环形队列和一个按截止时间排序的最小堆
+     * 出队时按优先级从高到低查找,同一优先级中带截止时间的任务按截止时间最早优先(EDF)执行,然后才执行不带截止时间的任务
+     */
+    template<typename T>
+    class PriorityTaskQueue
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        bool empty() const noexcept {return m_Size == 0;}
+
+        std::size_t size() const noexcept {return m_Size;}
+
+        std::size_t size(unsigned level) const noexcept
+        {
+            return m_Fifo[level].size() + m_Deadline[level].size();
+        }
+
+        void push(T&& task,unsigned level)
+        {
+            m_Fifo[level].push(std::move(task));
+            ++m_Size;
+        }
+
+        void push(T&& task,unsigned level,Clock::time_point deadline)
+        {
+            std::vector<Item>& heap = m_Deadline[level];
+            heap.push_back(Item{deadline,m_Sequence++,std::move(task)});
+            std::push_heap(heap.begin(),heap.end(),Later());
+            ++m_Size;
+        }
+
+        ///按优先级从高到低取出一个任务
+        bool pop(T& task)
+        {
+            for(unsigned level = 0; level < LevelCount; level++)
+            {
+                if(pop(task,level))
+                    return true;
+            }
+            return false;
+        }
+
+        ///从指定的优先级中取出一个任务
+        bool pop(T& task,unsigned level)
+        {
+            std::vector<Item>& heap = m_Deadline[level];
+            if(!heap.empty())
+            {
+                std::pop_heap(heap.begin(),heap.end(),Later());
+                task = std::move(heap.back().task);
+                heap.pop_back();
+                --m_Size;
+                return true;
+            }
+
+            RingQueue<T>& fifo = m_Fifo[level];
+            if(!fifo.empty())
+            {
+                task = std::move(fifo.front());
+                fifo.pop();
+                --m_Size;
+                return true;
+            }
+            return false;
+        }
+
+        ///每一个优先级都预先分配capacity个任务的存储空间,任务总数不超过capacity时不会再分配内存
+        void reserve(std::size_t capacity)
+        {
+            for(unsigned level = 0; level < LevelCount; level++)
+            {
+                m_Fifo[level].reserve(capacity);
+                m_Deadline[level].reserve(capacity);
+            }
+        }
+
+        ///从最低的非空优先级中取出最早提交的任务,这个优先级中只有带截止时间的任务时取出截止时间最晚的任务
+        bool dropOldest(T& task,unsigned& level)
+        {
+            for(unsigned i = LevelCount; i > 0; i--)
+            {
+                level = i - 1;
+                RingQueue<T>& fifo = m_Fifo[level];
+                if(!fifo.empty())
+                {
+                    task = std::move(fifo.front());
+                    fifo.pop();
+                    --m_Size;
+                    return true;
+                }
+
+                std::vector<Item>& heap = m_Deadline[level];
+                if(!heap.empty())
+                {
+                    auto latest = std::min_element(heap.begin(),heap.end(),Later());
+                    std::iter_swap(latest,heap.end() - 1);
+                    task = std::move(heap.back().task);
+                    heap.pop_back();
+                    std::make_heap(heap.begin(),heap.end(),Later());
+                    --m_Size;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        ///移除所有满足pred的任务,被移除的任务和它的优先级依次传给out,返回移除的数量
+        ///剩余任务的顺序不变,环形缓冲区和堆的容量不变,所以不会分配内存
+        template<typename Pred,typename Out>
+        std::size_t removeIf(Pred pred,Out out)
+        {
+            std::size_t removed = 0;
+            for(unsigned level = 0; level < LevelCount; level++)
+            {
+                RingQueue<T>& fifo = m_Fifo[level];
+                for(std::size_t i = fifo.size(); i > 0; i--)
+                {
+                    T task = std::move(fifo.front());
+                    fifo.pop();
+                    if(pred(task))
+                    {
+                        out(std::move(task),level);
+                        removed++;
+                    }
+                    else
+                    {
+                        fifo.push(std::move(task));
+                    }
+                }
+
+                std::vector<Item>& heap = m_Deadline[level];
+                auto last = std::partition(heap.begin(),heap.end(),[&pred](Item& item){return !pred(item.task);});
+                if(last != heap.end())
+                {
+                    for(auto it = last; it != heap.end(); ++it)
+                    {
+                        out(std::move(it->task),level);
+                        removed++;
+                    }
+                    heap.erase(last,heap.end());
+                    std::make_heap(heap.begin(),heap.end(),Later());
+                }
+            }
+            m_Size -= removed;
+            return removed;
+        }
+
+        ///将所有任务按原有的优先级和截止时间转移到other中
+        void moveTo(PriorityTaskQueue& other)
+        {
+            for(unsigned level = 0; level < LevelCount; level++)
+            {
+                for(Item& item : m_Deadline[level])
+                    other.push(std::move(item.task),level,item.deadline);
+                m_Deadline[level].clear();
+
+                while (!m_Fifo[level].empty())
+                {
+                    other.push(std::move(m_Fifo[level].front()),level);
+                    m_Fifo[level].pop();
+                }
+            }
+            m_Size = 0;
+        }
+
+    private:
+        struct Item
+        {
+            Clock::time_point deadline;
+            std::uint64_t sequence;//截止时间相同时按提交顺序执行
+            T task;
+        };
+
+        struct Later
+        {
+            bool operator()(const Item& a,const Item& b) const noexcept
+            {
+                return a.deadline != b.deadline ? a.deadline > b.deadline : a.sequence > b.sequence;
+            }
+        };
+
+    private:
+        RingQueue<T> m_Fifo[LevelCount];
+        std::vector<Item> m_Deadline[LevelCount];
+        std::size_t m_Size = 0;
+        std::uint64_t m_Sequence = 0;
+    };
+}
+
+#endif // THREADPOOLPRIVATE_HPP
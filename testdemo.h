@@ -9,6 +9,25 @@
 #else
 #include "StringConvertorQ.hpp"
 #endif
+#include "ThreadPool.hpp"
+#include "MemoryPool.hpp"
+#include "MemoryPoolAny.h"
+#include "MemoryResource.hpp"
+#include "PageProvider.hpp"
+#include "SharedArray.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <new>
+#include <system_error>
 
 using namespace MetaUtility;
 
@@ -164,4 +183,1999 @@ void Test_StringConvertorQ()
 }
 #endif
 
+///以指定模式向线程池提交count个任务,返回每秒执行的任务数量
+template<ThreadPool::Distribution Mode>
+double Bench_ThreadPoolThroughput(void(*task)(),std::size_t count)
+{
+    ThreadPool pool;
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < count; i++)
+        pool.run<Mode>(task);
+    pool.waitforDone();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return count / elapsed.count();
+}
+
+///分别比较Ordered、Balanced、Stealing模式执行100万个空任务和100万个约1微秒任务时的吞吐量
+void Bench_ThreadPool()
+{
+    const std::size_t count = 1000000;
+    void(*emptyTask)() = [](){};
+    void(*microTask)() = [](){
+        auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(1);
+        while (std::chrono::steady_clock::now() < end){}
+    };
+
+    std::cout<<"empty task   Ordered:"<<Bench_ThreadPoolThroughput<ThreadPool::Ordered>(emptyTask,count)
+             <<"/s Balanced:"<<Bench_ThreadPoolThroughput<ThreadPool::Balanced>(emptyTask,count)
+             <<"/s Stealing:"<<Bench_ThreadPoolThroughput<ThreadPool::Stealing>(emptyTask,count)<<"/s"<<std::endl;
+
+    std::cout<<"1us task     Ordered:"<<Bench_ThreadPoolThroughput<ThreadPool::Ordered>(microTask,count)
+             <<"/s Balanced:"<<Bench_ThreadPoolThroughput<ThreadPool::Balanced>(microTask,count)
+             <<"/s Stealing:"<<Bench_ThreadPoolThroughput<ThreadPool::Stealing>(microTask,count)<<"/s"<<std::endl;
+}
+
+///比较逐个调用run()、runBatch()以及parallelFor()提交100万个同类任务的耗时
+void Bench_ThreadPoolBatch()
+{
+    const std::size_t count = 1000000;
+    std::vector<int> data(count,1);
+    std::atomic<long long> sum{0};
+    auto elapsed = [](std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    ThreadPool pool;
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < count; i++)
+        pool.run([&sum,&data,i](){sum += data[i];});
+    pool.waitforDone();
+    std::cout<<"run() x N:"<<elapsed(start)<<"ms ";
+
+    start = std::chrono::steady_clock::now();
+    pool.runBatch(data.begin(),data.end(),[&sum](int value){sum += value;}).get();
+    std::cout<<"runBatch:"<<elapsed(start)<<"ms ";
+
+    start = std::chrono::steady_clock::now();
+    pool.parallelFor<ThreadPool::Stealing>(std::size_t(0),count,0,[&sum,&data](std::size_t i){sum += data[i];}).get();
+    std::cout<<"parallelFor<Stealing>:"<<elapsed(start)<<"ms"<<std::endl;
+}
+
+///在后台任务占满线程池的情况下提交高优先级任务,打印高优先级任务从提交到开始执行的延迟的p50和p99
+template<ThreadPool::Priority Level>
+void Bench_ThreadPoolLatency(const char* name)
+{
+    using Clock = std::chrono::steady_clock;
+    const std::size_t probes = 1000;
+    std::vector<double> latency(probes);
+
+    ThreadPool pool;
+    for(int i = 0; i < 20000; i++)
+    {
+        pool.post<ThreadPool::Ordered,ThreadPool::Background>([](){
+            auto end = Clock::now() + std::chrono::microseconds(50);
+            while (Clock::now() < end){}
+        });
+    }
+
+    for(std::size_t i = 0; i < probes; i++)
+    {
+        Clock::time_point submit = Clock::now();
+        pool.post<ThreadPool::Ordered,Level>([&latency,i,submit](){
+            latency[i] = std::chrono::duration<double,std::micro>(Clock::now() - submit).count();
+        });
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    pool.waitforDone();
+
+    std::sort(latency.begin(),latency.end());
+    std::cout<<name<<" p50:"<<latency[probes / 2]<<"us p99:"<<latency[probes * 99 / 100]<<"us"<<std::endl;
+}
+
+void Bench_ThreadPoolPriority()
+{
+    Bench_ThreadPoolLatency<ThreadPool::High>("High under Background load");
+    Bench_ThreadPoolLatency<ThreadPool::Background>("Background under Background load");
+}
+
+///线程数量从1增加到64,打印每次调用post()的平均耗时,线程数量的调整不在提交路径上,所以耗时应该与线程数量基本无关
+void Bench_ThreadPoolSubmitCost()
+{
+    const std::size_t count = 200000;
+    for(unsigned size = 1; size <= 64; size *= 2)
+    {
+        ThreadPool pool(1);
+        pool.setThreadLimits(size,size);
+        while (pool.threadCount() != size)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        auto start = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < count; i++)
+            pool.post([](){});
+        std::chrono::duration<double,std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        pool.waitforDone();
+        std::cout<<size<<" threads post():"<<elapsed.count() / count<<"ns"<<std::endl;
+    }
+}
+
+///以指定的溢出策略向容量为1024的线程池突发提交10万个约10微秒的任务,打印提交耗时、实际执行的任务数量和队列已满的次数
+template<ThreadPool::Overflow Policy>
+void Bench_ThreadPoolOverflowPolicy(const char* name)
+{
+    const std::size_t count = 100000;
+    std::atomic<std::size_t> executed{0};
+    ThreadPool pool;
+    pool.setQueueCapacity(1024,Policy);
+
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < count; i++)
+    {
+        pool.post([&executed](){
+            auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(10);
+            while (std::chrono::steady_clock::now() < end){}
+            executed++;
+        });
+    }
+    std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    pool.waitforDone();
+
+    ThreadPool::OverflowStats stats = pool.overflowStats();
+    std::cout<<name<<" submit:"<<elapsed.count()<<"ms executed:"<<executed<<" full:"<<stats.full()<<std::endl;
+}
+
+void Bench_ThreadPoolOverflow()
+{
+    Bench_ThreadPoolOverflowPolicy<ThreadPool::Block>("Block");
+    Bench_ThreadPoolOverflowPolicy<ThreadPool::Reject>("Reject");
+    Bench_ThreadPoolOverflowPolicy<ThreadPool::DropOldest>("DropOldest");
+    Bench_ThreadPoolOverflowPolicy<ThreadPool::CallerRuns>("CallerRuns");
+}
+
+///一个客户端断开连接时它还有10万个任务在排队,打印取消之后这些任务被移出队列所需的时间
+void Bench_ThreadPoolCancellation()
+{
+    const std::size_t count = 100000;
+    ThreadPool pool(1);
+    std::atomic<bool> release{false};
+    pool.post([&release](){
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+
+    CancellationSource client;
+    std::vector<std::future<void>> futures;
+    futures.reserve(count);
+    for(std::size_t i = 0; i < count; i++)
+        futures.push_back(pool.run(client.token(),[](){}));
+
+    auto start = std::chrono::steady_clock::now();
+    client.cancel();
+    while (pool.pendingTasks() > 1)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    release = true;
+    pool.waitforDone();
+    std::cout<<count<<" queued tasks purged after cancel():"<<elapsed.count()<<"ms"<<std::endl;
+}
+
+///64个阻塞200毫秒的"串口读取"分别通过run()和runBlocking()提交,打印之后一个计算任务的等待时间以及计算线程的数量
+template<bool Blocking>
+void Bench_ThreadPoolBlockingLane(const char* name)
+{
+    using Clock = std::chrono::steady_clock;
+    ThreadPool pool;
+    pool.setOccupiedThreshold(100);
+    auto read = [](){std::this_thread::sleep_for(std::chrono::milliseconds(200));};
+    for(int i = 0; i < 64; i++)
+    {
+        if(Blocking)
+            pool.runBlocking(read);
+        else
+            pool.post(read);
+    }
+
+    Clock::time_point submit = Clock::now();
+    pool.run([](){}).wait();
+    std::chrono::duration<double,std::milli> latency = Clock::now() - submit;
+    pool.waitforDone();
+    std::cout<<name<<" cpu task latency:"<<latency.count()<<"ms cpu threads:"<<pool.threadCount()<<std::endl;
+}
+
+void Bench_ThreadPoolBlocking()
+{
+    Bench_ThreadPoolBlockingLane<false>("run()");
+    Bench_ThreadPoolBlockingLane<true>("runBlocking()");
+}
+
+///提交一个一直执行到release为true的任务,并等待它开始执行
+void Test_OccupyPool(ThreadPool& pool,std::atomic<bool>& release)
+{
+    std::atomic<bool> started{false};
+    pool.run([&started,&release](){
+        started = true;
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    while (!started)
+        std::this_thread::yield();
+}
+
+///工作窃取模式下外部提交的任务和线程池内部提交到双端队列的任务都恰好执行一次
+///唯一的线程被占用之后提交的工作窃取任务不属于任何一个线程的任务队列,也要由新启动的线程执行
+bool Test_ThreadPoolStealing()
+{
+    const std::size_t count = 100000;
+    std::unique_ptr<std::atomic<int>[]> runs(new std::atomic<int>[count]);
+    for(std::size_t i = 0; i < count; i++)
+        runs[i] = 0;
+
+    ThreadPool pool(4);
+    for(std::size_t i = 0; i < count; i += 100)
+    {
+        pool.run<ThreadPool::Stealing>([&pool,&runs,i](){
+            for(std::size_t j = i; j < i + 100; j++)
+                pool.run<ThreadPool::Stealing>([&runs,j](){runs[j]++;});
+        });
+    }
+    pool.waitforDone();
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(runs[i] != 1)
+            return false;
+    }
+
+    ThreadPool busy(1);
+    busy.setOccupiedThreshold(50);
+    std::atomic<bool> release{false};
+    Test_OccupyPool(busy,release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::future<void> stolen = busy.run<ThreadPool::Stealing>([](){});
+    const bool rescued = stolen.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+    release = true;
+    busy.waitforDone();
+    return rescued;
+}
+
+///当前线程调用operator new的次数,testdemo.h替换了全局的operator new,用于验证提交任务的过程没有堆分配
+std::size_t& Test_NewCount()
+{
+    static thread_local std::size_t count = 0;
+    return count;
+}
+
+void* operator new(std::size_t size)
+{
+    Test_NewCount()++;
+    if(void* ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr,std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+///预热之后,在提交任务的线程中post()、工作窃取模式的post()和run()都不调用operator new
+bool Test_ThreadPoolAllocation()
+{
+    ThreadPool pool(1);
+    std::atomic<int> executed{0};
+    auto task = [&executed](){executed++;};
+    auto submit = [&pool,&task](){
+        for(int i = 0; i < 1000; i++)
+        {
+            pool.post(task);
+            pool.post<ThreadPool::Stealing>(task);
+            pool.run(task).get();
+        }
+    };
+
+    //预热时先占住唯一的线程让所有任务积压,之后任意时刻积压的任务都不会超过预热时的数量
+    std::atomic<bool> release{false};
+    pool.post([&release](){
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    std::vector<std::future<void>> warmup;
+    for(int i = 0; i < 1000; i++)
+    {
+        pool.post(task);
+        pool.post<ThreadPool::Stealing>(task);
+        warmup.push_back(pool.run(task));
+    }
+    release = true;
+    for(std::future<void>& future : warmup)
+        future.get();
+    pool.waitforDone();
+
+    const std::size_t before = Test_NewCount();
+    submit();
+    const std::size_t allocations = Test_NewCount() - before;
+    pool.waitforDone();
+    return allocations == 0 && executed == 6000;
+}
+
+///runBatch()和parallelFor()在不同分块大小下恰好覆盖整个范围,分块中抛出的异常保存到返回的future中
+bool Test_ThreadPoolBatch()
+{
+    ThreadPool pool(4);
+    for(std::size_t grain : {std::size_t(0),std::size_t(1),std::size_t(7),std::size_t(5000)})
+    {
+        std::vector<std::atomic<int>> marks(1000);
+        pool.runBatch(marks.begin(),marks.end(),[](std::atomic<int>& mark){mark++;},grain).get();
+
+        std::vector<std::atomic<int>> indices(1000);
+        pool.parallelFor<ThreadPool::Stealing>(100,1000,grain,[&indices](int i){indices[i]++;}).get();
+        for(std::size_t i = 0; i < marks.size(); i++)
+        {
+            if(marks[i] != 1 || indices[i] != (i < 100 ? 0 : 1))
+                return false;
+        }
+    }
+
+    bool emptyRange = false;
+    pool.parallelFor(10,10,0,[&emptyRange](int){emptyRange = true;}).get();
+    if(emptyRange)
+        return false;
+
+    std::atomic<int> executed{0};
+    std::future<void> failed = pool.parallelFor<ThreadPool::Balanced>(0,1000,10,[&executed](int i){
+        if(i % 100 == 50)
+            throw std::out_of_range("index " + std::to_string(i));
+        executed++;
+    });
+    try
+    {
+        failed.get();
+        return false;
+    }
+    catch (const std::out_of_range&){}
+    //future就绪时所有分块都已经结束,抛出异常的10个分块中各有10个下标没有执行
+    return executed == 900;
+}
+
+///单个线程被占用期间提交的带截止时间的任务,在线程空闲之后按截止时间最早优先的顺序执行
+template<ThreadPool::Distribution Mode>
+bool Test_ThreadPoolDeadlineOrder()
+{
+    using Clock = std::chrono::steady_clock;
+    ThreadPool pool(1);
+    pool.setThreadLimits(1,1);
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    pool.post([&started,&release](){
+        started = true;
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    while (!started)
+        std::this_thread::yield();
+
+    std::vector<int> order;
+    const Clock::time_point now = Clock::now();
+    for(int offset : {50,10,40,20,30})
+        pool.runBefore<Mode>(now + std::chrono::milliseconds(offset),[&order,offset](){order.push_back(offset);});
+    release = true;
+    pool.waitforDone();
+    return order == std::vector<int>{10,20,30,40,50};
+}
+
+///唯一的线程被占用期间交替提交High和Background任务,线程空闲之后所有High任务先于Background任务执行
+bool Test_ThreadPoolPriority()
+{
+    ThreadPool pool(1);
+    pool.setThreadLimits(1,1);
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    pool.post([&started,&release](){
+        started = true;
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    while (!started)
+        std::this_thread::yield();
+
+    std::vector<ThreadPool::Priority> order;
+    for(int i = 0; i < 100; i++)
+    {
+        pool.post<ThreadPool::Ordered,ThreadPool::Background>([&order](){order.push_back(ThreadPool::Background);});
+        pool.post<ThreadPool::Ordered,ThreadPool::High>([&order](){order.push_back(ThreadPool::High);});
+    }
+    release = true;
+    pool.waitforDone();
+    if(order.size() != 200 || std::count(order.begin(),order.begin() + 100,ThreadPool::High) != 100)
+        return false;
+
+    return Test_ThreadPoolDeadlineOrder<ThreadPool::Ordered>() && Test_ThreadPoolDeadlineOrder<ThreadPool::Stealing>();
+}
+
+///then()链中的异常直接传递给最后的TaskFuture,whenAll()得到第一个异常,whenAny()得到最先完成的任务的下标
+///唯一的线程被占用时then()和whenAll()之后的后续任务仍然会被执行
+bool Test_TaskFuture()
+{
+    ThreadPool pool(4);
+    TaskFuture<int> value = pool.async([](){return 20;});
+    if(value.then([](int v){return v + 1;}).then([](int v){return v * 2;}).get() != 42)
+        return false;
+
+    std::atomic<bool> skipped{true};
+    TaskFuture<int> failed = pool.async([]() -> int {throw std::runtime_error("failed");});
+    try
+    {
+        failed.then([&skipped](int v){skipped = false; return v;}).then([&skipped](int v){skipped = false; return v;}).get();
+        return false;
+    }
+    catch (const std::runtime_error&){}
+    if(!skipped)
+        return false;
+
+    std::vector<TaskFuture<int>> futures;
+    for(int i = 0; i < 8; i++)
+        futures.push_back(pool.async([i](){return i;}));
+    std::vector<int> values = ThreadPool::whenAll(futures).get();
+    for(int i = 0; i < 8; i++)
+    {
+        if(values[i] != i)
+            return false;
+    }
+
+    futures.push_back(failed);
+    try
+    {
+        ThreadPool::whenAll(futures).get();
+        return false;
+    }
+    catch (const std::runtime_error&){}
+    try
+    {
+        ThreadPool::whenAll(value,failed).get();
+        return false;
+    }
+    catch (const std::runtime_error&){}
+
+    //第一个任务一直等到whenAny()就绪之后才完成,等它被认为占用了线程之后再以工作窃取模式提交第二个任务,线程池会为第二个任务增加线程
+    std::atomic<bool> release{false};
+    std::vector<TaskFuture<int>> race;
+    pool.setOccupiedThreshold(50);
+    race.push_back(pool.async([&release](){
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return 0;
+    }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    race.push_back(pool.async<ThreadPool::Stealing>([](){return 1;}));
+    std::size_t first = ThreadPool::whenAny(race).get();
+    release = true;
+    if(first != 1 || race[0].get() != 0)
+        return false;
+
+    ThreadPool busy(1);
+    busy.setOccupiedThreshold(50);
+    TaskFuture<int> one = busy.async([](){return 1;});
+    one.wait();
+    release = false;
+    Test_OccupyPool(busy,release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    TaskFuture<int> chained = one.then([](int v){return v + 1;});
+    TaskFuture<std::size_t> joined = ThreadPool::whenAll(std::vector<TaskFuture<int>>{one,one}).then([](const std::vector<int>& v){return v.size();});
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!(chained.ready() && joined.ready()) && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const bool rescued = chained.ready() && joined.ready();
+    release = true;
+    busy.waitforDone();
+    return rescued && chained.get() == 2 && joined.get() == 2;
+}
+
+///菱形任务图按依赖顺序执行,有环的任务图直接失败,节点抛出异常之后后续节点不再执行
+///唯一的线程被占用时任务图的节点仍然会被执行
+bool Test_TaskGraph()
+{
+    ThreadPool pool(4);
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&mutex,&order](int id){
+        return [&mutex,&order,id](){
+            std::unique_lock<std::mutex> lock(mutex);
+            order.push_back(id);
+        };
+    };
+
+    TaskGraph graph;
+    TaskGraph::Node top = graph.add(record(0));
+    TaskGraph::Node left = graph.add(record(1));
+    TaskGraph::Node right = graph.add(record(2));
+    TaskGraph::Node bottom = graph.add(record(3));
+    graph.precede(top,left);
+    graph.precede(top,right);
+    graph.precede(left,bottom);
+    graph.precede(right,bottom);
+    for(int round = 0; round < 100; round++)
+    {
+        order.clear();
+        graph.run(pool).get();
+        if(order.size() != 4 || order.front() != 0 || order.back() != 3)
+            return false;
+    }
+
+    TaskGraph cycle;
+    TaskGraph::Node first = cycle.add(record(4));
+    TaskGraph::Node second = cycle.add(record(5));
+    cycle.precede(first,second);
+    cycle.precede(second,first);
+    try
+    {
+        cycle.run(pool).get();
+        return false;
+    }
+    catch (const std::future_error&)
+    {
+        return false;
+    }
+    catch (const std::logic_error&){}
+
+    std::atomic<bool> executed{false};
+    TaskGraph failing;
+    TaskGraph::Node thrower = failing.add([](){throw std::runtime_error("node failed");});
+    TaskGraph::Node after = failing.add([&executed](){executed = true;});
+    failing.precede(thrower,after);
+    try
+    {
+        failing.run(pool).get();
+        return false;
+    }
+    catch (const std::runtime_error&){}
+    if(executed || order.size() != 4)
+        return false;
+
+    ThreadPool busy(1);
+    busy.setOccupiedThreshold(50);
+    std::atomic<bool> release{false};
+    Test_OccupyPool(busy,release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    order.clear();
+    TaskFuture<void> done = graph.run(busy);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done.ready() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const bool rescued = done.ready();
+    release = true;
+    busy.waitforDone();
+    return rescued && order.size() == 4;
+}
+
+///多个线程同时等待整个线程池,任务组只等待自己的任务,任务组中的第一个异常在wait()中重新抛出
+bool Test_TaskGroup()
+{
+    ThreadPool pool(2);
+    pool.setThreadLimits(2,2);
+    std::atomic<int> sum{0};
+    for(int i = 0; i < 1000; i++)
+        pool.post([&sum](){sum++;});
+    std::vector<std::thread> waiters;
+    for(int i = 0; i < 4; i++)
+        waiters.emplace_back([&pool](){pool.waitforDone();});
+    for(std::thread& waiter : waiters)
+        waiter.join();
+    if(sum != 1000 || pool.pendingTasks() != 0)
+        return false;
+
+    //一个线程被任务组之外的任务占用,任务组的任务由另一个线程执行,wait()不等待这个任务
+    std::atomic<bool> release{false};
+    pool.post([&release](){
+        while (!release)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+    TaskGroup group(pool);
+    for(int i = 0; i < 100; i++)
+        group.run<ThreadPool::Stealing>([&sum](){sum++;});
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (group.pending() != 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    bool waitedOwnTasks = group.pending() == 0;
+    if(waitedOwnTasks)
+    {
+        group.wait();
+        waitedOwnTasks = sum == 1100 && pool.pendingTasks() != 0;
+    }
+    release = true;
+    pool.waitforDone();
+    if(!waitedOwnTasks)
+        return false;
+
+    group.run([](){throw std::runtime_error("task failed");});
+    group.run([&sum](){sum++;});
+    try
+    {
+        group.wait();
+        return false;
+    }
+    catch (const std::runtime_error&){}
+    group.wait();
+    return sum == 1101;
+}
+
+///单节点机器上同样可以使用runOnNode(0,...),不存在的节点按普通方式提交,开启线程绑定之后线程的位置都在检测到的拓扑中
+bool Test_ThreadPoolNuma()
+{
+    ThreadPool pool(2);
+    auto placed = [&pool](const ThreadPool::Topology& topology){
+        for(const ThreadPool::ThreadPlacement& thread : topology.threads)
+        {
+            if(thread.node >= topology.nodes.size())
+                return false;
+            const std::vector<unsigned>& cpus = topology.nodes[thread.node];
+            if(std::find(cpus.begin(),cpus.end(),thread.cpu) == cpus.end())
+                return false;
+        }
+        return !topology.nodes.empty() && topology.threads.size() == pool.threadCount();
+    };
+    ThreadPool::Topology topology = pool.topology();
+    if(!placed(topology) || topology.affinity)
+        return false;
+
+    const std::thread::id caller = std::this_thread::get_id();
+    auto worker = [caller](){return std::this_thread::get_id() != caller;};
+    if(!pool.runOnNode(0,worker).get() || !pool.runOnNode<ThreadPool::Balanced>(0,worker).get())
+        return false;
+    if(!pool.runOnNode(static_cast<unsigned>(topology.nodes.size()) + 1,worker).get())
+        return false;
+
+    pool.setThreadAffinity(true);
+    topology = pool.topology();
+    bool ok = placed(topology) && topology.affinity && pool.runOnNode(0,worker).get();
+    pool.setThreadAffinity(false);
+    return ok && !pool.topology().affinity;
+}
+
+#ifdef THREADPOOL_METRICS
+///统计数据中的任务数量和延迟样本数量与提交的任务数量一致,导出的追踪是括号配对的JSON,每个任务一个"X"事件,每个线程一个"M"事件
+bool Test_ThreadPoolMetrics()
+{
+    const std::size_t count = 1000;
+    ThreadPool pool(2);
+    pool.setTracing(true);
+    for(std::size_t i = 0; i < count / 2; i++)
+    {
+        pool.post([](){});
+        pool.post<ThreadPool::Stealing>([](){});
+    }
+    pool.waitforDone();
+
+    ThreadPool::Metrics metrics = pool.metrics();
+    std::uint64_t executed = 0;
+    std::vector<std::size_t> ids;
+    for(const ThreadPool::WorkerStats& worker : metrics.workers)
+    {
+        executed += worker.executed;
+        ids.push_back(worker.id);
+    }
+    std::sort(ids.begin(),ids.end());
+    if(metrics.workers.size() != pool.threadCount() || executed != count || metrics.pending != 0 || std::unique(ids.begin(),ids.end()) != ids.end())
+        return false;
+    if(metrics.queueLatency.count() != count || metrics.runLatency.count() != count
+        || metrics.runLatency.percentile(0.5) > metrics.runLatency.percentile(0.99))
+        return false;
+
+    auto occurrences = [](const std::string& text,const std::string& pattern){
+        std::size_t found = 0;
+        for(std::size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern,pos + 1))
+            found++;
+        return found;
+    };
+    auto wellFormed = [](const std::string& text){
+        const std::string head = "{\"traceEvents\":[";
+        const std::string tail = "]}\n";
+        if(text.compare(0,head.size(),head) != 0 || text.size() < tail.size() || text.compare(text.size() - tail.size(),tail.size(),tail) != 0)
+            return false;
+
+        std::vector<char> brackets;
+        bool inString = false;
+        char last = 0;
+        for(char c : text)
+        {
+            if(c == '"')
+                inString = !inString;
+            if(inString || c == '"' || std::isspace(static_cast<unsigned char>(c)))
+            {
+                last = c == '"' ? c : last;
+                continue;
+            }
+            if((c == '}' || c == ']') && last == ',')
+                return false;
+            if(c == '{' || c == '[')
+                brackets.push_back(c);
+            else if(c == '}' || c == ']')
+            {
+                if(brackets.empty() || brackets.back() != (c == '}' ? '{' : '['))
+                    return false;
+                brackets.pop_back();
+            }
+            last = c;
+        }
+        return brackets.empty() && !inString;
+    };
+
+    std::ostringstream trace;
+    pool.exportTrace(trace);
+    const std::string text = trace.str();
+    if(!wellFormed(text) || occurrences(text,"\"ph\":\"X\"") != count || occurrences(text,"\"ph\":\"M\"") != metrics.workers.size())
+        return false;
+
+    //导出之后追踪记录被清空
+    std::ostringstream empty;
+    pool.exportTrace(empty);
+    return wellFormed(empty.str()) && occurrences(empty.str(),"\"ph\":\"X\"") == 0;
+}
+#endif
+
+struct Test_RepostChain
+{
+    ThreadPool* pool = nullptr;
+    std::atomic<int> runs{0};
+};
+
+///每次执行之后重新提交自己,直到所有任务链一共执行3000次
+void Test_RepostSpin(Test_RepostChain* chain)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    if(++chain->runs < 3000)
+        chain->pool->post(&Test_RepostSpin,chain);
+}
+
+///4个线程的线程池中有8条不断重新提交自己的任务链,线程池在任务链结束之前析构,析构函数不能卡住
+bool Test_ThreadPoolShutdown()
+{
+    Test_RepostChain chain;
+    ThreadPool* pool = new ThreadPool(4);
+    chain.pool = pool;
+    for(int i = 0; i < 8; i++)
+        pool->post(&Test_RepostSpin,&chain);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    delete pool;
+    return chain.runs > 0;
+}
+
+///唯一的线程被占用并且容量为4的任务队列已满时,第5个任务按溢出策略被放弃、挤掉最早的任务、在调用线程中执行或者等待
+bool Test_ThreadPoolOverflow()
+{
+    bool ok = true;
+    std::atomic<int> executed{0};
+    auto count = [&executed](){executed++;};
+    auto broken = [](std::future<void>& future){
+        try
+        {
+            future.get();
+        }
+        catch (const std::future_error& error)
+        {
+            return error.code() == std::future_errc::broken_promise;
+        }
+        return false;
+    };
+
+    {
+        ThreadPool pool(1);
+        pool.setThreadLimits(1,1);
+        pool.setQueueCapacity(4,ThreadPool::Reject);
+        std::atomic<bool> release{false};
+        Test_OccupyPool(pool,release);
+        for(int i = 0; i < 4; i++)
+            ok = pool.post(count) && ok;
+        ok = !pool.post(count) && ok;
+        std::future<void> rejected = pool.run(count);
+        release = true;
+        pool.waitforDone();
+        ok = ok && broken(rejected) && executed == 4 && pool.overflowStats().rejected == 2;
+    }
+
+    executed = 0;
+    {
+        ThreadPool pool(1);
+        pool.setThreadLimits(1,1);
+        pool.setQueueCapacity(4,ThreadPool::DropOldest);
+        std::atomic<bool> release{false};
+        Test_OccupyPool(pool,release);
+        std::vector<std::future<void>> futures;
+        for(int i = 0; i < 4; i++)
+            futures.push_back(pool.run(count));
+        ok = pool.post(count) && ok;
+        release = true;
+        pool.waitforDone();
+        ok = ok && broken(futures[0]) && executed == 4 && pool.overflowStats().dropped == 1;
+    }
+
+    executed = 0;
+    {
+        ThreadPool pool(1);
+        pool.setThreadLimits(1,1);
+        pool.setQueueCapacity(4,ThreadPool::CallerRuns);
+        std::atomic<bool> release{false};
+        Test_OccupyPool(pool,release);
+        for(int i = 0; i < 4; i++)
+            pool.post(count);
+        std::thread::id runner;
+        ok = pool.post([&runner](){runner = std::this_thread::get_id();}) && ok;
+        ok = ok && runner == std::this_thread::get_id() && executed == 0;
+        release = true;
+        pool.waitforDone();
+        ok = ok && executed == 4 && pool.overflowStats().callerRuns == 1;
+    }
+
+    executed = 0;
+    {
+        ThreadPool pool(1);
+        pool.setThreadLimits(1,1);
+        pool.setQueueCapacity(4,ThreadPool::Block);
+        std::atomic<bool> release{false};
+        Test_OccupyPool(pool,release);
+        for(int i = 0; i < 4; i++)
+            pool.post(count);
+        std::atomic<bool> admitted{false};
+        std::thread producer([&pool,&count,&admitted](){
+            admitted = pool.post(count);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ok = !admitted && ok;
+        release = true;
+        producer.join();
+        pool.waitforDone();
+        ok = ok && admitted && executed == 5 && pool.overflowStats().blocked == 1;
+    }
+    return ok;
+}
+
+///取消之后还在排队的任务被跳过并且得到TaskCancelled,没有关联令牌的任务不受影响,正在执行的任务可以自己检查令牌
+bool Test_ThreadPoolCancellation()
+{
+    ThreadPool pool(1);
+    pool.setThreadLimits(1,1);
+    std::atomic<bool> release{false};
+    Test_OccupyPool(pool,release);
+
+    CancellationSource client;
+    std::atomic<int> executed{0};
+    std::vector<std::future<void>> cancelled;
+    std::vector<std::future<void>> kept;
+    for(int i = 0; i < 100; i++)
+    {
+        cancelled.push_back(pool.run(client.token(),[&executed](){executed++;}));
+        cancelled.push_back(pool.run<ThreadPool::Stealing>(client.token(),[&executed](){executed++;}));
+        if(i % 10 == 0)
+            kept.push_back(pool.run([&executed](){executed++;}));
+    }
+    client.cancel();
+
+    //控制线程定期把被取消的任务移出队列,不需要等到唯一的线程空闲
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (pool.pendingTasks() > kept.size() + 1 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    bool ok = pool.pendingTasks() == kept.size() + 1;
+    release = true;
+    pool.waitforDone();
+
+    for(std::future<void>& future : cancelled)
+    {
+        try
+        {
+            future.get();
+            ok = false;
+        }
+        catch (const TaskCancelled&){}
+    }
+    for(std::future<void>& future : kept)
+        future.get();
+
+    //任务开始执行之后才被取消,由任务自己检查令牌
+    CancellationSource running;
+    CancellationToken token = running.token();
+    std::atomic<bool> started{false};
+    std::future<void> checked = pool.run([&started,token](){
+        started = true;
+        while (!token.cancelled())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        token.throwIfCancelled();
+    });
+    while (!started)
+        std::this_thread::yield();
+    running.cancel();
+    try
+    {
+        checked.get();
+        ok = false;
+    }
+    catch (const TaskCancelled&){}
+    return ok && executed == 10;
+}
+
+///16个阻塞200毫秒的任务通过runBlocking()提交,计算任务不需要等待它们,计算线程的数量也不会增加
+bool Test_ThreadPoolBlocking()
+{
+    ThreadPool pool(2);
+    pool.setOccupiedThreshold(50);
+    const std::size_t threads = pool.threadCount();
+    std::atomic<int> finished{0};
+    std::vector<std::future<void>> reads;
+    for(int i = 0; i < 16; i++)
+    {
+        reads.push_back(pool.runBlocking([&finished](){
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            finished++;
+        }));
+    }
+
+    //计算线程都可以立即执行计算任务
+    std::vector<std::future<int>> computes;
+    for(int i = 0; i < 2; i++)
+        computes.push_back(pool.run([&finished](){return finished.load();}));
+    bool ok = true;
+    for(std::future<int>& compute : computes)
+        ok = compute.get() == 0 && ok;
+    ok = ok && pool.blockingThreadCount() > 0;
+
+    //等待时间超过被占用阈值之后控制线程也不会为阻塞任务增加计算线程
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ok = ok && pool.threadCount() == threads;
+    pool.waitforDone();
+    for(std::future<void>& read : reads)
+        read.get();
+    return ok && finished == 16;
+}
+
+struct Bench_Message
+{
+    char payload[48];
+};
+
+///threads个线程各自循环分配64个48字节的对象再全部释放,返回每秒完成的分配/释放次数
+template<typename Alloc,typename Release>
+double Bench_AllocatorThroughput(unsigned threads,Alloc alloc,Release release)
+{
+    const std::size_t rounds = 20000;
+    const std::size_t batch = 64;
+
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&alloc,&release](){
+            Bench_Message* objects[batch];
+            for(std::size_t r = 0; r < rounds; r++)
+            {
+                for(std::size_t i = 0; i < batch; i++)
+                    objects[i] = alloc();
+                for(std::size_t i = 0; i < batch; i++)
+                    release(objects[i]);
+            }
+        });
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return threads * rounds * batch / elapsed.count();
+}
+
+template<std::size_t N>
+struct Test_Block
+{
+    unsigned char data[N];
+};
+
+///内存块的复用、跨线程释放、reset()之后其他线程缓存的内存块被丢弃、内存页剩余空间的切割
+bool Test_MemoryPool()
+{
+    bool ok = true;
+    {
+        //释放之后再次分配同样大小的对象直接复用本地缓存中的内存块
+        MemoryPool pool;
+        Test_Block<48>* first = pool.allocate<Test_Block<48>>();
+        Test_Block<48>* released = first;
+        pool.deallocate(released);
+        Test_Block<48>* second = pool.allocate<Test_Block<48>>();
+        ok = ok && released == nullptr && second == first;
+        pool.deallocate(second);
+    }
+    {
+        //另一个线程释放的内存块在线程退出时归还给中心仓库,之后的分配优先使用这些内存块
+        MemoryPool pool;
+        std::vector<Test_Block<48>*> blocks(1000);
+        for(Test_Block<48>*& block : blocks)
+            block = pool.allocate<Test_Block<48>>();
+        std::set<Test_Block<48>*> released(blocks.begin(),blocks.end());
+        std::thread([&pool,&blocks](){
+            for(Test_Block<48>*& block : blocks)
+                pool.deallocate(block);
+        }).join();
+
+        std::size_t reused = 0;
+        for(Test_Block<48>*& block : blocks)
+        {
+            block = pool.allocate<Test_Block<48>>();
+            reused += released.count(block);
+        }
+        std::vector<Test_Block<48>*> extra(1000);
+        for(Test_Block<48>*& block : extra)
+        {
+            block = pool.allocate<Test_Block<48>>();
+            reused += released.count(block);
+        }
+        ok = ok && reused == released.size();
+        for(Test_Block<48>*& block : blocks)
+            pool.deallocate(block);
+        for(Test_Block<48>*& block : extra)
+            pool.deallocate(block);
+    }
+    {
+        //reset()之后其他线程缓存的内存块已经随内存页释放,这个线程再次分配时不能使用它们,否则会和本线程分配的内存块重叠
+        MemoryPool pool;
+        std::promise<void> cached,resumed;
+        std::future<void> resume = resumed.get_future();
+        std::vector<Test_Block<48>*> other;
+        std::thread worker([&](){
+            std::vector<Test_Block<48>*> blocks(10);
+            for(Test_Block<48>*& block : blocks)
+                block = pool.allocate<Test_Block<48>>();
+            for(Test_Block<48>*& block : blocks)
+                pool.deallocate(block);
+            cached.set_value();
+            resume.wait();
+            for(int i = 0; i < 100; i++)
+                other.push_back(pool.allocate<Test_Block<48>>());
+        });
+        cached.get_future().wait();
+        pool.reset();
+        std::set<Test_Block<48>*> own;
+        for(int i = 0; i < 100; i++)
+            own.insert(pool.allocate<Test_Block<48>>());
+        resumed.set_value();
+        worker.join();
+        for(Test_Block<48>* block : other)
+            ok = ok && own.count(block) == 0;
+        pool.reset();
+    }
+    {
+        //内存页的大小5000不是16的倍数,9个512字节的内存块之后剩余392字节,申请新内存页时切割成一个384字节的内存块
+        MemoryPool pool(5000);
+        std::vector<Test_Block<512>*> large(10);
+        for(Test_Block<512>*& block : large)
+            block = pool.allocate<Test_Block<512>>();
+        unsigned char* base = (*std::min_element(large.begin(),large.begin() + 8))->data;
+        unsigned char* remainder = base + 9 * 512;
+
+        bool carved = false;
+        std::vector<Test_Block<384>*> small(3);
+        for(Test_Block<384>*& block : small)
+        {
+            block = pool.allocate<Test_Block<384>>();
+            carved = carved || block->data == remainder;
+            std::memset(block->data,0xAB,sizeof (block->data));
+        }
+        ok = ok && carved;
+        for(Test_Block<384>*& block : small)
+            pool.deallocate(block);
+        for(Test_Block<512>*& block : large)
+            pool.deallocate(block);
+    }
+    return ok;
+}
+
+///分别在1、4、16个线程下比较operator new/delete和MemoryPool的分配吞吐量
+void Bench_MemoryPool()
+{
+    MemoryPool pool;
+    for(unsigned threads : {1u,4u,16u})
+    {
+        double heap = Bench_AllocatorThroughput(threads,[](){return new Bench_Message;},[](Bench_Message* ptr){delete ptr;});
+        double arena = Bench_AllocatorThroughput(threads,
+                                                 [&pool](){return pool.allocate<Bench_Message>();},
+                                                 [&pool](Bench_Message* ptr){pool.deallocate(ptr);});
+        std::cout<<threads<<" threads operator new:"<<heap<<"/s MemoryPool:"<<arena<<"/s"<<std::endl;
+    }
+}
+
+///每轮分配1000个对象再按分配顺序全部释放,共100万次分配/释放,返回总耗时
+template<typename Alloc,typename Release>
+double Bench_ObjectPoolCost(Alloc alloc,Release release)
+{
+    const std::size_t rounds = 1000;
+    const std::size_t batch = 1000;
+    std::vector<Bench_Message*> objects(batch);
+
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t r = 0; r < rounds; r++)
+    {
+        for(std::size_t i = 0; i < batch; i++)
+            objects[i] = alloc();
+        for(std::size_t i = 0; i < batch; i++)
+            release(objects[i]);
+    }
+    return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+///析构时计数,用来检查对象池析构时只对没有回收的对象调用析构函数
+struct Test_Counted
+{
+    explicit Test_Counted(int* counter):destroyed(counter){}
+
+    ~Test_Counted()
+    {
+        ++*destroyed;
+    }
+
+    int* destroyed;
+    char payload[24];
+};
+
+template<bool Magazine>
+bool Test_AllocatorDestroyLive()
+{
+    int destroyed = 0;
+    {
+        Allocator<Test_Counted,Magazine> allocator(8);
+        std::vector<Test_Counted*> objects;
+        for(int i = 0; i < 20; i++)
+            objects.push_back(allocator.allocate(&destroyed));
+        for(int i = 0; i < 5; i++)
+            allocator.deallocate(objects[i]);
+        if(destroyed != 5)
+            return false;
+    }
+    return destroyed == 20;
+}
+
+///槽位的复用、跨线程释放、对象池析构之后线程退出时弹匣的回收、析构时只销毁没有回收的对象
+bool Test_Allocator()
+{
+    bool ok = true;
+    {
+        //回收的槽位位于空闲链表头部,下一次分配直接取出
+        Allocator<Test_Block<48>> single(16);
+        Allocator<Test_Block<48>,true> magazine(16);
+        Test_Block<48>* first = single.allocate();
+        single.deallocate(first);
+        ok = ok && single.allocate() == first;
+        first = magazine.allocate();
+        magazine.deallocate(first);
+        ok = ok && magazine.allocate() == first;
+    }
+    {
+        //另一个线程回收的槽位在线程退出时从弹匣归还给中心仓库,之后的分配优先使用这些槽位
+        Allocator<Test_Block<48>,true> allocator(1024);
+        std::vector<Test_Block<48>*> objects(1000);
+        for(Test_Block<48>*& object : objects)
+            object = allocator.allocate();
+        std::set<Test_Block<48>*> released(objects.begin(),objects.end());
+        std::thread([&allocator,&objects](){
+            for(Test_Block<48>* object : objects)
+                allocator.deallocate(object);
+        }).join();
+
+        std::size_t reused = 0;
+        for(int i = 0; i < 2000; i++)
+            reused += released.count(allocator.allocate());
+        ok = ok && reused == released.size();
+    }
+    {
+        //对象池析构时另一个线程的弹匣中还有槽位,线程退出时发现中心仓库已经析构,直接丢弃弹匣
+        std::unique_ptr<Allocator<Test_Block<48>,true>> allocator(new Allocator<Test_Block<48>,true>(64));
+        std::promise<void> cached,destroyed;
+        std::future<void> wait = destroyed.get_future();
+        std::thread worker([&](){
+            allocator->deallocate(allocator->allocate());
+            cached.set_value();
+            wait.wait();
+        });
+        cached.get_future().wait();
+        allocator.reset();
+        destroyed.set_value();
+        worker.join();
+    }
+    return ok && Test_AllocatorDestroyLive<false>() && Test_AllocatorDestroyLive<true>();
+}
+
+///比较operator new/delete、Allocator<T>以及带弹匣的Allocator<T,true>完成100万次分配/释放的耗时
+void Bench_Allocator()
+{
+    Allocator<Bench_Message> single(1024);
+    Allocator<Bench_Message,true> magazine(1024);
+    std::cout<<"operator new:"<<Bench_ObjectPoolCost([](){return new Bench_Message;},[](Bench_Message* ptr){delete ptr;})
+             <<"ms Allocator:"<<Bench_ObjectPoolCost([&single](){return single.allocate();},[&single](Bench_Message* ptr){single.deallocate(ptr);})
+             <<"ms Allocator<Magazine>:"<<Bench_ObjectPoolCost([&magazine](){return magazine.allocate();},[&magazine](Bench_Message* ptr){magazine.deallocate(ptr);})
+             <<"ms"<<std::endl;
+}
+
+template<std::size_t N>
+struct Bench_Block
+{
+    unsigned char data[N];
+};
+
+template<std::size_t N>
+void* Bench_PoolAnyAllocate(MemoryPoolAny& pool)
+{
+    return pool.construct<Bench_Block<N>>();
+}
+
+template<std::size_t N>
+void Bench_PoolAnyRelease(MemoryPoolAny& pool,void* ptr)
+{
+    pool.destruct(static_cast<Bench_Block<N>*>(ptr));
+}
+
+///混合尺寸负载使用的内存块尺寸,最后一种超过256字节,由一级分配器分配
+struct Bench_SizeClass
+{
+    std::size_t size;
+    void*(*allocate)(MemoryPoolAny&);
+    void(*release)(MemoryPoolAny&,void*);
+};
+
+static const Bench_SizeClass Bench_MixedSizes[] = {
+    {8,&Bench_PoolAnyAllocate<8>,&Bench_PoolAnyRelease<8>},
+    {16,&Bench_PoolAnyAllocate<16>,&Bench_PoolAnyRelease<16>},
+    {24,&Bench_PoolAnyAllocate<24>,&Bench_PoolAnyRelease<24>},
+    {40,&Bench_PoolAnyAllocate<40>,&Bench_PoolAnyRelease<40>},
+    {64,&Bench_PoolAnyAllocate<64>,&Bench_PoolAnyRelease<64>},
+    {100,&Bench_PoolAnyAllocate<100>,&Bench_PoolAnyRelease<100>},
+    {200,&Bench_PoolAnyAllocate<200>,&Bench_PoolAnyRelease<200>},
+    {256,&Bench_PoolAnyAllocate<256>,&Bench_PoolAnyRelease<256>},
+    {300,&Bench_PoolAnyAllocate<300>,&Bench_PoolAnyRelease<300>}
+};
+
+///每个线程持有1024个槽位,随机选择一个槽位:槽位为空时分配一个随机尺寸的内存块,否则释放它
+///useMalloc为true时使用malloc/free,verify为true时为每个内存块填充特征值并在释放前检查,用来发现两个内存块地址重叠
+double Bench_MixedWorkload(MemoryPoolAny& pool,unsigned threads,std::size_t operations,bool useMalloc,bool verify,std::atomic<bool>& corrupted)
+{
+    const std::size_t kinds = sizeof(Bench_MixedSizes) / sizeof(Bench_MixedSizes[0]);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&pool,&corrupted,t,operations,useMalloc,verify,kinds](){
+            std::minstd_rand random(t + 1);
+            std::vector<std::pair<void*,std::size_t>> slots(1024,std::make_pair(nullptr,std::size_t(0)));
+            for(std::size_t i = 0; i <= operations; i++)
+            {
+                //最后一轮释放所有剩余的内存块
+                std::pair<void*,std::size_t>& slot = slots[random() % slots.size()];
+                std::size_t count = i == operations ? slots.size() : 1;
+                for(std::size_t k = 0; k < count; k++)
+                {
+                    std::pair<void*,std::size_t>& target = count == 1 ? slot : slots[k];
+                    if(target.first != nullptr)
+                    {
+                        const Bench_SizeClass& kind = Bench_MixedSizes[target.second];
+                        unsigned char* bytes = static_cast<unsigned char*>(target.first);
+                        if(verify && (bytes[0] != (unsigned char)(t * 31 + target.second) || bytes[kind.size - 1] != (unsigned char)t))
+                            corrupted = true;
+                        if(useMalloc)
+                            std::free(target.first);
+                        else
+                            kind.release(pool,target.first);
+                        target.first = nullptr;
+                    }
+                    else if(count == 1)
+                    {
+                        target.second = random() % kinds;
+                        const Bench_SizeClass& kind = Bench_MixedSizes[target.second];
+                        target.first = useMalloc ? std::malloc(kind.size) : kind.allocate(pool);
+                        if(verify)
+                        {
+                            std::memset(target.first,(unsigned char)(t * 31 + target.second),kind.size);
+                            static_cast<unsigned char*>(target.first)[kind.size - 1] = (unsigned char)t;
+                        }
+                    }
+                }
+            }
+        });
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+    return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+///8个线程共享一个MemoryPoolAny执行混合尺寸的随机分配/释放,检查内存块之间没有发生重叠
+bool Test_MemoryPoolAny()
+{
+    MemoryPoolAny pool;
+    std::atomic<bool> corrupted{false};
+    Bench_MixedWorkload(pool,8,200000,false,true,corrupted);
+    return !corrupted;
+}
+
+///分别在1、4个线程下比较glibc malloc与MemoryPoolAny执行100万次混合尺寸随机分配/释放的耗时
+void Bench_MemoryPoolAny()
+{
+    std::atomic<bool> corrupted{false};
+    for(unsigned threads : {1u,4u})
+    {
+        MemoryPoolAny pool;
+        double heap = Bench_MixedWorkload(pool,threads,1000000,true,false,corrupted);
+        double any = Bench_MixedWorkload(pool,threads,1000000,false,false,corrupted);
+        std::cout<<threads<<" threads malloc:"<<heap<<"ms MemoryPoolAny:"<<any<<"ms"<<std::endl;
+    }
+}
+
+///同一个内存池中分配的容器,容器析构之后reset()一次性释放
+bool Test_PoolAllocator()
+{
+    MemoryPool arena;
+    {
+        std::vector<int,PoolAllocator<int>> numbers{PoolAllocator<int>(arena)};
+        std::map<int,std::string,std::less<int>,PoolAllocator<std::pair<const int,std::string>>> names{PoolAllocator<std::pair<const int,std::string>>(arena)};
+        for(int i = 0; i < 1000; i++)
+        {
+            numbers.push_back(i);
+            names.emplace(i,std::to_string(i));
+        }
+        if(numbers[999] != 999 || names.size() != 1000 || names[500] != "500")
+            return false;
+    }
+    arena.reset();
+    return true;
+}
+
+#if __cplusplus > 201402L
+///三种内存池分别作为std::pmr容器的内存资源
+bool Test_MemoryResource()
+{
+    MemoryPool arena;
+    MemoryPoolResource arenaResource(arena);
+    {
+        std::pmr::vector<std::pmr::string> lines(&arenaResource);
+        for(int i = 0; i < 100; i++)
+            lines.emplace_back("request-scoped string that does not fit in SSO " + std::to_string(i));
+        if(lines[42].get_allocator().resource() != &arenaResource)
+            return false;
+    }
+    arena.reset();
+
+    MemoryPoolAny any;
+    MemoryPoolAnyResource anyResource(any);
+    std::pmr::map<int,std::pmr::string> table(&anyResource);
+    for(int i = 0; i < 100; i++)
+        table.emplace(i,std::string(i,'x'));
+
+    struct Node
+    {
+        alignas(std::max_align_t) unsigned char storage[64];
+    };
+    Allocator<Node> nodes(256);
+    AllocatorResource<Node> nodeResource(nodes);
+    std::pmr::list<int> list(&nodeResource);
+    for(int i = 0; i < 1000; i++)
+        list.push_back(i);
+
+    return table[99].size() == 99 && list.back() == 999;
+}
+#endif
+
+///MemoryPool和MemoryPoolAny使用同一个MappedPageProvider,内存池reset()或者析构之后区域全部变为空闲
+bool Test_PageProvider()
+{
+    MappedPageProvider::Options options;
+    options.hugePages = MappedPageProvider::TransparentHugePages;
+    MappedPageProvider provider(options);
+    {
+        MemoryPool pool(64 * 1024,&provider);
+        MemoryPoolAny any(&provider);
+        std::vector<Bench_Message*> messages;
+        std::vector<Bench_Block<64>*> blocks;
+        for(int i = 0; i < 100000; i++)
+        {
+            messages.push_back(pool.allocate<Bench_Message>());
+            blocks.push_back(any.construct<Bench_Block<64>>());
+        }
+        //MemoryPoolAny的内存块回到空闲链表中,内存页直到析构时才归还给provider
+        for(Bench_Block<64>* block : blocks)
+            any.destruct(block);
+        if(provider.regionCount() == 0 || provider.idleRegionCount() != 0)
+            return false;
+        pool.reset();
+    }
+    return provider.idleRegionCount() == provider.regionCount();
+}
+
+///比较从PageProvider::heap()和预先写入32MB的MappedPageProvider中分配约24MB对象的总耗时以及单次allocate()耗时的p99.9
+void Bench_PageProviderPrefault()
+{
+    auto firstAllocations = [](const char* name,PageProvider* provider){
+        const std::size_t count = 500000;
+        std::vector<double> latency(count);
+        MemoryPool pool(64 * 1024,provider);
+        auto begin = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < count; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            pool.allocate<Bench_Message>();
+            latency[i] = std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        double total = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - begin).count();
+        std::sort(latency.begin(),latency.end());
+        std::cout<<name<<" total:"<<total<<"ms p99.9:"<<latency[count * 999 / 1000]<<"us ";
+    };
+
+    MappedPageProvider::Options options;
+    options.prefaultBytes = std::size_t(32) << 20;
+    MappedPageProvider prefaulted(options);
+    firstAllocations("heap pages",PageProvider::heap());
+    firstAllocations("prefaulted mapped pages",&prefaulted);
+    std::cout<<std::endl;
+}
+
+///三种内存池的stats():跨线程释放以及reset()之后,分配和释放的次数、正在使用的字节数都能对上
+bool Test_PoolStats()
+{
+    MemoryPool pool;
+    std::vector<Bench_Message*> messages;
+    for(int i = 0; i < 1000; i++)
+        messages.push_back(pool.allocate<Bench_Message>());
+    PoolStats stats = pool.stats();
+    if(stats.allocations != 1000 || stats.bytesInUse == 0 || stats.bytesReserved < stats.bytesInUse)
+        return false;
+    std::thread([&]{
+        for(Bench_Message* message : messages)
+            pool.deallocate(message);
+    }).join();
+    stats = pool.stats();
+    if(stats.deallocations != 1000 || stats.bytesInUse != 0 || stats.highWaterBytes == 0)
+        return false;
+    pool.allocate<Bench_Message>();
+    pool.reset();
+    if(pool.stats().bytesInUse != 0)
+        return false;
+
+    MemoryPoolAny any;
+    Bench_Block<64>* block = any.construct<Bench_Block<64>>();
+    Bench_Block<1024>* large = any.construct<Bench_Block<1024>>();
+    if(any.stats().allocations != 2)
+        return false;
+    any.destruct(block);
+    any.destruct(large);
+    if(any.stats().bytesInUse != 0)
+        return false;
+
+    Allocator<Bench_Message,true> objects(64);
+    Bench_Message* message = objects.allocate();
+    if(objects.stats().sizeClasses[0].live != 1)
+        return false;
+    objects.deallocate(message);
+    stats = objects.stats();
+    return stats.sizeClasses[0].live == 0 && stats.allocations == 1 && stats.deallocations == 1;
+}
+
+///非平凡类型的写时复制:副本修改之后原数组不变,多个线程同时分离同一份数据
+bool Test_SharedArray()
+{
+    const std::string text(40,'a');
+    SharedArray<std::string> origin(3,text);
+    SharedArray<std::string> copy = origin;
+    if(origin.isDetached() || copy.constData() != origin.constData())
+        return false;
+    copy.edit()[1] = "changed";
+    if(!origin.isDetached() || !copy.isDetached() || origin.constData()[1] != text || copy.constData()[0] != text)
+        return false;
+
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> workers;
+    for(int i = 0; i < 4; i++)
+    {
+        workers.emplace_back([&origin,&failed,i]{
+            for(int n = 0; n < 1000; n++)
+            {
+                SharedArray<std::string> local = origin;
+                local.edit()[n % 3] = std::to_string(i);
+                if(local.constData()[n % 3] != std::to_string(i) || local.size() != 3)
+                    failed = true;
+            }
+        });
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+
+    SharedArray<std::string> moved = std::move(copy);
+    return !failed && copy.empty() && moved.size() == 3 && origin.constData()[1] == text;
+}
+
+///在共享的数组上追加、插入和调整大小:只有写入的副本被分离,分离和扩容只分配一次
+bool Test_SharedArrayGrowth()
+{
+    SharedArray<std::string> frame{"header"};
+    frame.reserve(4);
+    const std::string* storage = frame.constData();
+    frame.push_back("payload");
+    frame.push_back(frame.constData()[0]);
+    if(frame.constData() != storage || frame.size() != 3 || frame.constData()[2] != "header")
+        return false;
+
+    SharedArray<std::string> snapshot = frame;
+    std::vector<std::string> tail{"crc","end"};
+    frame.append(tail.begin(),tail.end());
+    frame.insert(frame.cbegin() + 1,"length");
+    if(snapshot.size() != 3 || !snapshot.isDetached() || frame.size() != 6 || frame.constData()[1] != "length" || frame.constData()[5] != "end")
+        return false;
+
+    frame.resize(2);
+    snapshot.resize(5,"pad");
+    return frame.size() == 2 && snapshot.constData()[4] == "pad" && snapshot.capacity() >= 5;
+}
+
+///组帧:在收到的帧头之后追加16段64字节的负载,比较先复制到std::vector再复制回SharedArray与直接在SharedArray上追加的耗时
+void Bench_SharedArrayFrame()
+{
+    const int count = 100000;
+    const SharedArray<unsigned char> header(16,0xAA);
+    const std::vector<unsigned char> chunk(64,0x55);
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t bytes = 0;
+    for(int i = 0; i < count; i++)
+    {
+        std::vector<unsigned char> buffer(header.begin(),header.end());
+        for(int n = 0; n < 16; n++)
+            buffer.insert(buffer.end(),chunk.begin(),chunk.end());
+        unsigned char* array = new unsigned char[buffer.size()];
+        std::memcpy(array,buffer.data(),buffer.size());
+        SharedArray<unsigned char> frame(array,buffer.size());
+        bytes += frame.size();
+    }
+    std::chrono::duration<double,std::milli> vector = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        SharedArray<unsigned char> frame = header;
+        for(int n = 0; n < 16; n++)
+            frame.append(chunk.data(),chunk.size());
+        bytes += frame.size();
+    }
+    std::chrono::duration<double,std::milli> shared = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        SharedArray<unsigned char> frame = header;
+        frame.reserve(header.size() + 16 * chunk.size());
+        for(int n = 0; n < 16; n++)
+            frame.append(chunk.data(),chunk.size());
+        bytes += frame.size();
+    }
+    std::chrono::duration<double,std::milli> reserved = std::chrono::steady_clock::now() - start;
+
+    std::cout<<"std::vector round trip:"<<vector.count()<<"ms SharedArray append:"<<shared.count()
+             <<"ms SharedArray reserve+append:"<<reserved.count()<<"ms ("<<bytes<<" bytes)"<<std::endl;
+}
+
+///把数据报拆分成帧头和多个字段交给不同的线程,子数组共享原数组的数据块,修改子数组时只复制子数组
+bool Test_SharedArraySlice()
+{
+    SharedArray<unsigned char> datagram(1024);
+    SharedArray<unsigned char>::Editor bytes = datagram.edit();
+    for(std::size_t i = 0; i < bytes.size(); i++)
+        bytes[i] = static_cast<unsigned char>(i);
+
+    SharedArray<unsigned char> header = datagram.slice(0,16);
+    SharedArray<unsigned char> payload = datagram.slice(16);
+    if(header.constData() != datagram.constData() || payload.constData() != datagram.constData() + 16 || payload.size() != 1008)
+        return false;
+
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> workers;
+    for(std::size_t field = 0; field < 4; field++)
+    {
+        workers.emplace_back([&failed,field](SharedArray<unsigned char> view){
+            const unsigned char first = view.constData()[0];
+            if(first != static_cast<unsigned char>(16 + field * 252))
+                failed = true;
+            view.edit()[0] = 0xFF;
+            view.push_back(0xEE);
+            if(view.size() != 253 || view.constData()[0] != 0xFF)
+                failed = true;
+        },payload.slice(field * 252,252));
+    }
+    for(std::thread& worker : workers)
+        worker.join();
+
+    header.edit()[0] = 0x7E;
+    return !failed && header.isDetached() && datagram.constData()[0] == 0 && datagram.constData()[16] == 16
+            && payload.isSharedWith(datagram) && datagram.slice(2000).empty();
+}
+
+///把1500字节的数据报拆分成20个字段,比较逐个复制字段与slice()的耗时
+void Bench_SharedArraySlice()
+{
+    const int count = 100000;
+    const std::size_t field = 75;
+    const SharedArray<unsigned char> datagram(1500,0x5A);
+    std::size_t bytes = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        for(std::size_t offset = 0; offset < datagram.size(); offset += field)
+        {
+            SharedArray<unsigned char> copy;
+            copy.append(datagram.constData() + offset,field);
+            bytes += copy.size();
+        }
+    }
+    std::chrono::duration<double,std::milli> copied = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        for(std::size_t offset = 0; offset < datagram.size(); offset += field)
+        {
+            SharedArray<unsigned char> view = datagram.slice(offset,field);
+            bytes += view.size();
+        }
+    }
+    std::chrono::duration<double,std::milli> sliced = std::chrono::steady_clock::now() - start;
+
+    std::cout<<"copy fields:"<<copied.count()<<"ms slice fields:"<<sliced.count()<<"ms ("<<bytes<<" bytes)"<<std::endl;
+}
+
+///旧版SharedArray的数据结构:std::shared_ptr管理new T[]分配的数组,分离时new T[]再memcpy
+template<typename T>
+struct Bench_LegacySharedArray
+{
+    std::shared_ptr<T> data;
+    std::size_t size;
+
+    explicit Bench_LegacySharedArray(std::size_t length):data(new T[length](),std::default_delete<T[]>()),size(length){}
+
+    ///旧版没有edit(),非const的operator[]本身就会分离
+    Bench_LegacySharedArray& edit()
+    {
+        return *this;
+    }
+
+    T& operator[](std::size_t index)
+    {
+        if(data.use_count() > 1)
+        {
+            std::shared_ptr<T> newData(new T[size],std::default_delete<T[]>());
+            std::memcpy(newData.get(),data.get(),sizeof (T) * size);
+            data = newData;
+        }
+        return data.get()[index];
+    }
+};
+
+template<typename Array>
+void Bench_SharedArrayCase(const char* name)
+{
+    const int count = 1000000;
+    auto elapsed = [](std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count / 10; i++)
+    {
+        Array array(64);
+        array.edit()[0] = i;
+    }
+    double create = elapsed(start);
+
+    Array origin(1024);
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        Array copy(origin);
+        (void)copy;
+    }
+    double copy = elapsed(start);
+
+    //通过volatile指针访问,避免整个循环被优化掉
+    Array* volatile target = &origin;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        Array moved(std::move(*target));
+        *target = std::move(moved);
+    }
+    double move = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count / 10; i++)
+    {
+        Array copy(origin);
+        copy.edit()[i % 1024] = i;
+    }
+    double detach = elapsed(start);
+
+    std::cout<<name<<" create(64)x100k:"<<create<<"ms copy x1M:"<<copy<<"ms move x1M:"<<move<<"ms detach(1024)x100k:"<<detach<<"ms"<<std::endl;
+}
+
+///通过非const引用遍历共享的数组不会复制数据,edit()只在共享时分离一次;定义SHAREDARRAY_DEBUG时检查分离计数
+bool Test_SharedArrayEdit()
+{
+#ifdef SHAREDARRAY_DEBUG
+    SharedArrayDetach::reset();
+#endif
+    SharedArray<int> origin(1000,1);
+    SharedArray<int> copy = origin;
+    long long sum = 0;
+    for(int value : copy)
+        sum += value;
+    for(std::size_t i = 0; i < copy.size(); i++)
+        sum += copy[i];
+    if(sum != 2000 || !copy.isSharedWith(origin))
+        return false;
+
+    SharedArray<int>::Editor editor = copy.edit();
+    for(int& value : editor)
+        value = 2;
+    copy.edit()[0] = 3;
+    if(copy.isSharedWith(origin) || origin[0] != 1 || copy[0] != 3 || copy[1] != 2)
+        return false;
+
+    SharedArray<int> snapshot = copy;
+    snapshot.push_back(4);
+#ifdef SHAREDARRAY_DEBUG
+    SharedArrayDetach::print(std::cout);
+    if(SharedArrayDetach::count(SharedArrayDetach::Edit) != 1 || SharedArrayDetach::count(SharedArrayDetach::Append) != 1
+            || SharedArrayDetach::bytes(SharedArrayDetach::Edit) != 1000 * sizeof(int))
+        return false;
+#endif
+    return snapshot.size() == 1001 && copy.size() == 1000;
+}
+
+///对一个正在被其他线程共享的64K个int的数组求和1000次,旧版通过非const的operator[]读取也会先复制整个数组
+void Bench_SharedArrayRead()
+{
+    const int count = 1000;
+    const std::size_t length = 64 * 1024;
+    auto elapsed = [](std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    long long sum = 0;
+
+    Bench_LegacySharedArray<int> legacy(length);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        Bench_LegacySharedArray<int> copy(legacy);
+        for(std::size_t n = 0; n < length; n++)
+            sum += copy[n];
+    }
+    double legacyTime = elapsed(start);
+
+    SharedArray<int> shared(length);
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        SharedArray<int> copy(shared);
+        for(std::size_t n = 0; n < length; n++)
+            sum += copy[n];
+    }
+    double sharedTime = elapsed(start);
+
+    std::cout<<"shared_ptr non-const read:"<<legacyTime<<"ms SharedArray read:"<<sharedTime<<"ms ("<<sum<<")"<<std::endl;
+}
+
+///映射文件:只读映射在写入时复制到匿名内存,CopyOnWrite映射独占时原地写入,两种模式都不会修改文件
+bool Test_SharedArrayMapFile()
+{
+    const char* path = "SharedArrayMapFile.bin";
+    std::vector<std::uint32_t> values(4096);
+    for(std::size_t i = 0; i < values.size(); i++)
+        values[i] = std::uint32_t(i);
+    std::FILE* file = std::fopen(path,"wb");
+    if(file == nullptr)
+        return false;
+    std::fwrite(values.data(),sizeof(std::uint32_t),values.size(),file);
+    std::fclose(file);
+
+    bool result = true;
+    {
+        SharedArray<std::uint32_t> table = SharedArray<std::uint32_t>::mapFile(path);
+        SharedArray<std::uint32_t> row = table.slice(1024,16);
+        result = result && table.size() == 4096 && table[4095] == 4095 && row.constData() == table.constData() + 1024;
+
+        row.edit()[0] = 7;
+        result = result && row[0] == 7 && table[1024] == 1024 && !table.isDetached();
+
+        SharedArray<std::uint32_t> capture = SharedArray<std::uint32_t>::mapFile(path,SharedArray<std::uint32_t>::CopyOnWrite);
+        const std::uint32_t* mapped = capture.constData();
+        capture.edit()[0] = 9;
+        capture.push_back(4096);
+        result = result && capture.isDetached() && capture[0] == 9 && capture[4096] == 4096 && capture.constData() != mapped;
+    }
+    {
+        SharedArray<std::uint32_t> reopened = SharedArray<std::uint32_t>::mapFile(path,SharedArray<std::uint32_t>::CopyOnWrite);
+        SharedArray<std::uint32_t>::Editor editor = reopened.edit();
+        editor[1] = 11;
+        result = result && reopened.constData() == editor.data() && reopened[1] == 11;
+    }
+    result = result && SharedArray<std::uint32_t>::mapFile(path)[0] == 0 && SharedArray<std::uint32_t>::mapFile(path)[1] == 1;
+    std::remove(path);
+
+    try
+    {
+        SharedArray<char>::mapFile(path);
+        return false;
+    }
+    catch(const std::system_error&)
+    {
+    }
+    return result;
+}
+
+///64MB的文件:比较读入整个文件、映射后每1MB访问一个元素以及映射后顺序读取全部元素的耗时
+void Bench_SharedArrayMapFile()
+{
+    const char* path = "SharedArrayMapFile.bin";
+    const std::size_t bytes = std::size_t(64) << 20;
+    {
+        std::vector<char> content(bytes,1);
+        std::FILE* file = std::fopen(path,"wb");
+        if(file == nullptr)
+            return;
+        std::fwrite(content.data(),1,content.size(),file);
+        std::fclose(file);
+    }
+    auto elapsed = [](std::chrono::steady_clock::time_point start){
+        return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    long long sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::FILE* file = std::fopen(path,"rb");
+        SharedArray<char> loaded(bytes);
+        std::fread(loaded.edit().data(),1,bytes,file);
+        std::fclose(file);
+        sum += loaded[bytes / 2];
+    }
+    double read = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        SharedArray<char> mapped = SharedArray<char>::mapFile(path);
+        for(std::size_t offset = 0; offset < mapped.size(); offset += std::size_t(1) << 20)
+            sum += mapped[offset];
+    }
+    double sparse = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        SharedArray<char> mapped = SharedArray<char>::mapFile(path);
+        for(char value : mapped)
+            sum += value;
+    }
+    double scan = elapsed(start);
+
+    std::remove(path);
+    std::cout<<"fread whole file:"<<read<<"ms mapFile sparse access:"<<sparse<<"ms mapFile full scan:"<<scan<<"ms ("<<sum<<")"<<std::endl;
+}
+
+///比较旧版(shared_ptr + new[] + memcpy)与单次分配的SharedArray的创建、拷贝、移动和分离耗时
+void Bench_SharedArray()
+{
+    Bench_SharedArrayCase<Bench_LegacySharedArray<int>>("shared_ptr");
+    Bench_SharedArrayCase<SharedArray<int>>("SharedArray");
+}
+
+#ifdef THREADPOOL_COROUTINE
+///模拟一个I/O型的协议处理协程:等待10次、每次10毫秒的"I/O",等待期间不占用线程
+Task<int> Bench_ProtocolHandler(ThreadPool& pool,int id)
+{
+    co_await pool.schedule();
+    for(int i = 0; i < 10; i++)
+        co_await pool.sleepFor(10);
+    co_return id;
+}
+
+///切换到线程池的线程之后等待20毫秒,再等待一个TaskFuture的结果
+Task<int> Test_AwaitFuture(ThreadPool& pool,int offset)
+{
+    co_await pool.schedule();
+    co_await pool.sleepFor(20);
+    int value = co_await pool.async([](){return 40;});
+    co_return value + offset;
+}
+
+Task<std::thread::id> Test_ResumedThread(ThreadPool& pool)
+{
+    co_await pool.schedule();
+    co_return std::this_thread::get_id();
+}
+
+Task<void> Test_ThrowAfterSleep(ThreadPool& pool)
+{
+    co_await pool.sleepFor(1);
+    throw std::runtime_error("coroutine failed");
+}
+
+///析构时增加count,放在协程帧中检查协程帧是否被销毁
+struct Test_FrameGuard
+{
+    std::atomic<int>& count;
+    ~Test_FrameGuard(){count++;}
+};
+
+///一直在sleepFor()中等待的协程,协程帧被销毁时增加destroyed
+Task<int> Test_SleepForever(ThreadPool& pool,std::atomic<int>& destroyed)
+{
+    Test_FrameGuard guard{destroyed};
+    co_await pool.sleepFor(60 * 1000);
+    co_return 0;
+}
+
+///schedule()切换到线程池的线程,sleepFor()至少等待指定的时间,协程中可以co_await TaskFuture,spawn()返回的TaskFuture得到协程的结果或者异常
+///线程池析构时还在sleepFor()中等待的协程被恢复并得到broken_promise,协程帧被释放,whenAll()不会一直等待
+bool Test_ThreadPoolCoroutine()
+{
+    bool ok = true;
+    {
+        ThreadPool pool;
+        const auto start = std::chrono::steady_clock::now();
+        ok = pool.spawn(Test_AwaitFuture(pool,2)).get() == 42 && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20);
+        ok = pool.spawn(Test_ResumedThread(pool)).get() != std::this_thread::get_id() && ok;
+        try
+        {
+            pool.spawn(Test_ThrowAfterSleep(pool)).get();
+            ok = false;
+        }
+        catch (const std::runtime_error&){}
+    }
+
+    std::atomic<int> destroyed{0};
+    TaskFuture<std::vector<int>> sleepers;
+    {
+        ThreadPool pool;
+        std::vector<TaskFuture<int>> futures;
+        for(int i = 0; i < 4; i++)
+            futures.push_back(pool.spawn(Test_SleepForever(pool,destroyed)));
+        sleepers = ThreadPool::whenAll(futures);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!sleepers.ready() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if(!sleepers.ready())
+        return false;
+    try
+    {
+        sleepers.get();
+        ok = false;
+    }
+    catch (const std::future_error& error)
+    {
+        ok = error.code() == std::future_errc::broken_promise && ok;
+    }
+    return ok && destroyed == 4;
+}
+
+///1万个协程共享线程池中的线程,如果每个处理器独占一个线程则需要1万个线程
+void Bench_ThreadPoolCoroutine()
+{
+    const int count = 10000;
+    ThreadPool pool;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<TaskFuture<int>> handlers;
+    handlers.reserve(count);
+    for(int i = 0; i < count; i++)
+        handlers.push_back(pool.spawn(Bench_ProtocolHandler(pool,i)));
+    ThreadPool::whenAll(handlers).wait();
+
+    std::chrono::duration<double,std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout<<count<<" coroutine handlers (10 x 10ms sleep each):"<<elapsed.count()<<"ms"<<std::endl;
+}
+#endif
+
 #endif // TESTDEMO_H